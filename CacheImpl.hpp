@@ -1,276 +1,5523 @@
 #ifndef CACHES_CACHEIMPL_HPP
 #define CACHES_CACHEIMPL_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
 #include <list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <optional>
 #include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace CacheImpl {
-template <typename K, typename V> class Cache {
+namespace detail {
+// Batched operations handle their keys in groups of this size, probing every
+// key of a group before resolving any so that their cache misses overlap
+constexpr std::size_t BATCH_SIZE = 16;
+
+inline void prefetch(const void *address) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(address);
+#else
+  (void)address;
+#endif
+}
+
+// Whether a hash or an equality functor also accepts keys of other types
+template <typename Functor, typename = void>
+struct IsTransparent : std::false_type {};
+
+template <typename Functor>
+struct IsTransparent<Functor, std::void_t<typename Functor::is_transparent>>
+    : std::true_type {};
+
+// Transparent hashes get a transparent equality, so that an index can compare
+// keys of other types without converting them
+template <typename K, typename Hash>
+using KeyEqualFor =
+    typename std::conditional<IsTransparent<Hash>::value, std::equal_to<>,
+                              std::equal_to<K>>::type;
+
+// 'Allocator' rebound to allocate objects of type T, as containers do for
+// their nodes
+template <typename Allocator, typename T>
+using Rebind =
+    typename std::allocator_traits<Allocator>::template rebind_alloc<T>;
+} // namespace detail
+
+// An open-addressing hash map in the style of Swiss tables, which can replace
+// std::unordered_map as the index of the caches. Slots come in groups of 16
+// with one control byte per slot holding 7 bits of the hash of its key, so a
+// single SSE2 comparison finds the candidate slots of a whole group. A lookup
+// usually reads one group of control bytes and one slot. Inserting may move
+// the elements and invalidate all iterators; erasing invalidates only
+// iterators to the erased element. 'Allocator' provides the memory of the
+// slots and of the control bytes.
+template <typename K, typename T, typename Hash = std::hash<K>,
+          typename KeyEqual = std::equal_to<K>,
+          typename Allocator = std::allocator<std::pair<const K, T>>>
+class FlatHashMap {
+public:
+  using key_type = K;
+  using mapped_type = T;
+  using value_type = std::pair<const K, T>;
+  using size_type = std::size_t;
+  using hasher = Hash;
+  using key_equal = KeyEqual;
+  using allocator_type = Allocator;
+
+private:
+  static constexpr std::size_t GROUP_SIZE = 16;
+  static constexpr std::int8_t EMPTY = -128;
+  static constexpr std::int8_t DELETED = -2;
+
+  // Lookups take keys of other types only when both functors are transparent
+  template <typename Key>
+  using EnableIfLookupKey = typename std::enable_if<
+      std::is_same<Key, K>::value || (detail::IsTransparent<Hash>::value &&
+                                      detail::IsTransparent<KeyEqual>::value),
+      int>::type;
+
+  // Each method returns a mask whose bit i is set when slot i of the group
+  // matches
+  class Group {
+  private:
+    const std::int8_t *m_ctrl;
+
+  public:
+    explicit Group(const std::int8_t *ctrl) : m_ctrl(ctrl) {}
+
+    std::uint32_t match(std::int8_t h2) const {
+#ifdef __SSE2__
+      __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(m_ctrl));
+      return static_cast<std::uint32_t>(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl)));
+#else
+      std::uint32_t mask = 0;
+      for (std::size_t i = 0; i < GROUP_SIZE; ++i) {
+        mask |= (m_ctrl[i] == h2 ? 1U : 0U) << i;
+      }
+      return mask;
+#endif
+    }
+
+    std::uint32_t matchEmpty() const { return match(EMPTY); }
+
+    // Empty and deleted slots are the ones an insertion can take
+    std::uint32_t matchAvailable() const {
+#ifdef __SSE2__
+      __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(m_ctrl));
+      return static_cast<std::uint32_t>(
+          _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), ctrl)));
+#else
+      std::uint32_t mask = 0;
+      for (std::size_t i = 0; i < GROUP_SIZE; ++i) {
+        mask |= (m_ctrl[i] < -1 ? 1U : 0U) << i;
+      }
+      return mask;
+#endif
+    }
+  };
+
+  template <bool IsConst> class Iterator {
+  private:
+    friend class FlatHashMap;
+    using Map = typename std::conditional<IsConst, const FlatHashMap,
+                                          FlatHashMap>::type;
+
+    Map *m_map;
+    std::size_t m_index;
+
+    Iterator(Map *map, std::size_t index) : m_map(map), m_index(index) {}
+
+    void skipFreeSlots() {
+      while (m_index < m_map->capacity() && m_map->m_ctrl[m_index] < 0) {
+        ++m_index;
+      }
+    }
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = typename FlatHashMap::value_type;
+    using difference_type = std::ptrdiff_t;
+    using reference = typename std::conditional<IsConst, const value_type &,
+                                                value_type &>::type;
+    using pointer = typename std::conditional<IsConst, const value_type *,
+                                              value_type *>::type;
+
+    Iterator() : m_map(nullptr), m_index(0) {}
+
+    // Allows the conversion from iterator to const_iterator
+    template <bool WasConst, typename = typename std::enable_if<
+                                 IsConst && !WasConst>::type>
+    Iterator(const Iterator<WasConst> &other)
+        : m_map(other.m_map), m_index(other.m_index) {}
+
+    reference operator*() const { return m_map->m_slots[m_index]; }
+
+    pointer operator->() const { return &m_map->m_slots[m_index]; }
+
+    Iterator &operator++() {
+      ++m_index;
+      skipFreeSlots();
+      return *this;
+    }
+
+    Iterator operator++(int) {
+      Iterator previous = *this;
+      ++*this;
+      return previous;
+    }
+
+    friend bool operator==(const Iterator &lhs, const Iterator &rhs) {
+      return lhs.m_index == rhs.m_index;
+    }
+
+    friend bool operator!=(const Iterator &lhs, const Iterator &rhs) {
+      return lhs.m_index != rhs.m_index;
+    }
+  };
+
+  using SlotTraits = std::allocator_traits<Allocator>;
+  using CtrlAllocator = detail::Rebind<Allocator, std::int8_t>;
+  using CtrlTraits = std::allocator_traits<CtrlAllocator>;
+
+  Hash m_hasher;
+  KeyEqual m_equal;
+  Allocator m_allocator;
+  // 'm_ctrl' points to a shared group of empty slots until the first insertion
+  std::int8_t *m_ctrl;
+  value_type *m_slots;
+  std::size_t m_groupMask;
+  std::size_t m_size;
+  // How many more elements can go into empty slots before the load factor
+  // exceeds 7/8; deleted slots do not give room back
+  std::size_t m_growthLeft;
+
+  static std::int8_t *emptyGroup() {
+    alignas(GROUP_SIZE) static std::int8_t group[GROUP_SIZE] = {
+        EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY,
+        EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY};
+    return group;
+  }
+
+  static std::size_t maxLoad(std::size_t capacity) {
+    return capacity - capacity / 8;
+  }
+
+  static std::size_t lowestBit(std::uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<std::size_t>(__builtin_ctz(mask));
+#else
+    std::size_t index = 0;
+    while ((mask & 1U) == 0) {
+      mask >>= 1;
+      ++index;
+    }
+    return index;
+#endif
+  }
+
+  // Returns the first slot on the probe sequence of 'hash' that an insertion
+  // can take
+  std::size_t findAvailable(std::size_t hash) const {
+    std::size_t group = (hash >> 7) & m_groupMask;
+    for (std::size_t step = 1;; ++step) {
+      std::uint32_t mask = Group(m_ctrl + group * GROUP_SIZE).matchAvailable();
+      if (mask != 0) {
+        return group * GROUP_SIZE + lowestBit(mask);
+      }
+      group = (group + step) & m_groupMask;
+    }
+  }
+
+  void rehash(std::size_t groupCount) {
+    std::int8_t *ctrl = m_ctrl;
+    value_type *slots = m_slots;
+    std::size_t capacity = this->capacity();
+    CtrlAllocator ctrlAllocator(m_allocator);
+    m_ctrl = CtrlTraits::allocate(ctrlAllocator, groupCount * GROUP_SIZE);
+    std::fill(m_ctrl, m_ctrl + groupCount * GROUP_SIZE, EMPTY);
+    m_slots = SlotTraits::allocate(m_allocator, groupCount * GROUP_SIZE);
+    m_groupMask = groupCount - 1;
+    m_growthLeft = maxLoad(groupCount * GROUP_SIZE) - m_size;
+    for (std::size_t i = 0; i < capacity; ++i) {
+      if (ctrl[i] >= 0) {
+        std::size_t hash = hashOf(slots[i].first);
+        std::size_t index = findAvailable(hash);
+        m_ctrl[index] = static_cast<std::int8_t>(hash & 0x7f);
+        new (m_slots + index) value_type(std::move(slots[i]));
+        slots[i].~value_type();
+      }
+    }
+    if (slots != nullptr) {
+      deallocate(ctrl, slots, capacity);
+    }
+  }
+
+  void deallocate(std::int8_t *ctrl, value_type *slots, std::size_t capacity) {
+    CtrlAllocator ctrlAllocator(m_allocator);
+    CtrlTraits::deallocate(ctrlAllocator, ctrl, capacity);
+    SlotTraits::deallocate(m_allocator, slots, capacity);
+  }
+
+  // Rehashes without reallocating, so that the deleted slots become empty
+  void dropDeleted() {
+    // Until its element has been placed again, a full slot is marked deleted
+    for (std::size_t i = 0; i < capacity(); ++i) {
+      m_ctrl[i] = m_ctrl[i] >= 0 ? DELETED : EMPTY;
+    }
+    for (std::size_t i = 0; i < capacity(); ++i) {
+      if (m_ctrl[i] != DELETED) {
+        continue;
+      }
+      std::size_t hash = hashOf(m_slots[i].first);
+      std::size_t target = findAvailable(hash);
+      auto h2 = static_cast<std::int8_t>(hash & 0x7f);
+      if (target / GROUP_SIZE == i / GROUP_SIZE) {
+        // A lookup reaches this group first, so the element can stay
+        m_ctrl[i] = h2;
+      } else if (m_ctrl[target] == EMPTY) {
+        new (m_slots + target) value_type(std::move(m_slots[i]));
+        m_slots[i].~value_type();
+        m_ctrl[target] = h2;
+        m_ctrl[i] = EMPTY;
+      } else {
+        // The target holds an element not placed yet: swap the two and place
+        // the one that lands in slot i next
+        value_type displaced(std::move(m_slots[target]));
+        m_slots[target].~value_type();
+        new (m_slots + target) value_type(std::move(m_slots[i]));
+        m_slots[i].~value_type();
+        new (m_slots + i) value_type(std::move(displaced));
+        m_ctrl[target] = h2;
+        --i;
+      }
+    }
+    m_growthLeft = maxLoad(capacity()) - m_size;
+  }
+
+  // Makes room for one more element, either by dropping the deleted slots or
+  // by doubling the number of groups
+  void grow() {
+    if (m_slots == nullptr) {
+      rehash(1);
+    } else if (m_size * 2 <= maxLoad(capacity())) {
+      dropDeleted();
+    } else {
+      rehash((m_groupMask + 1) * 2);
+    }
+  }
+
+  void insertAll(const FlatHashMap &other) {
+    reserve(other.size());
+    for (const auto &element : other) {
+      emplace(element.first, element.second);
+    }
+  }
+
+  void destroyAll() {
+    if (m_slots == nullptr) {
+      return;
+    }
+    for (std::size_t i = 0; i < capacity(); ++i) {
+      if (m_ctrl[i] >= 0) {
+        m_slots[i].~value_type();
+      }
+    }
+  }
+
+  // Exchanges everything but the allocators
+  void swapSlots(FlatHashMap &other) noexcept {
+    std::swap(m_hasher, other.m_hasher);
+    std::swap(m_equal, other.m_equal);
+    std::swap(m_ctrl, other.m_ctrl);
+    std::swap(m_slots, other.m_slots);
+    std::swap(m_groupMask, other.m_groupMask);
+    std::swap(m_size, other.m_size);
+    std::swap(m_growthLeft, other.m_growthLeft);
+  }
+
+public:
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  explicit FlatHashMap(const Hash &hash = Hash(),
+                       const KeyEqual &equal = KeyEqual(),
+                       const Allocator &allocator = Allocator())
+      : m_hasher(hash), m_equal(equal), m_allocator(allocator),
+        m_ctrl(emptyGroup()), m_slots(nullptr), m_groupMask(0), m_size(0),
+        m_growthLeft(0) {}
+
+  explicit FlatHashMap(const Allocator &allocator)
+      : FlatHashMap(Hash(), KeyEqual(), allocator) {}
+
+  FlatHashMap(const FlatHashMap &other)
+      : FlatHashMap(other.m_hasher, other.m_equal,
+                    SlotTraits::select_on_container_copy_construction(
+                        other.m_allocator)) {
+    insertAll(other);
+  }
+
+  // The allocator moves along with the slots, as in the std containers
+  FlatHashMap(FlatHashMap &&other) noexcept
+      : m_hasher(other.m_hasher), m_equal(other.m_equal),
+        m_allocator(std::move(other.m_allocator)),
+        m_ctrl(std::exchange(other.m_ctrl, emptyGroup())),
+        m_slots(std::exchange(other.m_slots, nullptr)),
+        m_groupMask(std::exchange(other.m_groupMask, 0)),
+        m_size(std::exchange(other.m_size, 0)),
+        m_growthLeft(std::exchange(other.m_growthLeft, 0)) {}
+
+  // Assignments keep the allocator of this map, as std::pmr containers do
+  FlatHashMap &operator=(const FlatHashMap &other) {
+    if (this != &other) {
+      clear();
+      m_hasher = other.m_hasher;
+      m_equal = other.m_equal;
+      insertAll(other);
+    }
+    return *this;
+  }
+
+  // A map can hand over its slots along with an allocator that propagates, or
+  // to a map with an equal allocator; otherwise the elements are moved one by
+  // one
+  FlatHashMap &operator=(FlatHashMap &&other) {
+    if constexpr (SlotTraits::propagate_on_container_move_assignment::value) {
+      FlatHashMap moved(std::move(other));
+      swapSlots(moved);
+      std::swap(m_allocator, moved.m_allocator);
+    } else if (m_allocator == other.m_allocator) {
+      FlatHashMap moved(std::move(other));
+      swap(moved);
+    } else {
+      clear();
+      m_hasher = other.m_hasher;
+      m_equal = other.m_equal;
+      reserve(other.size());
+      for (auto &element : other) {
+        emplace(element.first, std::move(element.second));
+      }
+      other.clear();
+    }
+    return *this;
+  }
+
+  ~FlatHashMap() {
+    destroyAll();
+    if (m_slots != nullptr) {
+      deallocate(m_ctrl, m_slots, capacity());
+    }
+  }
+
+  // The allocators are exchanged only if they propagate on swap; otherwise
+  // they must compare equal
+  void swap(FlatHashMap &other) noexcept {
+    if constexpr (SlotTraits::propagate_on_container_swap::value) {
+      std::swap(m_allocator, other.m_allocator);
+    }
+    swapSlots(other);
+  }
+
+  iterator begin() {
+    iterator iter(this, 0);
+    iter.skipFreeSlots();
+    return iter;
+  }
+
+  const_iterator begin() const {
+    const_iterator iter(this, 0);
+    iter.skipFreeSlots();
+    return iter;
+  }
+
+  iterator end() { return iterator(this, capacity()); }
+
+  const_iterator end() const { return const_iterator(this, capacity()); }
+
+  std::size_t size() const { return m_size; }
+
+  bool empty() const { return m_size == 0; }
+
+  std::size_t capacity() const {
+    return m_slots == nullptr ? 0 : (m_groupMask + 1) * GROUP_SIZE;
+  }
+
+  hasher hash_function() const { return m_hasher; }
+
+  allocator_type get_allocator() const { return m_allocator; }
+
+  key_equal key_eq() const { return m_equal; }
+
+  // The hash of 'key' as used to place it, mixed so that weak hashes such as
+  // the identity std::hash<int> still spread over the groups
+  template <typename Key, EnableIfLookupKey<Key> = 0>
+  std::size_t hashOf(const Key &key) const {
+    auto hash = static_cast<std::uint64_t>(m_hasher(key));
+    hash *= 0x9e3779b97f4a7c15ULL;
+    return static_cast<std::size_t>(hash ^ (hash >> 32));
+  }
+
+  // Fetches the first group probed for 'hash' into the CPU cache, so that a
+  // batch of lookups can overlap their cache misses
+  void prefetch(std::size_t hash) const {
+    detail::prefetch(m_ctrl + ((hash >> 7) & m_groupMask) * GROUP_SIZE);
+  }
+
+  template <typename Key, EnableIfLookupKey<Key> = 0>
+  iterator find(const Key &key, std::size_t hash) {
+    std::size_t group = (hash >> 7) & m_groupMask;
+    auto h2 = static_cast<std::int8_t>(hash & 0x7f);
+    for (std::size_t step = 1;; ++step) {
+      Group candidates(m_ctrl + group * GROUP_SIZE);
+      for (std::uint32_t mask = candidates.match(h2); mask != 0;
+           mask &= mask - 1) {
+        std::size_t index = group * GROUP_SIZE + lowestBit(mask);
+        if (m_equal(m_slots[index].first, key)) {
+          return iterator(this, index);
+        }
+      }
+      // The key would have been placed in the first empty slot on its way
+      if (candidates.matchEmpty() != 0) {
+        return end();
+      }
+      group = (group + step) & m_groupMask;
+    }
+  }
+
+  template <typename Key, EnableIfLookupKey<Key> = 0>
+  iterator find(const Key &key) {
+    return find(key, hashOf(key));
+  }
+
+  template <typename Key, EnableIfLookupKey<Key> = 0>
+  const_iterator find(const Key &key) const {
+    return const_cast<FlatHashMap *>(this)->find(key);
+  }
+
+  template <typename Key, EnableIfLookupKey<Key> = 0>
+  std::size_t count(const Key &key) const {
+    return find(key) == end() ? 0 : 1;
+  }
+
+  template <typename... Args>
+  std::pair<iterator, bool> emplace(const K &key, Args &&...args) {
+    std::size_t hash = hashOf(key);
+    auto iter = find(key, hash);
+    if (iter != end()) {
+      return std::make_pair(iter, false);
+    }
+    std::size_t index = findAvailable(hash);
+    if (m_ctrl[index] == EMPTY && m_growthLeft == 0) {
+      grow();
+      index = findAvailable(hash);
+    }
+    new (m_slots + index) value_type(std::piecewise_construct,
+                                     std::forward_as_tuple(key),
+                                     std::forward_as_tuple(
+                                         std::forward<Args>(args)...));
+    m_growthLeft -= m_ctrl[index] == EMPTY ? 1 : 0;
+    m_ctrl[index] = static_cast<std::int8_t>(hash & 0x7f);
+    ++m_size;
+    return std::make_pair(iterator(this, index), true);
+  }
+
+  std::pair<iterator, bool> insert(const value_type &value) {
+    return emplace(value.first, value.second);
+  }
+
+  T &operator[](const K &key) { return emplace(key).first->second; }
+
+  void erase(iterator position) {
+    std::size_t index = position.m_index;
+    m_slots[index].~value_type();
+    --m_size;
+    // A group with an empty slot ends every probe sequence that reaches it,
+    // so no other key can depend on this slot being occupied
+    if (Group(m_ctrl + index / GROUP_SIZE * GROUP_SIZE).matchEmpty() != 0) {
+      m_ctrl[index] = EMPTY;
+      ++m_growthLeft;
+    } else {
+      m_ctrl[index] = DELETED;
+    }
+  }
+
+  template <typename Key, EnableIfLookupKey<Key> = 0>
+  std::size_t erase(const Key &key) {
+    auto iter = find(key);
+    if (iter == end()) {
+      return 0;
+    }
+    erase(iter);
+    return 1;
+  }
+
+  void clear() {
+    if (m_slots == nullptr) {
+      return;
+    }
+    destroyAll();
+    std::fill(m_ctrl, m_ctrl + capacity(), EMPTY);
+    m_size = 0;
+    m_growthLeft = maxLoad(capacity());
+  }
+
+  // Makes room for 'count' elements without further rehashing
+  void reserve(std::size_t count) {
+    std::size_t groupCount = 1;
+    while (maxLoad(groupCount * GROUP_SIZE) < count) {
+      groupCount *= 2;
+    }
+    if (groupCount * GROUP_SIZE > capacity()) {
+      rehash(groupCount);
+    }
+  }
+};
+
+// The caches take one of these as their 'Index' parameter to choose the hash
+// map that finds their entries by key
+struct UnorderedMapIndex {
+  template <typename K, typename T, typename Hash,
+            typename Allocator = std::allocator<std::pair<const K, T>>>
+  using map =
+      std::unordered_map<K, T, Hash, detail::KeyEqualFor<K, Hash>, Allocator>;
+};
+
+struct FlatHashMapIndex {
+  template <typename K, typename T, typename Hash,
+            typename Allocator = std::allocator<std::pair<const K, T>>>
+  using map = FlatHashMap<K, T, Hash, detail::KeyEqualFor<K, Hash>, Allocator>;
+};
+
+// A transparent hash for std::string keys. With FlatHashMapIndex, it lets the
+// caches look up a std::string_view or a string literal without building a
+// std::string for it.
+struct StringHash {
+  using is_transparent = void;
+
+  std::size_t operator()(std::string_view key) const {
+    return std::hash<std::string_view>()(key);
+  }
+};
+
+// The default weigher of the policies, under which every entry weighs one and
+// the capacity counts entries. A weigher taking the key and the value and
+// returning, say, their size in bytes turns the capacity into a byte budget:
+// put() then evicts as many entries as the new one needs, and does not cache
+// an entry heavier than the whole capacity. The weight of an entry is taken
+// when it is put, so values changed through getPtr() keep their weight.
+struct UnitWeigher {
+  template <typename K, typename V>
+  std::size_t operator()(const K &, const V &) const {
+    return 1;
+  }
+};
+
+namespace detail {
+// Looks up 'size' keys in 'map', probing all of them before returning any
+template <typename Map, typename Key>
+void findAll(Map &map, const Key *keys, std::size_t size,
+             typename Map::iterator *iters) {
+  for (std::size_t i = 0; i < size; ++i) {
+    iters[i] = map.find(keys[i]);
+  }
+}
+
+// A FlatHashMap hashes every key and prefetches its group first
+template <typename K, typename T, typename Hash, typename KeyEqual,
+          typename Allocator, typename Key>
+void findAll(FlatHashMap<K, T, Hash, KeyEqual, Allocator> &map,
+             const Key *keys, std::size_t size,
+             typename FlatHashMap<K, T, Hash, KeyEqual, Allocator>::iterator
+                 *iters) {
+  std::size_t hashes[BATCH_SIZE];
+  for (std::size_t i = 0; i < size; ++i) {
+    hashes[i] = map.hashOf(keys[i]);
+    map.prefetch(hashes[i]);
+  }
+  for (std::size_t i = 0; i < size; ++i) {
+    iters[i] = map.find(keys[i], hashes[i]);
+  }
+}
+
+// Whether 'map' can look up a 'Key' without converting it to its key type
+template <typename Map, typename Key>
+struct HasHeterogeneousLookup : std::false_type {};
+
+template <typename K, typename T, typename Hash, typename KeyEqual,
+          typename Allocator, typename Key>
+struct HasHeterogeneousLookup<FlatHashMap<K, T, Hash, KeyEqual, Allocator>,
+                              Key>
+    : std::integral_constant<bool, IsTransparent<Hash>::value &&
+                                       IsTransparent<KeyEqual>::value> {};
+
+#ifdef __cpp_lib_generic_unordered_lookup
+template <typename K, typename T, typename Hash, typename KeyEqual,
+          typename Allocator, typename Key>
+struct HasHeterogeneousLookup<
+    std::unordered_map<K, T, Hash, KeyEqual, Allocator>, Key>
+    : std::integral_constant<bool, IsTransparent<Hash>::value &&
+                                       IsTransparent<KeyEqual>::value> {};
+#endif
+
+// Finds 'key' in 'map', converting it to the key type of 'map' only if the map
+// cannot compare it directly
+template <typename Map, typename Key> auto findKey(Map &map, const Key &key) {
+  using Mutable = typename std::remove_const<Map>::type;
+  using KeyType = typename Mutable::key_type;
+  if constexpr (std::is_same<Key, KeyType>::value ||
+                HasHeterogeneousLookup<Mutable, Key>::value) {
+    return map.find(key);
+  } else {
+    return map.find(static_cast<KeyType>(key));
+  }
+}
+
+template <typename V> V valueOrThrow(const V *value) {
+  if (value == nullptr) {
+    throw std::invalid_argument(
+        "Key is not found!"); // throw an exception that indicates 'not found'
+  }
+  return *value;
+}
+
+template <typename V> std::optional<V> valueOrNothing(const V *value) {
+  if (value == nullptr) {
+    return std::nullopt;
+  }
+  return *value;
+}
+
+// Moves the element of 'oldKey' to 'newKey', which must not be in 'map'
+template <typename Map, typename Key>
+void rekey(Map &map, const Key &oldKey, const Key &newKey) {
+  auto iter = map.find(oldKey);
+  auto mapped = std::move(iter->second);
+  map.erase(iter);
+  map.emplace(newKey, std::move(mapped));
+}
+
+// std::unordered_map can relink the same node under the new key instead. A
+// node handle keeps a copy of the allocator, which libstdc++ does not always
+// destroy, so an allocator that owns something, such as PoolAllocator, takes
+// the generic path; its freed node is the one the new key gets
+template <typename K, typename T, typename Hash, typename KeyEqual,
+          typename Allocator, typename Key>
+void rekey(std::unordered_map<K, T, Hash, KeyEqual, Allocator> &map,
+           const Key &oldKey, const Key &newKey) {
+  if constexpr (std::is_trivially_destructible<Allocator>::value) {
+    auto handle = map.extract(oldKey);
+    handle.key() = newKey;
+    map.insert(std::move(handle));
+  } else {
+    auto iter = map.find(oldKey);
+    auto mapped = std::move(iter->second);
+    map.erase(iter);
+    map.emplace(newKey, std::move(mapped));
+  }
+}
+
+// The most entries a cache reserves room for up front. A larger capacity may
+// never fill, e.g. std::numeric_limits<std::size_t>::max() for a cache that
+// is never full, so its containers grow past that as the entries come.
+constexpr std::size_t MAX_RESERVED_ENTRIES = std::size_t(1) << 16;
+
+// The smallest power of two, and at least 16, that is not below 'count'.
+// Throws std::length_error rather than overflow once that is over 'limit',
+// e.g. the max_size() of the ring
+inline std::size_t ringSizeFor(std::size_t count, std::size_t limit) {
+  std::size_t size = 16;
+  while (size < count) {
+    if (size > limit / 2) {
+      throw std::length_error("Ring buffer is too large!");
+    }
+    size *= 2;
+  }
+  return size;
+}
+
+// A FIFO queue in a ring buffer of a power of two of elements, which doubles
+// when full. Popped elements stay in the buffer until they are overwritten,
+// so T should be cheap to keep, e.g. an index. The buffer takes its memory
+// from 'Allocator'
+template <typename T, typename Allocator = std::allocator<T>> class RingBuffer {
+private:
+  std::vector<T, Allocator> m_items;
+  std::size_t m_head;
+  std::size_t m_size;
+
+  void grow(std::size_t count) {
+    std::vector<T, Allocator> items(count, m_items.get_allocator());
+    for (std::size_t i = 0; i < m_size; ++i) {
+      items[i] = std::move((*this)[i]);
+    }
+    m_items.swap(items);
+    m_head = 0;
+  }
+
+public:
+  explicit RingBuffer(const Allocator &allocator = Allocator())
+      : m_items(allocator), m_head(0), m_size(0) {}
+
+  RingBuffer(const RingBuffer &) = default;
+
+  // A buffer moved from is left empty and without storage, as a vector is. A
+  // move assignment between unequal allocators moves the elements one by one
+  RingBuffer(RingBuffer &&other) noexcept
+      : m_items(std::move(other.m_items)),
+        m_head(std::exchange(other.m_head, 0)),
+        m_size(std::exchange(other.m_size, 0)) {}
+
+  RingBuffer &operator=(const RingBuffer &) = default;
+
+  RingBuffer &operator=(RingBuffer &&other) {
+    if (this != &other) {
+      m_items = std::move(other.m_items);
+      m_head = std::exchange(other.m_head, 0);
+      m_size = std::exchange(other.m_size, 0);
+    }
+    return *this;
+  }
+
+  std::size_t size() const { return m_size; }
+
+  bool empty() const { return m_size == 0; }
+
+  // The element 'index' places behind the front
+  T &operator[](std::size_t index) {
+    return m_items[(m_head + index) & (m_items.size() - 1)];
+  }
+
+  T &front() { return m_items[m_head]; }
+
+  // Makes room for 'count' elements, but for no more than
+  // MAX_RESERVED_ENTRIES up front, as each is built and touched; push_back()
+  // grows the buffer past that as it fills
+  void reserve(std::size_t count) {
+    std::size_t size = ringSizeFor(std::min(count, MAX_RESERVED_ENTRIES),
+                                   m_items.max_size());
+    if (size > m_items.size()) {
+      grow(size);
+    }
+  }
+
+  void push_back(const T &value) {
+    if (m_size == m_items.size()) {
+      grow(ringSizeFor(m_items.size() + 1, m_items.max_size()));
+    }
+    (*this)[m_size++] = value;
+  }
+
+  void pop_front() {
+    m_head = (m_head + 1) & (m_items.size() - 1);
+    --m_size;
+  }
+
+  // Drops the elements 'predicate' holds for, keeping the others in order
+  template <typename Predicate> void removeIf(Predicate predicate) {
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < m_size; ++i) {
+      if (!predicate((*this)[i])) {
+        (*this)[kept++] = std::move((*this)[i]);
+      }
+    }
+    m_size = kept;
+  }
+
+  void clear() {
+    m_head = 0;
+    m_size = 0;
+  }
+};
+
+// The weight an entry was put with, as a base of the entry. Under UnitWeigher
+// every entry weighs one, and the base is empty
+template <typename Weigher> class EntryWeight {
+private:
+  std::size_t m_weight = 0;
+
+public:
+  std::size_t getWeight() const { return m_weight; }
+
+  void setWeight(std::size_t weight) { m_weight = weight; }
+};
+
+template <> class EntryWeight<UnitWeigher> {
+public:
+  static constexpr std::size_t getWeight() { return 1; }
+
+  void setWeight(std::size_t) {}
+};
+
+// The entries of the policies that keep std::pair<K, V> in a list. The value
+// is constructed in place from 'args'
+template <typename K, typename V, typename Weigher>
+struct WeightedPair : std::pair<K, V>, EntryWeight<Weigher> {
+  template <typename Key, typename... Args>
+  WeightedPair(std::size_t weight, Key &&key, Args &&...args)
+      : std::pair<K, V>(std::piecewise_construct,
+                        std::forward_as_tuple(std::forward<Key>(key)),
+                        std::forward_as_tuple(std::forward<Args>(args)...)) {
+    this->setWeight(weight);
+  }
+};
+
+// Assigns a value built from 'args' to 'value', or the argument itself when
+// it already is a V
+template <typename V, typename... Args> void assign(V &value, Args &&...args) {
+  if constexpr (sizeof...(Args) == 1 &&
+                (std::is_same<typename std::decay<Args>::type, V>::value &&
+                 ...)) {
+    value = (std::forward<Args>(args), ...);
+  } else {
+    value = V(std::forward<Args>(args)...);
+  }
+}
+
+// Destroys 'object' and builds another from 'args' in its storage, which an
+// assignment from a value built from 'args' would need a temporary for. Only
+// for constructions that cannot throw, as a failed one would leave no object
+// behind
+template <typename T, typename... Args> void rebuild(T &object, Args &&...args) {
+  object.~T();
+  new (static_cast<void *>(std::addressof(object)))
+      T(std::forward<Args>(args)...);
+}
+
+// Calls 'store(key, weight, args...)', the core of a policy's emplace(), with
+// the weight of the entry built from 'key' and 'args'. UnitWeigher needs no
+// value for that, so the policy makes room first and then constructs the
+// value in place. Other weighers weigh a value built up front, which is then
+// moved into place. A key of another type is converted to K first.
+template <typename K, typename V, typename Weigher, typename Store,
+          typename Key, typename... Args>
+void emplaceWeighed(Store &&store, Key &&key, Args &&...args) {
+  if constexpr (!std::is_same<typename std::decay<Key>::type, K>::value) {
+    emplaceWeighed<K, V, Weigher>(store, K(std::forward<Key>(key)),
+                                  std::forward<Args>(args)...);
+  } else if constexpr (std::is_same<Weigher, UnitWeigher>::value) {
+    store(std::forward<Key>(key), std::size_t(1), std::forward<Args>(args)...);
+  } else {
+    V value(std::forward<Args>(args)...);
+    std::size_t weight = Weigher()(key, value);
+    store(std::forward<Key>(key), weight, std::move(value));
+  }
+}
+
+// The number of entries to reserve room for up front, which is only known
+// when the capacity counts entries, and is at most MAX_RESERVED_ENTRIES
+template <typename Weigher> std::size_t entriesFor(std::size_t capacity) {
+  return std::is_same<Weigher, UnitWeigher>::value
+             ? std::min(capacity, MAX_RESERVED_ENTRIES)
+             : 0;
+}
+} // namespace detail
+
+// An arena of the nodes of a cache. Blocks of up to MAX_POOLED bytes are
+// grouped in size classes of GRANULE bytes; a freed block goes on the free
+// list of its class, linked through its first word, and the next allocation
+// of that class takes it back. A class without free blocks hands out the
+// next block of its latest chunk, and takes a new chunk from 'upstream' once
+// that is used up. The first chunk of a class of nodes, i.e. of blocks that
+// hold one object each, holds the number of blocks given to expect(), i.e.
+// the entries the cache reserves room for; other classes, such as those of
+// small bucket arrays, start with MIN_CHUNK_BLOCKS. Later chunks double the
+// blocks of the class. Pages of a chunk are touched only as its blocks are
+// handed out, so reserving for the capacity costs no memory until the cache
+// fills. Larger or over-aligned blocks go to 'upstream' directly.
+class NodePool {
 private:
+  static constexpr std::size_t GRANULE = alignof(std::max_align_t);
+  static constexpr std::size_t MAX_POOLED = 512;
+  static constexpr std::size_t MIN_CHUNK_BLOCKS = 16;
+
+  // Each chunk starts with its header, padded to a granule
+  struct Chunk {
+    Chunk *m_next;
+    std::size_t m_bytes;
+  };
+
+  static_assert(sizeof(Chunk) <= GRANULE, "a chunk header fits in a granule");
+
+  struct SizeClass {
+    void *m_free = nullptr;
+    char *m_next = nullptr;
+    char *m_end = nullptr;
+    std::size_t m_blocks = 0;
+    // Whether the class holds nodes, which expect() sizes
+    bool m_nodes = false;
+  };
+
+  std::pmr::memory_resource *m_upstream;
+  Chunk *m_chunks;
+  std::size_t m_expected;
+  SizeClass m_classes[MAX_POOLED / GRANULE];
+
+  static bool isPooled(std::size_t bytes, std::size_t alignment) {
+    return bytes <= MAX_POOLED && alignment <= GRANULE;
+  }
+
+  static std::size_t classOf(std::size_t bytes) {
+    return bytes == 0 ? 0 : (bytes - 1) / GRANULE;
+  }
+
+  void refill(SizeClass &sizeClass, std::size_t blockSize) {
+    std::size_t count = std::max(sizeClass.m_blocks, MIN_CHUNK_BLOCKS);
+    if (sizeClass.m_nodes && m_expected > sizeClass.m_blocks) {
+      count = std::max(count, m_expected - sizeClass.m_blocks);
+    }
+    std::size_t bytes = GRANULE + count * blockSize;
+    void *memory = m_upstream->allocate(bytes, GRANULE);
+    m_chunks = new (memory) Chunk{m_chunks, bytes};
+    sizeClass.m_next = static_cast<char *>(memory) + GRANULE;
+    sizeClass.m_end = sizeClass.m_next + count * blockSize;
+    sizeClass.m_blocks += count;
+  }
+
+public:
+  explicit NodePool(
+      std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+      : m_upstream(upstream), m_chunks(nullptr), m_expected(0) {}
+
+  NodePool(const NodePool &) = delete;
+
+  NodePool &operator=(const NodePool &) = delete;
+
+  ~NodePool() { release(); }
+
+  // Sizes the chunks still to come for 'count' blocks of each class of nodes
+  void expect(std::size_t count) { m_expected = count; }
+
+  // 'node' tells that the block holds a single node of the cache, which puts
+  // its class among those expect() sizes
+  void *allocate(std::size_t bytes, std::size_t alignment, bool node = false) {
+    if (!isPooled(bytes, alignment)) {
+      return m_upstream->allocate(bytes, alignment);
+    }
+    std::size_t index = classOf(bytes);
+    SizeClass &sizeClass = m_classes[index];
+    sizeClass.m_nodes = sizeClass.m_nodes || node;
+    if (void *block = sizeClass.m_free) {
+      sizeClass.m_free = *static_cast<void **>(block);
+      return block;
+    }
+    std::size_t blockSize = (index + 1) * GRANULE;
+    if (sizeClass.m_next == sizeClass.m_end) {
+      refill(sizeClass, blockSize);
+    }
+    void *block = sizeClass.m_next;
+    sizeClass.m_next += blockSize;
+    return block;
+  }
+
+  void deallocate(void *memory, std::size_t bytes, std::size_t alignment) {
+    if (!isPooled(bytes, alignment)) {
+      m_upstream->deallocate(memory, bytes, alignment);
+      return;
+    }
+    SizeClass &sizeClass = m_classes[classOf(bytes)];
+    *static_cast<void **>(memory) = sizeClass.m_free;
+    sizeClass.m_free = memory;
+  }
+
+  // Gives all of the chunks back upstream; no block may still be in use
+  void release() {
+    while (m_chunks != nullptr) {
+      Chunk *chunk = m_chunks;
+      m_chunks = chunk->m_next;
+      m_upstream->deallocate(chunk, chunk->m_bytes, GRANULE);
+    }
+    std::fill(std::begin(m_classes), std::end(m_classes), SizeClass());
+  }
+};
+
+// The default allocator of the caches. A default-constructed PoolAllocator
+// starts a NodePool of its own, which its copies and rebound copies share, so
+// all of the nodes of a cache come from one pool. The lists of a cache splice
+// nodes between each other, so the pool goes along when a cache is moved or
+// swapped. A container copied from one using the pool starts a pool of its
+// own, so a copy of a cache never shares a pool with the original. The
+// policies whose index holds iterators into their lists, such as
+// BasicLRUCache, cannot be copied at all, only moved.
+//
+// NodePool is not thread-safe, so a cache moved from must not keep sharing
+// the pool of the cache it was moved to. A moved-from PoolAllocator has no
+// pool and allocates from the heap, as std::allocator does. Its copies
+// compare equal, so the lists of a moved-from cache still splice nodes
+// between each other. A fresh pool per allocator would break that, since
+// each container moves its own allocator. A move assignment swaps the pools
+// instead, which leaves the target's old pool to the source alone.
+template <typename T> class PoolAllocator {
+private:
+  template <typename U> friend class PoolAllocator;
+
+  std::shared_ptr<NodePool> m_pool;
+
+public:
+  using value_type = T;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  PoolAllocator() : m_pool(std::make_shared<NodePool>()) {}
+
+  explicit PoolAllocator(std::shared_ptr<NodePool> pool)
+      : m_pool(std::move(pool)) {}
+
+  PoolAllocator(const PoolAllocator &other) noexcept = default;
+
+  PoolAllocator(PoolAllocator &&other) noexcept
+      : m_pool(std::move(other.m_pool)) {}
+
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U> &other) noexcept
+      : m_pool(other.m_pool) {}
+
+  PoolAllocator &operator=(const PoolAllocator &other) noexcept = default;
+
+  PoolAllocator &operator=(PoolAllocator &&other) noexcept {
+    m_pool.swap(other.m_pool);
+    return *this;
+  }
+
+  PoolAllocator select_on_container_copy_construction() const {
+    return PoolAllocator();
+  }
+
+  // The containers allocate their nodes one at a time, and their arrays
+  // several elements at once
+  T *allocate(std::size_t count) {
+    if (m_pool == nullptr) {
+      return std::allocator<T>().allocate(count);
+    }
+    return static_cast<T *>(
+        m_pool->allocate(count * sizeof(T), alignof(T), count == 1));
+  }
+
+  void deallocate(T *memory, std::size_t count) {
+    if (m_pool == nullptr) {
+      std::allocator<T>().deallocate(memory, count);
+      return;
+    }
+    m_pool->deallocate(memory, count * sizeof(T), alignof(T));
+  }
+
+  // The pool, or nullptr once the allocator has been moved from
+  NodePool *pool() const { return m_pool.get(); }
+
+  template <typename U>
+  friend bool operator==(const PoolAllocator &lhs,
+                         const PoolAllocator<U> &rhs) {
+    return lhs.m_pool == rhs.m_pool;
+  }
+
+  template <typename U>
+  friend bool operator!=(const PoolAllocator &lhs,
+                         const PoolAllocator<U> &rhs) {
+    return lhs.m_pool != rhs.m_pool;
+  }
+};
+
+namespace detail {
+// Tells the pool of 'allocator', if it has one, how many entries the cache
+// will hold; other allocators have nothing to prepare
+template <typename Allocator>
+void expectNodes(const Allocator &allocator, std::size_t count) {
+  (void)allocator;
+  (void)count;
+}
+
+template <typename T>
+void expectNodes(const PoolAllocator<T> &allocator, std::size_t count) {
+  if (NodePool *pool = allocator.pool()) {
+    pool->expect(count);
+  }
+}
+
+// A type that no cache converts to, see MoveSource
+class NoMoveSource {
+private:
+  NoMoveSource() {}
+};
+
+// The parameter of the move assignment of 'Cache', a cache whose index holds
+// iterators into its lists. A move assignment hands the nodes of the lists
+// over only if 'Allocator' propagates or all its instances are equal.
+// Otherwise, e.g. for two std::pmr::polymorphic_allocator on different
+// resources, the lists move each entry into nodes of their own and the index
+// would still point into the source, so such caches take a NoMoveSource and
+// are move-constructible only.
+template <typename Cache, typename Allocator>
+using MoveSource = std::conditional_t<
+    std::allocator_traits<
+        Allocator>::propagate_on_container_move_assignment::value ||
+        std::allocator_traits<Allocator>::is_always_equal::value,
+    Cache, NoMoveSource>;
+} // namespace detail
+
+// The interface shared by all the policies, for code that picks a policy at
+// run time. Each policy is implemented without virtual methods, e.g. as
+// BasicLRUCache; LRUCache is that policy behind this interface, see
+// VirtualCache.
+template <typename K, typename V> class Cache {
+private:
+  std::size_t m_capacity;
+
+public:
+  explicit Cache(std::size_t capacity) : m_capacity(capacity) {}
+
+  virtual ~Cache() = default;
+
+  size_t getCapacity() const { return m_capacity; }
+
+  // The total weight of the cached entries, which put() keeps within the
+  // capacity; the number of entries under UnitWeigher
+  virtual std::size_t getWeight() const = 0;
+
+  // Policies override this to evict the entries over a smaller capacity, in
+  // the order put() would, and to reserve room for a larger one
+  virtual void setCapacity(size_t capacity) { m_capacity = capacity; }
+
+  // Returns a pointer to the value of 'key', or nullptr if 'key' is not
+  // cached. The lookup counts as an access for the replacement policy, exactly
+  // like get(), and the pointer stays valid until the cache is next modified.
+  virtual V *getPtr(const K &key) = 0;
+
+  virtual V get(const K &key) { return detail::valueOrThrow(getPtr(key)); }
+
+  // Non-throwing alternatives to get() for workloads where misses are common
+  std::optional<V> tryGet(const K &key) {
+    return detail::valueOrNothing(getPtr(key));
+  }
+
+  bool tryGet(const K &key, V &value) {
+    V *ptr = getPtr(key);
+    if (ptr == nullptr) {
+      return false;
+    }
+    value = *ptr;
+    return true;
+  }
+
+  // Looks up 'count' keys as if get() were called on each of them in order;
+  // 'results[i]' receives the value of 'keys[i]', or std::nullopt on a miss
+  virtual void getMany(const K *keys, std::size_t count,
+                       std::optional<V> *results) {
+    for (std::size_t i = 0; i < count; ++i) {
+      results[i] = tryGet(keys[i]);
+    }
+  }
+
+  // Stores 'count' pairs as if put() were called on each of them in order
+  virtual void putMany(const K *keys, const V *values, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      put(keys[i], values[i]);
+    }
+  }
+
+  virtual void put(const K &key, const V &value) = 0;
+
+  // Like put(), but moves the value, or the key and the value, into the cache.
+  // The policies override these; the defaults copy.
+  virtual void put(const K &key, V &&value) {
+    put(key, static_cast<const V &>(value));
+  }
+
+  virtual void put(K &&key, V &&value) {
+    put(static_cast<const K &>(key), static_cast<const V &>(value));
+  }
+
+  // Whether 'key' is cached; unlike get(), this is not an access
+  virtual bool contains(const K &key) const = 0;
+
+  // Removes 'key' from the cache and returns whether it was cached
+  virtual bool erase(const K &key) = 0;
+
+  virtual void clear() = 0;
+};
+
+// The front end every policy derives from, naming itself as 'Derived'. It
+// builds get(), tryGet(), put() and the batch methods on the getPtr(),
+// store() and friends of the policy, which it calls directly: nothing is
+// virtual, so a cache used through its own type, e.g. a BasicLRUCache, has no
+// vtable and its lookups and insertions inline fully. A policy hides the
+// methods it implements better, such as getMany(), and setCapacity() to evict
+// the entries over a smaller capacity.
+template <typename Derived, typename K, typename V> class BasicCache {
+private:
+  std::size_t m_capacity;
+
+  Derived &self() { return static_cast<Derived &>(*this); }
+
+  const Derived &self() const { return static_cast<const Derived &>(*this); }
+
+protected:
+  explicit BasicCache(std::size_t capacity) : m_capacity(capacity) {}
+
+  ~BasicCache() = default;
+
+public:
+  using key_type = K;
+  using mapped_type = V;
+
+  std::size_t getCapacity() const { return m_capacity; }
+
+  void setCapacity(std::size_t capacity) { m_capacity = capacity; }
+
+  // 'key' may be a K or, as with getPtr(), any type that compares with K
+  template <typename Key> V get(const Key &key) {
+    return detail::valueOrThrow(self().getPtr(key));
+  }
+
+  template <typename Key> std::optional<V> tryGet(const Key &key) {
+    return detail::valueOrNothing(self().getPtr(key));
+  }
+
+  bool tryGet(const K &key, V &value) {
+    V *ptr = self().getPtr(key);
+    if (ptr == nullptr) {
+      return false;
+    }
+    value = *ptr;
+    return true;
+  }
+
+  void getMany(const K *keys, std::size_t count, std::optional<V> *results) {
+    for (std::size_t i = 0; i < count; ++i) {
+      results[i] = tryGet(keys[i]);
+    }
+  }
+
+  void putMany(const K *keys, const V *values, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      put(keys[i], values[i]);
+    }
+  }
+
+  void put(const K &key, const V &value) { self().emplace(key, value); }
+
+  void put(const K &key, V &&value) { self().emplace(key, std::move(value)); }
+
+  void put(K &&key, V &&value) {
+    self().emplace(std::move(key), std::move(value));
+  }
+
+  // Stores a value constructed from 'args' under 'key' as put() does, building
+  // it in place in a new entry
+  template <typename Key, typename... Args>
+  void emplace(Key &&key, Args &&...args) {
+    detail::emplaceWeighed<K, V, typename Derived::weigher_type>(
+        [this](auto &&newKey, std::size_t weight, auto &&...valueArgs) {
+          self().store(std::forward<decltype(newKey)>(newKey), weight,
+                       std::forward<decltype(valueArgs)>(valueArgs)...);
+        },
+        std::forward<Key>(key), std::forward<Args>(args)...);
+  }
+
+  // Like emplace(), but returns false and constructs no value when 'key' is
+  // already cached, leaving its entry as it is. Finding the entry is not an
+  // access, as with contains()
+  template <typename Key, typename... Args>
+  bool tryEmplace(Key &&key, Args &&...args) {
+    if (self().contains(key)) {
+      return false;
+    }
+    self().emplace(std::forward<Key>(key), std::forward<Args>(args)...);
+    return true;
+  }
+};
+
+// Puts a policy such as BasicLRUCache behind the virtual Cache<K, V>
+// interface, for code that picks the policy at run time or mixes policies in
+// one container; LRUCache and the other policy names are aliases of it. Each
+// override calls the policy directly, so a call through a Cache<K, V> costs
+// one indirect call, and the methods of the policy itself stay available.
+template <typename Policy>
+class VirtualCache
+    : public Cache<typename Policy::key_type, typename Policy::mapped_type>,
+      public Policy {
+private:
+  using K = typename Policy::key_type;
+  using V = typename Policy::mapped_type;
+  using Interface = Cache<K, V>;
+
+public:
+  template <typename... Args>
+  explicit VirtualCache(std::size_t capacity, Args &&...args)
+      : Interface(capacity), Policy(capacity, std::forward<Args>(args)...) {}
+
+  using Policy::contains;
+  using Policy::erase;
+  using Policy::get;
+  using Policy::getCapacity;
+  using Policy::getPtr;
+  using Policy::put;
+  using Policy::tryGet;
+
+  std::size_t getWeight() const override { return Policy::getWeight(); }
+
+  void setCapacity(std::size_t capacity) override {
+    Interface::setCapacity(capacity);
+    Policy::setCapacity(capacity);
+  }
+
+  V *getPtr(const K &key) override { return Policy::getPtr(key); }
+
+  V get(const K &key) override { return Policy::get(key); }
+
+  void getMany(const K *keys, std::size_t count,
+               std::optional<V> *results) override {
+    Policy::getMany(keys, count, results);
+  }
+
+  void putMany(const K *keys, const V *values, std::size_t count) override {
+    Policy::putMany(keys, values, count);
+  }
+
+  void put(const K &key, const V &value) override { Policy::put(key, value); }
+
+  void put(const K &key, V &&value) override {
+    Policy::put(key, std::move(value));
+  }
+
+  void put(K &&key, V &&value) override {
+    Policy::put(std::move(key), std::move(value));
+  }
+
+  bool contains(const K &key) const override { return Policy::contains(key); }
+
+  bool erase(const K &key) override { return Policy::erase(key); }
+
+  void clear() override { Policy::clear(); }
+};
+
+// Entries are only ever added and evicted at the newest end, so they form a
+// stack in a vector, and the hash map holds the index of each entry in it.
+// erase() leaves a hole, which is dropped once it reaches the top of the
+// stack, and the stack closes the holes in place once they take up half of
+// it.
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+class BasicFILOCache
+    : public BasicCache<
+          BasicFILOCache<K, V, Key_Hash, Index, Weigher, Allocator>, K, V> {
+private:
+  using Base = BasicCache<
+      BasicFILOCache<K, V, Key_Hash, Index, Weigher, Allocator>, K, V>;
+  friend Base;
+
+  using Entry = detail::WeightedPair<K, V, Weigher>;
+
+  // An empty slot is a hole left by erase()
+  using Slot = std::optional<Entry>;
+  using Stack = std::vector<Slot, detail::Rebind<Allocator, Slot>>;
+  using Map = typename Index::template map<
+      K, std::size_t, Key_Hash,
+      detail::Rebind<Allocator, std::pair<const K, std::size_t>>>;
+
+  // The back of 'm_stack' holds the newest entry and is never a hole
+  Stack m_stack;
+  Map m_hashmap;
+  std::size_t m_holes;
+  std::size_t m_weight;
+
+  void dropHoles() {
+    while (!m_stack.empty() && !m_stack.back()) {
+      m_stack.pop_back();
+      --m_holes;
+    }
+  }
+
+  // Moves each entry behind a hole down, renumbering it in the hash map
+  void compact() {
+    std::size_t next = 0;
+    for (std::size_t index = 0; index < m_stack.size(); ++index) {
+      if (!m_stack[index]) {
+        continue;
+      }
+      if (index != next) {
+        m_hashmap.find(m_stack[index]->first)->second = next;
+        m_stack[next] = std::move(m_stack[index]);
+      }
+      ++next;
+    }
+    m_stack.erase(m_stack.begin() + next, m_stack.end());
+    m_holes = 0;
+  }
+
+  void reserve(std::size_t entries) {
+    m_stack.reserve(entries);
+    m_hashmap.reserve(entries);
+    detail::expectNodes(m_hashmap.get_allocator(), entries);
+  }
+
+  // Erases the entry that put() replaces once the cache is full, i.e. the
+  // newest one
+  void evict() {
+    m_weight -= m_stack.back()->getWeight();
+    m_hashmap.erase(m_stack.back()->first);
+    m_stack.pop_back();
+    dropHoles();
+  }
+
+  // The core of put() and emplace(): stores the value constructed from 'args'
+  // under 'key', in an entry weighing 'weight'
+  template <typename Key, typename... Args>
+  void store(Key &&key, std::size_t weight, Args &&...args) {
+    // Corner case: an entry heavier than the whole cache is not cached
+    if (weight > this->getCapacity()) {
+      erase<K>(key);
+      return;
+    }
+    // We check if 'key' is in the hash map
+    auto iter = m_hashmap.find(key);
+    if (iter == m_hashmap.end()) {
+      while (m_weight + weight > this->getCapacity()) {
+        // The cache is full, we need to erase the top of 'm_stack' and update
+        // the hash map (First In Last Out / Last In First Out)
+        evict();
+      }
+      m_stack.emplace_back(std::in_place, weight, std::forward<Key>(key),
+                           std::forward<Args>(args)...);
+      m_hashmap.emplace(m_stack.back()->first, m_stack.size() - 1);
+      m_weight += weight;
+    } else {
+      // The entry is updated in place and keeps its position in the stack
+      Entry &entry = *m_stack[iter->second];
+      m_weight = m_weight - entry.getWeight() + weight;
+      entry.setWeight(weight);
+      detail::assign(entry.second, std::forward<Args>(args)...);
+      // A heavier value may push other entries out, or itself
+      while (m_weight > this->getCapacity()) {
+        evict();
+      }
+    }
+  }
+
+public:
+  using weigher_type = Weigher;
+
+  // When the capacity counts entries, the stack and the hash map are sized
+  // for it up front, so filling the cache never moves or rehashes them. The
+  // stack and the hash map take their memory from 'allocator'.
+  explicit BasicFILOCache(std::size_t capacity,
+                          const Allocator &allocator = Allocator())
+      : Base(capacity), m_stack(allocator), m_hashmap(allocator), m_holes(0),
+        m_weight(0) {
+    reserve(detail::entriesFor<Weigher>(capacity));
+  }
+
+  BasicFILOCache(const BasicFILOCache &) = default;
+
+  // The entries move with the stack, which leaves the cache moved from empty
+  BasicFILOCache(BasicFILOCache &&other)
+      : Base(other.getCapacity()), m_stack(std::move(other.m_stack)),
+        m_hashmap(std::move(other.m_hashmap)),
+        m_holes(std::exchange(other.m_holes, 0)),
+        m_weight(std::exchange(other.m_weight, 0)) {}
+
+  BasicFILOCache &operator=(const BasicFILOCache &) = default;
+
+  BasicFILOCache &operator=(BasicFILOCache &&other) {
+    if (this != &other) {
+      Base::setCapacity(other.getCapacity());
+      m_stack = std::move(other.m_stack);
+      m_hashmap = std::move(other.m_hashmap);
+      m_holes = std::exchange(other.m_holes, 0);
+      m_weight = std::exchange(other.m_weight, 0);
+    }
+    return *this;
+  }
+
+  std::size_t getWeight() const { return m_weight; }
+
+  void setCapacity(std::size_t capacity) {
+    Base::setCapacity(capacity);
+    while (m_weight > capacity) {
+      evict();
+    }
+    reserve(detail::entriesFor<Weigher>(capacity));
+  }
+
+  // 'key' may be of any type that compares with K, e.g. std::string_view for
+  // std::string keys; see detail::findKey
+  template <typename Key> V *getPtr(const Key &key) {
+    // We check if 'key' is in the hash map
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end()) {
+      return nullptr;
+    }
+    // Return 'value' from the pair
+    return &m_stack[iter->second]->second;
+  }
+
+  template <typename Key> bool contains(const Key &key) const {
+    return detail::findKey(m_hashmap, key) != m_hashmap.end();
+  }
+
+  template <typename Key> bool erase(const Key &key) {
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end()) {
+      return false;
+    }
+    Slot &slot = m_stack[iter->second];
+    m_weight -= slot->getWeight();
+    m_hashmap.erase(iter);
+    slot.reset();
+    ++m_holes;
+    dropHoles();
+    if (2 * m_holes > m_stack.size()) {
+      compact();
+    }
+    return true;
+  }
+
+  void getMany(const K *keys, std::size_t count,
+               std::optional<V> *results) {
+    typename decltype(m_hashmap)::iterator iters[detail::BATCH_SIZE];
+    for (std::size_t first = 0; first < count; first += detail::BATCH_SIZE) {
+      std::size_t size = std::min(detail::BATCH_SIZE, count - first);
+      // Probe every key of the group and prefetch the slots of the hits
+      detail::findAll(m_hashmap, keys + first, size, iters);
+      for (std::size_t i = 0; i < size; ++i) {
+        if (iters[i] != m_hashmap.end()) {
+          detail::prefetch(&m_stack[iters[i]->second]);
+        }
+      }
+      for (std::size_t i = 0; i < size; ++i) {
+        if (iters[i] == m_hashmap.end()) {
+          results[first + i] = std::nullopt;
+        } else {
+          results[first + i] = m_stack[iters[i]->second]->second;
+        }
+      }
+    }
+  }
+
+  void putMany(const K *keys, const V *values, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      BasicFILOCache::put(keys[i], values[i]);
+    }
+  }
+
+  // The stack keeps its storage for the next entries, so for trivially
+  // destructible entries this only resets its size
+  void clear() {
+    m_stack.clear();
+    m_hashmap.clear();
+    m_holes = 0;
+    m_weight = 0;
+  }
+};
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+using FILOCache =
+    VirtualCache<BasicFILOCache<K, V, Key_Hash, Index, Weigher, Allocator>>;
+
+// A hit never reorders the entries, so they are kept in insertion order in a
+// ring buffer rather than a list, and eviction only advances its head. The
+// hash map holds the number of each entry, which is its place in the order;
+// entry 'n' lives in slot n & (size - 1) of the ring. erase() leaves a hole
+// that the head or the tail skips once it reaches it, and the ring closes the
+// holes in place once they take up half of it.
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+class BasicFIFOCache
+    : public BasicCache<
+          BasicFIFOCache<K, V, Key_Hash, Index, Weigher, Allocator>, K, V> {
+private:
+  using Base = BasicCache<
+      BasicFIFOCache<K, V, Key_Hash, Index, Weigher, Allocator>, K, V>;
+  friend Base;
+
+  using Entry = detail::WeightedPair<K, V, Weigher>;
+
+  // An empty slot is a hole left by erase(), or room for the next entry
+  using Slot = std::optional<Entry>;
+  using Ring = std::vector<Slot, detail::Rebind<Allocator, Slot>>;
+  using Map = typename Index::template map<
+      K, std::size_t, Key_Hash,
+      detail::Rebind<Allocator, std::pair<const K, std::size_t>>>;
+
+  // The entries numbered from 'm_head', the oldest, to 'm_tail' - 1, the
+  // newest. The slots of 'm_head' and 'm_tail' - 1 are never holes
+  Ring m_ring;
+  Map m_hashmap;
+  std::size_t m_head;
+  std::size_t m_tail;
+  std::size_t m_holes;
+  std::size_t m_weight;
+
+  Slot &slotOf(std::size_t number) {
+    return m_ring[number & (m_ring.size() - 1)];
+  }
+
+  void skipHoles() {
+    while (m_head != m_tail && !slotOf(m_head)) {
+      ++m_head;
+      --m_holes;
+    }
+    while (m_head != m_tail && !slotOf(m_tail - 1)) {
+      --m_tail;
+      --m_holes;
+    }
+  }
+
+  // Moves the entries to a ring of 'size' slots. They keep their numbers,
+  // which all fall in different slots as long as they fit
+  void resize(std::size_t size) {
+    Ring ring(size, m_ring.get_allocator());
+    for (std::size_t number = m_head; number != m_tail; ++number) {
+      ring[number & (size - 1)] = std::move(slotOf(number));
+    }
+    m_ring.swap(ring);
+  }
+
+  // Closes the holes by moving each entry behind them forward, renumbering
+  // it in the hash map. The slot an entry moves to is before its own, so it
+  // has been emptied already
+  void compact() {
+    std::size_t next = m_head;
+    for (std::size_t number = m_head; number != m_tail; ++number) {
+      Slot &slot = slotOf(number);
+      if (!slot) {
+        continue;
+      }
+      if (number != next) {
+        m_hashmap.find(slot->first)->second = next;
+        slotOf(next) = std::move(slot);
+        slot.reset();
+      }
+      ++next;
+    }
+    m_tail = next;
+    m_holes = 0;
+  }
+
+  // Makes room for an entry at the tail. A full ring with few holes doubles
+  void makeRoom() {
+    if (m_tail - m_head < m_ring.size()) {
+      return;
+    }
+    if (m_holes > 0 && 2 * m_holes >= m_ring.size()) {
+      compact();
+    } else {
+      resize(detail::ringSizeFor(m_ring.size() + 1, m_ring.max_size()));
+    }
+  }
+
+  // Sizes the ring for 'entries', so that filling the cache never moves it.
+  // Only up to detail::MAX_RESERVED_ENTRIES slots are made up front, as each
+  // is built and touched; makeRoom() grows the ring past that as it fills
+  void reserve(std::size_t entries) {
+    entries = std::min(entries, detail::MAX_RESERVED_ENTRIES);
+    std::size_t size = detail::ringSizeFor(entries, m_ring.max_size());
+    if (size > m_ring.size()) {
+      resize(size);
+    }
+    m_hashmap.reserve(entries);
+    detail::expectNodes(m_hashmap.get_allocator(), entries);
+  }
+
+  // Erases the entry that put() replaces once the cache is full, i.e. the
+  // oldest one
+  void evict() {
+    Slot &slot = slotOf(m_head);
+    m_weight -= slot->getWeight();
+    m_hashmap.erase(slot->first);
+    slot.reset();
+    ++m_head;
+    skipHoles();
+  }
+
+  // The core of put() and emplace(): stores the value constructed from 'args'
+  // under 'key', in an entry weighing 'weight'
+  template <typename Key, typename... Args>
+  void store(Key &&key, std::size_t weight, Args &&...args) {
+    // Corner case: an entry heavier than the whole cache is not cached
+    if (weight > this->getCapacity()) {
+      erase<K>(key);
+      return;
+    }
+    // We check if 'key' is in the hash map
+    auto iter = m_hashmap.find(key);
+    if (iter == m_hashmap.end()) {
+      while (m_weight + weight > this->getCapacity()) {
+        // The cache is full, we need to erase the oldest entry at the head of
+        // the ring and update the hash map (First In First Out)
+        evict();
+      }
+      makeRoom();
+      Slot &slot = slotOf(m_tail);
+      slot.emplace(weight, std::forward<Key>(key), std::forward<Args>(args)...);
+      m_hashmap.emplace(slot->first, m_tail++);
+      m_weight += weight;
+    } else {
+      Entry &entry = *slotOf(iter->second);
+      m_weight = m_weight - entry.getWeight() + weight;
+      entry.setWeight(weight);
+      detail::assign(entry.second, std::forward<Args>(args)...);
+      // A heavier value may push older entries out, or itself
+      while (m_weight > this->getCapacity()) {
+        evict();
+      }
+    }
+  }
+
+public:
+  using weigher_type = Weigher;
+
+  // When the capacity counts entries, the ring and the hash map are sized for
+  // it up front, so filling the cache never moves or rehashes them. The ring
+  // and the hash map take their memory from 'allocator'.
+  explicit BasicFIFOCache(std::size_t capacity,
+                          const Allocator &allocator = Allocator())
+      : Base(capacity), m_ring(allocator), m_hashmap(allocator), m_head(0),
+        m_tail(0), m_holes(0), m_weight(0) {
+    reserve(detail::entriesFor<Weigher>(capacity));
+  }
+
+  BasicFIFOCache(const BasicFIFOCache &) = default;
+
+  // The entries move with the ring, which leaves the cache moved from empty
+  // and without slots; makeRoom() gives it new ones on its next put()
+  BasicFIFOCache(BasicFIFOCache &&other)
+      : Base(other.getCapacity()), m_ring(std::move(other.m_ring)),
+        m_hashmap(std::move(other.m_hashmap)),
+        m_head(std::exchange(other.m_head, 0)),
+        m_tail(std::exchange(other.m_tail, 0)),
+        m_holes(std::exchange(other.m_holes, 0)),
+        m_weight(std::exchange(other.m_weight, 0)) {}
+
+  BasicFIFOCache &operator=(const BasicFIFOCache &) = default;
+
+  BasicFIFOCache &operator=(BasicFIFOCache &&other) {
+    if (this != &other) {
+      Base::setCapacity(other.getCapacity());
+      m_ring = std::move(other.m_ring);
+      m_hashmap = std::move(other.m_hashmap);
+      m_head = std::exchange(other.m_head, 0);
+      m_tail = std::exchange(other.m_tail, 0);
+      m_holes = std::exchange(other.m_holes, 0);
+      m_weight = std::exchange(other.m_weight, 0);
+    }
+    return *this;
+  }
+
+  std::size_t getWeight() const { return m_weight; }
+
+  void setCapacity(std::size_t capacity) {
+    Base::setCapacity(capacity);
+    while (m_weight > capacity) {
+      evict();
+    }
+    reserve(detail::entriesFor<Weigher>(capacity));
+  }
+
+  // 'key' may be of any type that compares with K, e.g. std::string_view for
+  // std::string keys; see detail::findKey
+  template <typename Key> V *getPtr(const Key &key) {
+    // We check if 'key' is in the hash map
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end()) {
+      return nullptr;
+    }
+    // Return 'value' from the pair
+    return &slotOf(iter->second)->second;
+  }
+
+  template <typename Key> bool contains(const Key &key) const {
+    return detail::findKey(m_hashmap, key) != m_hashmap.end();
+  }
+
+  template <typename Key> bool erase(const Key &key) {
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end()) {
+      return false;
+    }
+    Slot &slot = slotOf(iter->second);
+    m_weight -= slot->getWeight();
+    m_hashmap.erase(iter);
+    slot.reset();
+    ++m_holes;
+    skipHoles();
+    return true;
+  }
+
+  void getMany(const K *keys, std::size_t count,
+               std::optional<V> *results) {
+    typename decltype(m_hashmap)::iterator iters[detail::BATCH_SIZE];
+    for (std::size_t first = 0; first < count; first += detail::BATCH_SIZE) {
+      std::size_t size = std::min(detail::BATCH_SIZE, count - first);
+      // Probe every key of the group and prefetch the slots of the hits
+      detail::findAll(m_hashmap, keys + first, size, iters);
+      for (std::size_t i = 0; i < size; ++i) {
+        if (iters[i] != m_hashmap.end()) {
+          detail::prefetch(&slotOf(iters[i]->second));
+        }
+      }
+      for (std::size_t i = 0; i < size; ++i) {
+        if (iters[i] == m_hashmap.end()) {
+          results[first + i] = std::nullopt;
+        } else {
+          results[first + i] = slotOf(iters[i]->second)->second;
+        }
+      }
+    }
+  }
+
+  void putMany(const K *keys, const V *values, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      BasicFIFOCache::put(keys[i], values[i]);
+    }
+  }
+
+  // The ring keeps its slots for the next entries
+  void clear() {
+    for (std::size_t number = m_head; number != m_tail; ++number) {
+      slotOf(number).reset();
+    }
+    m_hashmap.clear();
+    m_head = 0;
+    m_tail = 0;
+    m_holes = 0;
+    m_weight = 0;
+  }
+};
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+using FIFOCache =
+    VirtualCache<BasicFIFOCache<K, V, Key_Hash, Index, Weigher, Allocator>>;
+
+// S3-FIFO (Yang et al.), which keeps FIFOCache's property that a hit only
+// sets a counter and never reorders entries. New keys enter a small FIFO
+// queue holding a tenth of the capacity. An entry leaving it moves on to the
+// main FIFO queue if it was hit while there, and is otherwise evicted and
+// remembered by the hash of its key in a ghost FIFO queue. A new key found in
+// the ghost queue goes to the main queue directly. The main queue reinserts
+// entries whose 2-bit hit counter is not zero, decrementing it, and evicts the
+// others. Keys seen once thus leave through the small queue quickly.
+//
+// Entries live in a slab of slots and the queues are ring buffers of slot
+// indices. erase() frees the slot at once and bumps its generation, which
+// leaves the queued ticket for the slot stale until the queue pops it.
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+class BasicS3FIFOCache
+    : public BasicCache<
+          BasicS3FIFOCache<K, V, Key_Hash, Index, Weigher, Allocator>, K, V> {
+private:
+  using Base = BasicCache<
+      BasicS3FIFOCache<K, V, Key_Hash, Index, Weigher, Allocator>, K, V>;
+  friend Base;
+
+  static constexpr std::uint8_t MAX_FREQUENCY = 3;
+
+  // A freed slot drops its key and value at once, so an erased value does
+  // not hold on to its memory until the slot is reused
+  struct Slot : detail::EntryWeight<Weigher> {
+    std::optional<std::pair<K, V>> m_entry;
+    std::uint32_t m_generation = 0;
+    std::uint8_t m_frequency = 0;
+    bool m_main = false;
+  };
+
+  struct Ticket {
+    std::size_t m_slot;
+    std::uint32_t m_generation;
+  };
+
+  // A key remembered by the ghost queue, with the weight its entry had
+  struct Ghost : detail::EntryWeight<Weigher> {
+    std::size_t m_hash;
+  };
+
+  using Queue = detail::RingBuffer<Ticket, detail::Rebind<Allocator, Ticket>>;
+
+  std::vector<Slot, detail::Rebind<Allocator, Slot>> m_slots;
+  std::vector<std::size_t, detail::Rebind<Allocator, std::size_t>> m_freeSlots;
+  Queue m_small;
+  Queue m_main;
+  typename Index::template map<
+      K, std::size_t, Key_Hash,
+      detail::Rebind<Allocator, std::pair<const K, std::size_t>>>
+      m_hashmap;
+  // 'm_ghosts' maps the hash of each ghost to the sequence number of its
+  // latest insertion, so that popping an older copy of the hash does not
+  // forget it
+  detail::RingBuffer<Ghost, detail::Rebind<Allocator, Ghost>> m_ghostQueue;
+  typename Index::template map<
+      std::size_t, std::uint64_t, std::hash<std::size_t>,
+      detail::Rebind<Allocator, std::pair<const std::size_t, std::uint64_t>>>
+      m_ghosts;
+  std::uint64_t m_ghostSequence;
+  std::size_t m_weight;
+  std::size_t m_smallSize;
+  std::size_t m_smallWeight;
+  std::size_t m_ghostWeight;
+  std::size_t m_maxSmall;
+  // Tickets left in the queues by erase()
+  std::size_t m_staleTickets;
+
+  void computeLimits() {
+    std::size_t capacity = this->getCapacity();
+    m_maxSmall = std::min<std::size_t>(capacity, std::max<std::size_t>(
+                                                     1, capacity / 10));
+  }
+
+  bool isStale(const Ticket &ticket) const {
+    return m_slots[ticket.m_slot].m_generation != ticket.m_generation;
+  }
+
+  // Pops the front of 'queue', and returns false if it was stale
+  bool popTicket(Queue &queue, std::size_t &slot) {
+    Ticket ticket = queue.front();
+    queue.pop_front();
+    if (isStale(ticket)) {
+      --m_staleTickets;
+      return false;
+    }
+    slot = ticket.m_slot;
+    return true;
+  }
+
+  void freeSlot(std::size_t slot) {
+    Slot &entry = m_slots[slot];
+    m_weight -= entry.getWeight();
+    if (!entry.m_main) {
+      --m_smallSize;
+      m_smallWeight -= entry.getWeight();
+    }
+    m_hashmap.erase(entry.m_entry->first);
+    entry.m_entry.reset();
+    ++entry.m_generation;
+    m_freeSlots.push_back(slot);
+  }
+
+  // The ghost queue remembers as much weight as the main queue holds
+  void forgetGhosts() {
+    std::size_t maxGhosts = this->getCapacity() - m_maxSmall;
+    while (m_ghostWeight > maxGhosts) {
+      const Ghost &ghost = m_ghostQueue.front();
+      std::uint64_t sequence = m_ghostSequence - m_ghostQueue.size();
+      auto iter = m_ghosts.find(ghost.m_hash);
+      if (iter != m_ghosts.end() && iter->second == sequence) {
+        m_ghosts.erase(iter);
+      }
+      m_ghostWeight -= ghost.getWeight();
+      m_ghostQueue.pop_front();
+    }
+  }
+
+  void remember(const Slot &entry) {
+    Ghost ghost;
+    ghost.m_hash = Key_Hash()(entry.m_entry->first);
+    ghost.setWeight(entry.getWeight());
+    m_ghostQueue.push_back(ghost);
+    m_ghostWeight += ghost.getWeight();
+    m_ghosts[ghost.m_hash] = m_ghostSequence++;
+    forgetGhosts();
+  }
+
+  // Evicts from the small queue, moving the entries hit there to the main
+  // queue until one is evicted. Returns false if the small queue ran empty
+  bool evictSmall() {
+    while (!m_small.empty()) {
+      std::size_t slot;
+      if (!popTicket(m_small, slot)) {
+        continue;
+      }
+      Slot &entry = m_slots[slot];
+      if (entry.m_frequency > 0) {
+        --m_smallSize;
+        m_smallWeight -= entry.getWeight();
+        entry.m_frequency = 0;
+        entry.m_main = true;
+        m_main.push_back({slot, entry.m_generation});
+      } else {
+        remember(entry);
+        freeSlot(slot);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void evictMain() {
+    while (!m_main.empty()) {
+      std::size_t slot;
+      if (!popTicket(m_main, slot)) {
+        continue;
+      }
+      Slot &entry = m_slots[slot];
+      if (entry.m_frequency > 0) {
+        --entry.m_frequency;
+        m_main.push_back({slot, entry.m_generation});
+      } else {
+        freeSlot(slot);
+        return;
+      }
+    }
+  }
+
+  // Frees room for put() once the cache is full. The small queue gives up
+  // an entry while it is over its share, or when the main queue is empty
+  void evict() {
+    bool mainEmpty = m_hashmap.size() == m_smallSize;
+    if ((m_smallWeight < m_maxSmall && !mainEmpty) || !evictSmall()) {
+      evictMain();
+    }
+  }
+
+  // Sizes the slots, the queues and the index for 'capacity', but for no
+  // more than detail::MAX_RESERVED_ENTRIES entries; past that they grow as
+  // the cache fills
+  void reserve(std::size_t capacity) {
+    std::size_t entries = detail::entriesFor<Weigher>(capacity);
+    m_slots.reserve(entries);
+    m_small.reserve(entries);
+    m_main.reserve(entries);
+    m_hashmap.reserve(entries);
+    detail::expectNodes(m_hashmap.get_allocator(), entries);
+  }
+
+  // The core of put() and emplace(): stores the value constructed from 'args'
+  // under 'key', in an entry weighing 'weight'
+  template <typename Key, typename... Args>
+  void store(Key &&key, std::size_t weight, Args &&...args) {
+    // Corner case: an entry heavier than the whole cache is not cached
+    if (weight > this->getCapacity()) {
+      erase<K>(key);
+      return;
+    }
+    auto iter = m_hashmap.find(key);
+    if (iter != m_hashmap.end()) {
+      Slot &entry = m_slots[iter->second];
+      m_weight = m_weight - entry.getWeight() + weight;
+      if (!entry.m_main) {
+        m_smallWeight = m_smallWeight - entry.getWeight() + weight;
+      }
+      entry.setWeight(weight);
+      detail::assign(entry.m_entry->second, std::forward<Args>(args)...);
+      // A heavier value may push other entries out, or itself
+      while (m_weight > this->getCapacity()) {
+        evict();
+      }
+      return;
+    }
+    while (m_weight + weight > this->getCapacity()) {
+      evict();
+    }
+    std::size_t slot;
+    if (m_freeSlots.empty()) {
+      slot = m_slots.size();
+      m_slots.emplace_back();
+    } else {
+      slot = m_freeSlots.back();
+      m_freeSlots.pop_back();
+    }
+    Slot &entry = m_slots[slot];
+    entry.m_entry.emplace(std::piecewise_construct,
+                          std::forward_as_tuple(std::forward<Key>(key)),
+                          std::forward_as_tuple(std::forward<Args>(args)...));
+    entry.m_frequency = 0;
+    entry.setWeight(weight);
+    m_weight += weight;
+    auto ghost = m_ghosts.find(Key_Hash()(entry.m_entry->first));
+    entry.m_main = ghost != m_ghosts.end();
+    if (entry.m_main) {
+      m_ghosts.erase(ghost);
+      m_main.push_back({slot, entry.m_generation});
+    } else {
+      ++m_smallSize;
+      m_smallWeight += weight;
+      m_small.push_back({slot, entry.m_generation});
+    }
+    m_hashmap.emplace(entry.m_entry->first, slot);
+  }
+
+public:
+  using weigher_type = Weigher;
+
+  // The slots, the free list, the queues and the hash maps take their memory
+  // from 'allocator'
+  explicit BasicS3FIFOCache(std::size_t capacity,
+                            const Allocator &allocator = Allocator())
+      : Base(capacity), m_slots(allocator), m_freeSlots(allocator),
+        m_small(allocator), m_main(allocator), m_hashmap(allocator),
+        m_ghostQueue(allocator), m_ghosts(allocator),
+        m_ghostSequence(0), m_weight(0), m_smallSize(0), m_smallWeight(0),
+        m_ghostWeight(0), m_staleTickets(0) {
+    computeLimits();
+    reserve(capacity);
+  }
+
+  BasicS3FIFOCache(const BasicS3FIFOCache &) = default;
+
+  // The slots, the queues and the ghosts move with the cache, which leaves the
+  // one moved from empty
+  BasicS3FIFOCache(BasicS3FIFOCache &&other)
+      : Base(other.getCapacity()), m_slots(std::move(other.m_slots)),
+        m_freeSlots(std::move(other.m_freeSlots)),
+        m_small(std::move(other.m_small)), m_main(std::move(other.m_main)),
+        m_hashmap(std::move(other.m_hashmap)),
+        m_ghostQueue(std::move(other.m_ghostQueue)),
+        m_ghosts(std::move(other.m_ghosts)),
+        m_ghostSequence(std::exchange(other.m_ghostSequence, 0)),
+        m_weight(std::exchange(other.m_weight, 0)),
+        m_smallSize(std::exchange(other.m_smallSize, 0)),
+        m_smallWeight(std::exchange(other.m_smallWeight, 0)),
+        m_ghostWeight(std::exchange(other.m_ghostWeight, 0)),
+        m_maxSmall(other.m_maxSmall),
+        m_staleTickets(std::exchange(other.m_staleTickets, 0)) {}
+
+  BasicS3FIFOCache &operator=(const BasicS3FIFOCache &) = default;
+
+  BasicS3FIFOCache &operator=(BasicS3FIFOCache &&other) {
+    if (this != &other) {
+      Base::setCapacity(other.getCapacity());
+      m_slots = std::move(other.m_slots);
+      m_freeSlots = std::move(other.m_freeSlots);
+      m_small = std::move(other.m_small);
+      m_main = std::move(other.m_main);
+      m_hashmap = std::move(other.m_hashmap);
+      m_ghostQueue = std::move(other.m_ghostQueue);
+      m_ghosts = std::move(other.m_ghosts);
+      m_ghostSequence = std::exchange(other.m_ghostSequence, 0);
+      m_weight = std::exchange(other.m_weight, 0);
+      m_smallSize = std::exchange(other.m_smallSize, 0);
+      m_smallWeight = std::exchange(other.m_smallWeight, 0);
+      m_ghostWeight = std::exchange(other.m_ghostWeight, 0);
+      m_maxSmall = other.m_maxSmall;
+      m_staleTickets = std::exchange(other.m_staleTickets, 0);
+    }
+    return *this;
+  }
+
+  std::size_t getWeight() const { return m_weight; }
+
+  void setCapacity(std::size_t capacity) {
+    Base::setCapacity(capacity);
+    computeLimits();
+    while (m_weight > capacity) {
+      evict();
+    }
+    forgetGhosts();
+    reserve(capacity);
+  }
+
+  // 'key' may be of any type that compares with K, e.g. std::string_view for
+  // std::string keys; see detail::findKey
+  template <typename Key> V *getPtr(const Key &key) {
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end()) {
+      return nullptr;
+    }
+    Slot &entry = m_slots[iter->second];
+    if (entry.m_frequency < MAX_FREQUENCY) {
+      ++entry.m_frequency;
+    }
+    return &entry.m_entry->second;
+  }
+
+  template <typename Key> bool contains(const Key &key) const {
+    return detail::findKey(m_hashmap, key) != m_hashmap.end();
+  }
+
+  template <typename Key> bool erase(const Key &key) {
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end()) {
+      return false;
+    }
+    freeSlot(iter->second);
+    // Drop the stale tickets once they outnumber the capacity, so that a
+    // nearly empty cache does not sweep its queues every few erases. A
+    // capacity in weights gives no count of entries, and the entries cached
+    // bound the stale tickets instead
+    std::size_t limit = std::max(
+        m_hashmap.size(), detail::entriesFor<Weigher>(this->getCapacity()));
+    if (++m_staleTickets > limit) {
+      auto stale = [this](const Ticket &ticket) { return isStale(ticket); };
+      m_small.removeIf(stale);
+      m_main.removeIf(stale);
+      m_staleTickets = 0;
+    }
+    return true;
+  }
+
+  void clear() {
+    m_slots.clear();
+    m_freeSlots.clear();
+    m_small.clear();
+    m_main.clear();
+    m_hashmap.clear();
+    m_ghostQueue.clear();
+    m_ghosts.clear();
+    m_weight = 0;
+    m_smallSize = 0;
+    m_smallWeight = 0;
+    m_ghostWeight = 0;
+    m_staleTickets = 0;
+  }
+};
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+using S3FIFOCache = VirtualCache<
+    BasicS3FIFOCache<K, V, Key_Hash, Index, Weigher, Allocator>>;
+
+// Nodes of equal frequency share a bucket, and the buckets form a list in
+// increasing order of frequency. An access relinks the node into the next
+// bucket, so it costs one lookup in 'm_hashmap' and no allocation. 'Freq_Hash'
+// is no longer used; it is kept so that existing instantiations still compile.
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Freq_Hash = std::hash<int>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+class BasicLFUCache
+    : public BasicCache<BasicLFUCache<K, V, Key_Hash, Freq_Hash, Index,
+                                      Weigher, Allocator>,
+                        K, V> {
+private:
+  using Base = BasicCache<
+      BasicLFUCache<K, V, Key_Hash, Freq_Hash, Index, Weigher, Allocator>, K,
+      V>;
+  friend Base;
+
+  struct Bucket;
+  using BucketList = std::list<Bucket, detail::Rebind<Allocator, Bucket>>;
+  using BucketIterator = typename BucketList::iterator;
+
+  // Define the inner node
+  struct Node : detail::EntryWeight<Weigher> {
+    K m_key;
+    V m_value;
+    BucketIterator m_bucket;
+
+    template <typename Key, typename... Args>
+    Node(BucketIterator bucket, std::size_t weight,
+         Key &&key, Args &&...args)
+        : m_key(std::forward<Key>(key)), m_value(std::forward<Args>(args)...),
+          m_bucket(bucket) {
+      this->setWeight(weight);
+    }
+  };
+
+  using NodeList = std::list<Node, detail::Rebind<Allocator, Node>>;
+  using NodeIterator = typename NodeList::iterator;
+
+  // The nodes of one frequency, the most recently used one in front
+  struct Bucket {
+    std::size_t m_freq = 0;
+    NodeList m_nodes;
+
+    explicit Bucket(const typename NodeList::allocator_type &allocator)
+        : m_nodes(allocator) {}
+  };
+
+  // No bucket in 'm_buckets' is empty, so the front one holds the least
+  // frequently used nodes. Emptied buckets are parked in 'm_spareBuckets' and
+  // reused, so moving nodes between frequencies never allocates.
+  BucketList m_buckets;
+  BucketList m_spareBuckets;
+  typename Index::template map<
+      K, NodeIterator, Key_Hash,
+      detail::Rebind<Allocator, std::pair<const K, NodeIterator>>>
+      m_hashmap;
+  std::size_t m_weight;
+
+  BucketIterator insertBucket(BucketIterator position, std::size_t freq) {
+    if (m_spareBuckets.empty()) {
+      m_spareBuckets.emplace_back(m_spareBuckets.get_allocator());
+    }
+    m_buckets.splice(position, m_spareBuckets, m_spareBuckets.begin());
+    auto bucket = std::prev(position);
+    bucket->m_freq = freq;
+    return bucket;
+  }
+
+  void releaseIfEmpty(BucketIterator bucket) {
+    if (bucket->m_nodes.empty()) {
+      m_spareBuckets.splice(m_spareBuckets.begin(), m_buckets, bucket);
+    }
+  }
+
+  BucketIterator firstFreqBucket() {
+    if (m_buckets.empty() || m_buckets.front().m_freq != 1) {
+      return insertBucket(m_buckets.begin(), 1);
+    }
+    return m_buckets.begin();
+  }
+
+  // Erases the least recently used node among the least frequently used ones
+  void evict() {
+    auto bucket = m_buckets.begin();
+    m_weight -= bucket->m_nodes.back().getWeight();
+    m_hashmap.erase(bucket->m_nodes.back().m_key);
+    bucket->m_nodes.pop_back();
+    releaseIfEmpty(bucket);
+  }
+
+  // The weight of the node evict() would erase
+  std::size_t victimWeight() const {
+    return m_buckets.front().m_nodes.back().getWeight();
+  }
+
+  // Moves 'node' to the front of the bucket with the next frequency
+  void touch(NodeIterator node) {
+    auto bucket = node->m_bucket;
+    auto next = std::next(bucket);
+    std::size_t freq = bucket->m_freq + 1;
+    if (next == m_buckets.end() || next->m_freq != freq) {
+      if (bucket->m_nodes.size() == 1) {
+        // The node is alone, so its bucket can simply take the new frequency
+        bucket->m_freq = freq;
+        return;
+      }
+      next = insertBucket(next, freq);
+    }
+    next->m_nodes.splice(next->m_nodes.begin(), bucket->m_nodes, node);
+    node->m_bucket = next;
+    releaseIfEmpty(bucket);
+  }
+
+  // The core of put() and emplace(): stores the value constructed from 'args'
+  // under 'key', in an entry weighing 'weight'
+  template <typename Key, typename... Args>
+  void store(Key &&key, std::size_t weight, Args &&...args) {
+    // Corner case: an entry heavier than the whole cache is not cached
+    std::size_t capacity = this->getCapacity();
+    if (weight > capacity) {
+      erase<K>(key);
+      return;
+    }
+    auto iter = m_hashmap.find(key);
+    if (iter != m_hashmap.end()) {
+      m_weight = m_weight - iter->second->getWeight() + weight;
+      iter->second->setWeight(weight);
+      detail::assign(iter->second->m_value, std::forward<Args>(args)...);
+      touch(iter->second);
+      // A heavier value may push less frequently used entries out
+      while (m_weight > capacity) {
+        evict();
+      }
+    } else if (std::is_nothrow_constructible<K, Key &&>::value &&
+               std::is_nothrow_constructible<V, Args &&...>::value &&
+               m_weight + weight > capacity &&
+               m_weight + weight - victimWeight() <= capacity) {
+      // Evicting one node makes room, so recycle the least recently used node
+      // among the least frequently used ones for 'key', together with its
+      // node in 'm_hashmap'. The key and the value are built in place, which
+      // only a construction that cannot throw may do to a node of the list;
+      // others evict and build a new node below
+      auto bucket = m_buckets.begin();
+      auto node = std::prev(bucket->m_nodes.end());
+      detail::rekey(m_hashmap, node->m_key, key);
+      m_weight = m_weight - node->getWeight() + weight;
+      node->setWeight(weight);
+      detail::rebuild(node->m_key, std::forward<Key>(key));
+      detail::rebuild(node->m_value, std::forward<Args>(args)...);
+      auto first = firstFreqBucket();
+      first->m_nodes.splice(first->m_nodes.begin(), bucket->m_nodes, node);
+      node->m_bucket = first;
+      releaseIfEmpty(bucket);
+    } else {
+      while (m_weight + weight > capacity) {
+        evict();
+      }
+      auto first = firstFreqBucket();
+      first->m_nodes.emplace_front(first, weight, std::forward<Key>(key),
+                                   std::forward<Args>(args)...);
+      m_weight += weight;
+      m_hashmap.emplace(first->m_nodes.front().m_key, first->m_nodes.begin());
+    }
+  }
+
+public:
+  using weigher_type = Weigher;
+
+  // When the capacity counts entries, the hash map is sized for it up front,
+  // so filling the cache never rehashes it. The nodes, the buckets and the
+  // hash map take their memory from 'allocator'.
+  explicit BasicLFUCache(std::size_t capacity,
+                         const Allocator &allocator = Allocator())
+      : Base(capacity), m_buckets(allocator), m_spareBuckets(allocator),
+        m_hashmap(allocator), m_weight(0) {
+    m_hashmap.reserve(detail::entriesFor<Weigher>(capacity));
+    detail::expectNodes(m_hashmap.get_allocator(),
+                        detail::entriesFor<Weigher>(capacity));
+  }
+
+  BasicLFUCache(const BasicLFUCache &) = delete;
+
+  // The nodes and the buckets move with their lists, which leaves the cache
+  // moved from empty
+  BasicLFUCache(BasicLFUCache &&other)
+      : Base(other.getCapacity()), m_buckets(std::move(other.m_buckets)),
+        m_spareBuckets(std::move(other.m_spareBuckets)),
+        m_hashmap(std::move(other.m_hashmap)),
+        m_weight(std::exchange(other.m_weight, 0)) {}
+
+  BasicLFUCache &operator=(const BasicLFUCache &) = delete;
+
+  BasicLFUCache &
+  operator=(detail::MoveSource<BasicLFUCache, Allocator> &&other) {
+    if (this != &other) {
+      Base::setCapacity(other.getCapacity());
+      m_buckets = std::move(other.m_buckets);
+      m_spareBuckets = std::move(other.m_spareBuckets);
+      m_hashmap = std::move(other.m_hashmap);
+      m_weight = std::exchange(other.m_weight, 0);
+    }
+    return *this;
+  }
+
+  std::size_t getWeight() const { return m_weight; }
+
+  void setCapacity(std::size_t capacity) {
+    Base::setCapacity(capacity);
+    while (m_weight > capacity) {
+      evict();
+    }
+    m_hashmap.reserve(detail::entriesFor<Weigher>(capacity));
+    detail::expectNodes(m_hashmap.get_allocator(),
+                        detail::entriesFor<Weigher>(capacity));
+  }
+
+  // 'key' may be of any type that compares with K, e.g. std::string_view for
+  // std::string keys; see detail::findKey
+  template <typename Key> V *getPtr(const Key &key) {
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end()) {
+      return nullptr;
+    }
+    touch(iter->second);
+    return &iter->second->m_value;
+  }
+
+  template <typename Key> bool contains(const Key &key) const {
+    return detail::findKey(m_hashmap, key) != m_hashmap.end();
+  }
+
+  template <typename Key> bool erase(const Key &key) {
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end()) {
+      return false;
+    }
+    auto bucket = iter->second->m_bucket;
+    m_weight -= iter->second->getWeight();
+    bucket->m_nodes.erase(iter->second);
+    releaseIfEmpty(bucket);
+    m_hashmap.erase(iter);
+    return true;
+  }
+
+  void getMany(const K *keys, std::size_t count,
+               std::optional<V> *results) {
+    typename decltype(m_hashmap)::iterator iters[detail::BATCH_SIZE];
+    for (std::size_t first = 0; first < count; first += detail::BATCH_SIZE) {
+      std::size_t size = std::min(detail::BATCH_SIZE, count - first);
+      // Probe every key of the group and prefetch the nodes of the hits
+      detail::findAll(m_hashmap, keys + first, size, iters);
+      for (std::size_t i = 0; i < size; ++i) {
+        if (iters[i] != m_hashmap.end()) {
+          detail::prefetch(&*iters[i]->second);
+        }
+      }
+      for (std::size_t i = 0; i < size; ++i) {
+        if (iters[i] == m_hashmap.end()) {
+          results[first + i] = std::nullopt;
+        } else {
+          touch(iters[i]->second);
+          results[first + i] = iters[i]->second->m_value;
+        }
+      }
+    }
+  }
+
+  void putMany(const K *keys, const V *values, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      BasicLFUCache::put(keys[i], values[i]);
+    }
+  }
+
+  void clear() {
+    m_hashmap.clear();
+    m_buckets.clear();
+    m_spareBuckets.clear();
+    m_weight = 0;
+  }
+};
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Freq_Hash = std::hash<int>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+using LFUCache = VirtualCache<
+    BasicLFUCache<K, V, Key_Hash, Freq_Hash, Index, Weigher, Allocator>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+class BasicLRUCache
+    : public BasicCache<
+          BasicLRUCache<K, V, Key_Hash, Index, Weigher, Allocator>, K, V> {
+private:
+  using Base = BasicCache<
+      BasicLRUCache<K, V, Key_Hash, Index, Weigher, Allocator>, K, V>;
+  friend Base;
+
+  using Entry = detail::WeightedPair<K, V, Weigher>;
+
+  using List = std::list<Entry, detail::Rebind<Allocator, Entry>>;
+  using Map = typename Index::template map<
+      K, typename List::iterator, Key_Hash,
+      detail::Rebind<Allocator, std::pair<const K, typename List::iterator>>>;
+
+  List m_list;
+  Map m_hashmap;
+  std::size_t m_weight;
+
+  // Erases the entry that put() replaces once the cache is full, i.e. the
+  // least recently used one
+  void evict() {
+    m_weight -= m_list.back().getWeight();
+    m_hashmap.erase(m_list.back().first);
+    m_list.pop_back();
+  }
+
+  // The core of put() and emplace(): stores the value constructed from 'args'
+  // under 'key', in an entry weighing 'weight'
+  template <typename Key, typename... Args>
+  void store(Key &&key, std::size_t weight, Args &&...args) {
+    // Corner case: an entry heavier than the whole cache is not cached
+    if (weight > this->getCapacity()) {
+      erase<K>(key);
+      return;
+    }
+    // We check if 'key' is in the hash map
+    auto iter = m_hashmap.find(key);
+    if (iter == m_hashmap.end()) {
+      while (m_weight + weight > this->getCapacity()) {
+        // The cache is full, we need to erase the least recently used item from
+        // 'm_list' and update the hash map
+        evict();
+      }
+      // The key is moved into the node and copied once into the hash map
+      m_list.emplace_front(weight, std::forward<Key>(key),
+                           std::forward<Args>(args)...);
+      m_hashmap.emplace(m_list.front().first, m_list.begin());
+      m_weight += weight;
+    } else {
+      m_weight = m_weight - iter->second->getWeight() + weight;
+      iter->second->setWeight(weight);
+      detail::assign(iter->second->second, std::forward<Args>(args)...);
+      m_list.splice(m_list.begin(), m_list, iter->second);
+      // A heavier value may push less recently used entries out
+      while (m_weight > this->getCapacity()) {
+        evict();
+      }
+    }
+  }
+
+public:
+  using weigher_type = Weigher;
+
+  // When the capacity counts entries, the hash map is sized for it up front,
+  // so filling the cache never rehashes it. The entries and the hash map take
+  // their memory from 'allocator'.
+  explicit BasicLRUCache(std::size_t capacity,
+                         const Allocator &allocator = Allocator())
+      : Base(capacity), m_list(allocator), m_hashmap(allocator), m_weight(0) {
+    m_hashmap.reserve(detail::entriesFor<Weigher>(capacity));
+    detail::expectNodes(m_hashmap.get_allocator(),
+                        detail::entriesFor<Weigher>(capacity));
+  }
+
+  BasicLRUCache(const BasicLRUCache &) = delete;
+
+  // The entries move with the list, which leaves the cache moved from empty
+  BasicLRUCache(BasicLRUCache &&other)
+      : Base(other.getCapacity()), m_list(std::move(other.m_list)),
+        m_hashmap(std::move(other.m_hashmap)),
+        m_weight(std::exchange(other.m_weight, 0)) {}
+
+  BasicLRUCache &operator=(const BasicLRUCache &) = delete;
+
+  BasicLRUCache &
+  operator=(detail::MoveSource<BasicLRUCache, Allocator> &&other) {
+    if (this != &other) {
+      Base::setCapacity(other.getCapacity());
+      m_list = std::move(other.m_list);
+      m_hashmap = std::move(other.m_hashmap);
+      m_weight = std::exchange(other.m_weight, 0);
+    }
+    return *this;
+  }
+
+  std::size_t getWeight() const { return m_weight; }
+
+  void setCapacity(std::size_t capacity) {
+    Base::setCapacity(capacity);
+    while (m_weight > capacity) {
+      evict();
+    }
+    m_hashmap.reserve(detail::entriesFor<Weigher>(capacity));
+    detail::expectNodes(m_hashmap.get_allocator(),
+                        detail::entriesFor<Weigher>(capacity));
+  }
+
+  // 'key' may be of any type that compares with K, e.g. std::string_view for
+  // std::string keys; see detail::findKey
+  template <typename Key> V *getPtr(const Key &key) {
+    // We check if 'key' is in the hash map
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end()) {
+      return nullptr;
+    }
+    // Otherwise, relink the node to the front of 'm_list', which keeps the
+    // iterator in the hash map valid
+    m_list.splice(m_list.begin(), m_list, iter->second);
+    // Return 'value' from the pair
+    return &iter->second->second;
+  }
+
+  template <typename Key> bool contains(const Key &key) const {
+    return detail::findKey(m_hashmap, key) != m_hashmap.end();
+  }
+
+  template <typename Key> bool erase(const Key &key) {
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end()) {
+      return false;
+    }
+    m_weight -= iter->second->getWeight();
+    m_list.erase(iter->second);
+    m_hashmap.erase(iter);
+    return true;
+  }
+
+  void getMany(const K *keys, std::size_t count,
+               std::optional<V> *results) {
+    typename decltype(m_hashmap)::iterator iters[detail::BATCH_SIZE];
+    for (std::size_t first = 0; first < count; first += detail::BATCH_SIZE) {
+      std::size_t size = std::min(detail::BATCH_SIZE, count - first);
+      // Probe every key of the group and prefetch the nodes of the hits
+      detail::findAll(m_hashmap, keys + first, size, iters);
+      for (std::size_t i = 0; i < size; ++i) {
+        if (iters[i] != m_hashmap.end()) {
+          detail::prefetch(&*iters[i]->second);
+        }
+      }
+      for (std::size_t i = 0; i < size; ++i) {
+        if (iters[i] == m_hashmap.end()) {
+          results[first + i] = std::nullopt;
+        } else {
+          m_list.splice(m_list.begin(), m_list, iters[i]->second);
+          results[first + i] = iters[i]->second->second;
+        }
+      }
+    }
+  }
+
+  void putMany(const K *keys, const V *values, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      BasicLRUCache::put(keys[i], values[i]);
+    }
+  }
+
+  void clear() {
+    m_list.clear();
+    m_hashmap.clear();
+    m_weight = 0;
+  }
+};
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+using LRUCache =
+    VirtualCache<BasicLRUCache<K, V, Key_Hash, Index, Weigher, Allocator>>;
+
+// Segmented LRU. New entries enter the probationary segment, and a hit there
+// promotes an entry to the protected segment, which holds up to a share of
+// the capacity given by the protected ratio. An entry pushed out of the
+// protected segment goes back to the front of the probationary one, and a
+// full cache evicts the least recently used probationary entry. Keys seen
+// only once, as in a scan, thus never displace the protected entries. Each
+// operation costs about as much as in LRUCache.
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+class BasicSLRUCache
+    : public BasicCache<
+          BasicSLRUCache<K, V, Key_Hash, Index, Weigher, Allocator>, K, V> {
+private:
+  using Base = BasicCache<
+      BasicSLRUCache<K, V, Key_Hash, Index, Weigher, Allocator>, K, V>;
+  friend Base;
+
+  struct Node : detail::EntryWeight<Weigher> {
+    K m_key;
+    V m_value;
+    bool m_protected;
+
+    template <typename Key, typename... Args>
+    Node(std::size_t weight, Key &&key, Args &&...args)
+        : m_key(std::forward<Key>(key)), m_value(std::forward<Args>(args)...),
+          m_protected(false) {
+      this->setWeight(weight);
+    }
+  };
+
+  using NodeList = std::list<Node, detail::Rebind<Allocator, Node>>;
+  using NodeIterator = typename NodeList::iterator;
+  using Map = typename Index::template map<
+      K, NodeIterator, Key_Hash,
+      detail::Rebind<Allocator, std::pair<const K, NodeIterator>>>;
+
+  // The fronts of the lists hold the most recently used entries. Nodes are
+  // spliced between them, so both use the same allocator
+  NodeList m_probation;
+  NodeList m_protected;
+  Map m_hashmap;
+  double m_protectedRatio;
+  std::size_t m_maxProtected;
+  std::size_t m_weight;
+  std::size_t m_protectedWeight;
+
+  void computeLimits() {
+    m_maxProtected = static_cast<std::size_t>(
+        static_cast<double>(this->getCapacity()) * m_protectedRatio);
+  }
+
+  // Moves protected entries over the limit back to probation
+  void demote() {
+    while (m_protectedWeight > m_maxProtected) {
+      auto node = std::prev(m_protected.end());
+      node->m_protected = false;
+      m_protectedWeight -= node->getWeight();
+      m_probation.splice(m_probation.begin(), m_protected, node);
+    }
+  }
+
+  void touch(NodeIterator node) {
+    if (node->m_protected) {
+      m_protected.splice(m_protected.begin(), m_protected, node);
+      return;
+    }
+    node->m_protected = true;
+    m_protectedWeight += node->getWeight();
+    m_protected.splice(m_protected.begin(), m_probation, node);
+    demote();
+  }
+
+  // Erases the entry that put() replaces once the cache is full, i.e. the
+  // least recently used probationary one, if any
+  void evict() {
+    auto &list = m_probation.empty() ? m_protected : m_probation;
+    m_weight -= list.back().getWeight();
+    if (list.back().m_protected) {
+      m_protectedWeight -= list.back().getWeight();
+    }
+    m_hashmap.erase(list.back().m_key);
+    list.pop_back();
+  }
+
+  // The core of put() and emplace(): stores the value constructed from 'args'
+  // under 'key', in an entry weighing 'weight'
+  template <typename Key, typename... Args>
+  void store(Key &&key, std::size_t weight, Args &&...args) {
+    // Corner case: an entry heavier than the whole cache is not cached
+    if (weight > this->getCapacity()) {
+      erase<K>(key);
+      return;
+    }
+    auto iter = m_hashmap.find(key);
+    if (iter != m_hashmap.end()) {
+      NodeIterator node = iter->second;
+      m_weight = m_weight - node->getWeight() + weight;
+      if (node->m_protected) {
+        m_protectedWeight = m_protectedWeight - node->getWeight() + weight;
+      }
+      node->setWeight(weight);
+      detail::assign(node->m_value, std::forward<Args>(args)...);
+      touch(node);
+      demote();
+      // A heavier value may push probationary entries out
+      while (m_weight > this->getCapacity()) {
+        evict();
+      }
+      return;
+    }
+    while (m_weight + weight > this->getCapacity()) {
+      evict();
+    }
+    m_probation.emplace_front(weight, std::forward<Key>(key),
+                              std::forward<Args>(args)...);
+    m_weight += weight;
+    m_hashmap.emplace(m_probation.front().m_key, m_probation.begin());
+  }
+
+public:
+  using weigher_type = Weigher;
+
+  // 'protectedRatio' is clamped to [0, 1]. With 0, every hit is demoted again
+  // at once and the cache behaves like LRUCache
+  explicit BasicSLRUCache(std::size_t capacity, double protectedRatio = 0.8,
+                          const Allocator &allocator = Allocator())
+      : Base(capacity), m_probation(allocator), m_protected(allocator),
+        m_hashmap(allocator),
+        m_protectedRatio(std::min(1.0, std::max(protectedRatio, 0.0))),
+        m_weight(0), m_protectedWeight(0) {
+    computeLimits();
+    m_hashmap.reserve(detail::entriesFor<Weigher>(capacity));
+    detail::expectNodes(m_hashmap.get_allocator(),
+                        detail::entriesFor<Weigher>(capacity));
+  }
+
+  BasicSLRUCache(const BasicSLRUCache &) = delete;
+
+  // The entries move with the lists, which leaves the cache moved from empty
+  BasicSLRUCache(BasicSLRUCache &&other)
+      : Base(other.getCapacity()), m_probation(std::move(other.m_probation)),
+        m_protected(std::move(other.m_protected)),
+        m_hashmap(std::move(other.m_hashmap)),
+        m_protectedRatio(other.m_protectedRatio),
+        m_maxProtected(other.m_maxProtected),
+        m_weight(std::exchange(other.m_weight, 0)),
+        m_protectedWeight(std::exchange(other.m_protectedWeight, 0)) {}
+
+  BasicSLRUCache &operator=(const BasicSLRUCache &) = delete;
+
+  BasicSLRUCache &
+  operator=(detail::MoveSource<BasicSLRUCache, Allocator> &&other) {
+    if (this != &other) {
+      Base::setCapacity(other.getCapacity());
+      m_probation = std::move(other.m_probation);
+      m_protected = std::move(other.m_protected);
+      m_hashmap = std::move(other.m_hashmap);
+      m_protectedRatio = other.m_protectedRatio;
+      m_maxProtected = other.m_maxProtected;
+      m_weight = std::exchange(other.m_weight, 0);
+      m_protectedWeight = std::exchange(other.m_protectedWeight, 0);
+    }
+    return *this;
+  }
+
+  double getProtectedRatio() const { return m_protectedRatio; }
+
+  std::size_t getWeight() const { return m_weight; }
+
+  void setCapacity(std::size_t capacity) {
+    Base::setCapacity(capacity);
+    computeLimits();
+    demote();
+    while (m_weight > capacity) {
+      evict();
+    }
+    m_hashmap.reserve(detail::entriesFor<Weigher>(capacity));
+    detail::expectNodes(m_hashmap.get_allocator(),
+                        detail::entriesFor<Weigher>(capacity));
+  }
+
+  // 'key' may be of any type that compares with K, e.g. std::string_view for
+  // std::string keys; see detail::findKey
+  template <typename Key> V *getPtr(const Key &key) {
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end()) {
+      return nullptr;
+    }
+    touch(iter->second);
+    return &iter->second->m_value;
+  }
+
+  template <typename Key> bool contains(const Key &key) const {
+    return detail::findKey(m_hashmap, key) != m_hashmap.end();
+  }
+
+  template <typename Key> bool erase(const Key &key) {
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end()) {
+      return false;
+    }
+    NodeIterator node = iter->second;
+    m_weight -= node->getWeight();
+    if (node->m_protected) {
+      m_protectedWeight -= node->getWeight();
+    }
+    (node->m_protected ? m_protected : m_probation).erase(node);
+    m_hashmap.erase(iter);
+    return true;
+  }
+
+  void clear() {
+    m_probation.clear();
+    m_protected.clear();
+    m_hashmap.clear();
+    m_weight = 0;
+    m_protectedWeight = 0;
+  }
+};
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+using SLRUCache =
+    VirtualCache<BasicSLRUCache<K, V, Key_Hash, Index, Weigher, Allocator>>;
+
+// Adaptive Replacement Cache (Megiddo and Modha). Entries seen once live in
+// 'm_recent' and entries seen again in 'm_frequent'; both are LRU lists. The
+// keys they evicted are remembered without their values in two ghost lists of
+// the same kinds. A put() of a key found in a ghost list shows which of the
+// two lists gave up an entry too early, and shifts the target size of
+// 'm_recent' towards it. A scan only passes through 'm_recent', so it cannot
+// flush the entries in 'm_frequent'.
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+class BasicARCCache
+    : public BasicCache<
+          BasicARCCache<K, V, Key_Hash, Index, Weigher, Allocator>, K, V> {
+private:
+  using Base = BasicCache<
+      BasicARCCache<K, V, Key_Hash, Index, Weigher, Allocator>, K, V>;
+  friend Base;
+
+  enum class Region { Recent, Frequent, RecentGhost, FrequentGhost };
+
+  using Entry = detail::WeightedPair<K, V, Weigher>;
+
+  // A remembered key, with the weight its entry had
+  struct Ghost : detail::EntryWeight<Weigher> {
+    K m_key;
+
+    Ghost(K &&key, std::size_t weight) : m_key(std::move(key)) {
+      this->setWeight(weight);
+    }
+  };
+
+  using ResidentList = std::list<Entry, detail::Rebind<Allocator, Entry>>;
+  using GhostList = std::list<Ghost, detail::Rebind<Allocator, Ghost>>;
+  using ResidentIterator = typename ResidentList::iterator;
+  using GhostIterator = typename GhostList::iterator;
+
+  // Where a key is, depending on its region
+  struct Location {
+    Region m_region;
+    ResidentIterator m_resident;
+    GhostIterator m_ghost;
+  };
+
+  // The fronts of the lists hold the most recently used keys. The sizes of
+  // the lists are measured by the weights of their entries
+  ResidentList m_recent;
+  ResidentList m_frequent;
+  GhostList m_recentGhosts;
+  GhostList m_frequentGhosts;
+  typename Index::template map<
+      K, Location, Key_Hash,
+      detail::Rebind<Allocator, std::pair<const K, Location>>>
+      m_hashmap;
+  std::size_t m_recentWeight;
+  std::size_t m_frequentWeight;
+  std::size_t m_recentGhostWeight;
+  std::size_t m_frequentGhostWeight;
+  // The target weight of 'm_recent'
+  std::size_t m_target;
+
+  std::size_t residentWeight() const {
+    return m_recentWeight + m_frequentWeight;
+  }
+
+  std::size_t totalWeight() const {
+    return residentWeight() + m_recentGhostWeight + m_frequentGhostWeight;
+  }
+
+  // Moves the least recently used entry of 'm_recent' or 'm_frequent',
+  // whichever is over its target, to the matching ghost list
+  void replace(bool inFrequentGhosts) {
+    bool fromRecent = !m_recent.empty() &&
+                      (m_recentWeight > m_target ||
+                       (inFrequentGhosts && m_recentWeight == m_target));
+    if (!fromRecent && m_frequent.empty()) {
+      fromRecent = true;
+    }
+    auto &resident = fromRecent ? m_recent : m_frequent;
+    auto &ghosts = fromRecent ? m_recentGhosts : m_frequentGhosts;
+    std::size_t weight = resident.back().getWeight();
+    (fromRecent ? m_recentWeight : m_frequentWeight) -= weight;
+    (fromRecent ? m_recentGhostWeight : m_frequentGhostWeight) += weight;
+    auto &location = m_hashmap.find(resident.back().first)->second;
+    ghosts.emplace_front(std::move(resident.back().first), weight);
+    resident.pop_back();
+    location.m_region =
+        fromRecent ? Region::RecentGhost : Region::FrequentGhost;
+    location.m_ghost = ghosts.begin();
+  }
+
+  void dropGhost(GhostList &ghosts) {
+    (&ghosts == &m_recentGhosts ? m_recentGhostWeight
+                                : m_frequentGhostWeight) -=
+        ghosts.back().getWeight();
+    m_hashmap.erase(ghosts.back().m_key);
+    ghosts.pop_back();
+  }
+
+  // Moves a remembered key back into 'm_frequent' with the value constructed
+  // from 'args'
+  template <typename... Args>
+  void revive(Location &location, GhostList &ghosts, std::size_t weight,
+              Args &&...args) {
+    (&ghosts == &m_recentGhosts ? m_recentGhostWeight
+                                : m_frequentGhostWeight) -=
+        location.m_ghost->getWeight();
+    m_frequent.emplace_front(weight, std::move(location.m_ghost->m_key),
+                             std::forward<Args>(args)...);
+    m_frequentWeight += weight;
+    ghosts.erase(location.m_ghost);
+    location.m_region = Region::Frequent;
+    location.m_resident = m_frequent.begin();
+  }
+
+  void touch(Location &location) {
+    if (location.m_region == Region::Recent) {
+      std::size_t weight = location.m_resident->getWeight();
+      m_recentWeight -= weight;
+      m_frequentWeight += weight;
+    }
+    auto &list = location.m_region == Region::Recent ? m_recent : m_frequent;
+    m_frequent.splice(m_frequent.begin(), list, location.m_resident);
+    location.m_region = Region::Frequent;
+  }
+
+  // Whether 'location' holds a value rather than a remembered key
+  static bool isResident(const Location &location) {
+    return location.m_region == Region::Recent ||
+           location.m_region == Region::Frequent;
+  }
+
+  // How far a ghost hit moves the target: by the weight of the entry, times
+  // the ratio of the other ghost list's weight to this one's if that is more
+  static std::size_t targetStep(std::size_t weight, std::size_t ghostWeight,
+                                std::size_t otherGhostWeight) {
+    std::size_t ratio =
+        otherGhostWeight / std::max<std::size_t>(ghostWeight, 1);
+    return weight * std::max<std::size_t>(ratio, 1);
+  }
+
+  // The core of put() and emplace(): stores the value constructed from 'args'
+  // under 'key', in an entry weighing 'weight'
+  template <typename Key, typename... Args>
+  void store(Key &&key, std::size_t weight, Args &&...args) {
+    // Corner case: an entry heavier than the whole cache is not cached
+    std::size_t capacity = this->getCapacity();
+    if (weight > capacity) {
+      erase<K>(key);
+      return;
+    }
+    auto iter = m_hashmap.find(key);
+    if (iter != m_hashmap.end()) {
+      Location &location = iter->second;
+      switch (location.m_region) {
+      case Region::Recent:
+      case Region::Frequent:
+        touch(location);
+        m_frequentWeight =
+            m_frequentWeight - location.m_resident->getWeight() + weight;
+        location.m_resident->setWeight(weight);
+        detail::assign(location.m_resident->second,
+                       std::forward<Args>(args)...);
+        while (residentWeight() > capacity) {
+          replace(false);
+        }
+        return;
+      case Region::RecentGhost:
+        // 'm_recent' evicted the key too early, so let it grow
+        m_target = std::min(capacity,
+                            m_target + targetStep(weight, m_recentGhostWeight,
+                                                  m_frequentGhostWeight));
+        while (residentWeight() + weight > capacity) {
+          replace(false);
+        }
+        revive(location, m_recentGhosts, weight, std::forward<Args>(args)...);
+        return;
+      case Region::FrequentGhost:
+        // 'm_frequent' evicted the key too early, so let it grow
+        m_target -= std::min(m_target, targetStep(weight, m_frequentGhostWeight,
+                                                  m_recentGhostWeight));
+        while (residentWeight() + weight > capacity) {
+          replace(true);
+        }
+        revive(location, m_frequentGhosts, weight,
+               std::forward<Args>(args)...);
+        return;
+      }
+    }
+    // 'm_recent' and its ghosts stay within the capacity, and all lists
+    // within twice the capacity
+    while (m_recentWeight + m_recentGhostWeight + weight > capacity) {
+      if (m_recentGhosts.empty()) {
+        // 'm_recent' fills the whole cache, so its oldest entry leaves it
+        // without a trace
+        m_recentWeight -= m_recent.back().getWeight();
+        m_hashmap.erase(m_recent.back().first);
+        m_recent.pop_back();
+      } else {
+        dropGhost(m_recentGhosts);
+      }
+    }
+    while (totalWeight() + weight > 2 * capacity && !m_frequentGhosts.empty()) {
+      dropGhost(m_frequentGhosts);
+    }
+    while (residentWeight() + weight > capacity) {
+      replace(false);
+    }
+    m_recent.emplace_front(weight, std::forward<Key>(key),
+                           std::forward<Args>(args)...);
+    m_recentWeight += weight;
+    m_hashmap.emplace(m_recent.front().first,
+                      Location{Region::Recent, m_recent.begin(), {}});
+  }
+
+public:
+  using weigher_type = Weigher;
+
+  // The hash map also holds the ghost keys, up to twice the capacity in all.
+  // Entries move between the lists, so all of them use 'allocator'
+  explicit BasicARCCache(std::size_t capacity,
+                         const Allocator &allocator = Allocator())
+      : Base(capacity), m_recent(allocator), m_frequent(allocator),
+        m_recentGhosts(allocator), m_frequentGhosts(allocator),
+        m_hashmap(allocator), m_recentWeight(0), m_frequentWeight(0),
+        m_recentGhostWeight(0), m_frequentGhostWeight(0), m_target(0) {
+    m_hashmap.reserve(2 * detail::entriesFor<Weigher>(capacity));
+    detail::expectNodes(m_hashmap.get_allocator(),
+                        detail::entriesFor<Weigher>(capacity));
+  }
+
+  BasicARCCache(const BasicARCCache &) = delete;
+
+  // The entries and the ghosts move with the lists, which leaves the cache
+  // moved from empty, with no target for 'm_recent' learnt yet
+  BasicARCCache(BasicARCCache &&other)
+      : Base(other.getCapacity()), m_recent(std::move(other.m_recent)),
+        m_frequent(std::move(other.m_frequent)),
+        m_recentGhosts(std::move(other.m_recentGhosts)),
+        m_frequentGhosts(std::move(other.m_frequentGhosts)),
+        m_hashmap(std::move(other.m_hashmap)),
+        m_recentWeight(std::exchange(other.m_recentWeight, 0)),
+        m_frequentWeight(std::exchange(other.m_frequentWeight, 0)),
+        m_recentGhostWeight(std::exchange(other.m_recentGhostWeight, 0)),
+        m_frequentGhostWeight(std::exchange(other.m_frequentGhostWeight, 0)),
+        m_target(std::exchange(other.m_target, 0)) {}
+
+  BasicARCCache &operator=(const BasicARCCache &) = delete;
+
+  BasicARCCache &
+  operator=(detail::MoveSource<BasicARCCache, Allocator> &&other) {
+    if (this != &other) {
+      Base::setCapacity(other.getCapacity());
+      m_recent = std::move(other.m_recent);
+      m_frequent = std::move(other.m_frequent);
+      m_recentGhosts = std::move(other.m_recentGhosts);
+      m_frequentGhosts = std::move(other.m_frequentGhosts);
+      m_hashmap = std::move(other.m_hashmap);
+      m_recentWeight = std::exchange(other.m_recentWeight, 0);
+      m_frequentWeight = std::exchange(other.m_frequentWeight, 0);
+      m_recentGhostWeight = std::exchange(other.m_recentGhostWeight, 0);
+      m_frequentGhostWeight = std::exchange(other.m_frequentGhostWeight, 0);
+      m_target = std::exchange(other.m_target, 0);
+    }
+    return *this;
+  }
+
+  std::size_t getWeight() const { return residentWeight(); }
+
+  // Shrinking moves the entries over the new capacity to the ghost lists as
+  // put() would, then forgets the oldest ghosts until those fit as well
+  void setCapacity(std::size_t capacity) {
+    Base::setCapacity(capacity);
+    m_target = std::min(m_target, capacity);
+    while (residentWeight() > capacity) {
+      replace(false);
+    }
+    while (m_recentWeight + m_recentGhostWeight > capacity &&
+           !m_recentGhosts.empty()) {
+      dropGhost(m_recentGhosts);
+    }
+    while (totalWeight() > 2 * capacity && !m_frequentGhosts.empty()) {
+      dropGhost(m_frequentGhosts);
+    }
+    m_hashmap.reserve(2 * detail::entriesFor<Weigher>(capacity));
+    detail::expectNodes(m_hashmap.get_allocator(),
+                        detail::entriesFor<Weigher>(capacity));
+  }
+
+  // 'key' may be of any type that compares with K, e.g. std::string_view for
+  // std::string keys; see detail::findKey
+  template <typename Key> V *getPtr(const Key &key) {
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end() || !isResident(iter->second)) {
+      return nullptr;
+    }
+    touch(iter->second);
+    return &iter->second.m_resident->second;
+  }
+
+  template <typename Key> bool contains(const Key &key) const {
+    auto iter = detail::findKey(m_hashmap, key);
+    return iter != m_hashmap.end() && isResident(iter->second);
+  }
+
+  template <typename Key> bool erase(const Key &key) {
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end() || !isResident(iter->second)) {
+      return false;
+    }
+    bool recent = iter->second.m_region == Region::Recent;
+    (recent ? m_recentWeight : m_frequentWeight) -=
+        iter->second.m_resident->getWeight();
+    (recent ? m_recent : m_frequent).erase(iter->second.m_resident);
+    m_hashmap.erase(iter);
+    return true;
+  }
+
+  void clear() {
+    m_recent.clear();
+    m_frequent.clear();
+    m_recentGhosts.clear();
+    m_frequentGhosts.clear();
+    m_hashmap.clear();
+    m_recentWeight = 0;
+    m_frequentWeight = 0;
+    m_recentGhostWeight = 0;
+    m_frequentGhostWeight = 0;
+    m_target = 0;
+  }
+};
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+using ARCCache =
+    VirtualCache<BasicARCCache<K, V, Key_Hash, Index, Weigher, Allocator>>;
+
+// A LRU cache whose recency links and hash chain live inside each entry, so a
+// hit touches a single entry instead of a list node and a separate hash node.
+// Entries are carved out of slabs that are only released by the destructor:
+// once the cache is full, put() reuses the evicted entry and never allocates.
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Weigher = UnitWeigher>
+class BasicIntrusiveLRUCache
+    : public BasicCache<BasicIntrusiveLRUCache<K, V, Key_Hash, Weigher>, K, V> {
+private:
+  using Base =
+      BasicCache<BasicIntrusiveLRUCache<K, V, Key_Hash, Weigher>, K, V>;
+  friend Base;
+
+  struct Entry : detail::EntryWeight<Weigher> {
+    K m_key;
+    V m_value;
+    std::size_t m_hash;
+    Entry *m_prev;
+    Entry *m_next;
+    Entry *m_chain; // the next entry in the same bucket
+
+    template <typename Key, typename... Args>
+    Entry(std::size_t hash, std::size_t weight, Key &&key, Args &&...args)
+        : m_key(std::forward<Key>(key)), m_value(std::forward<Args>(args)...),
+          m_hash(hash), m_prev(nullptr), m_next(nullptr), m_chain(nullptr) {
+      this->setWeight(weight);
+    }
+  };
+
+  // Released entries are kept in a free list threaded through their storage
+  struct FreeEntry {
+    FreeEntry *m_next;
+  };
+
+  static constexpr std::size_t INITIAL_BUCKET_COUNT = 16;
+  static constexpr std::size_t MINIMAL_SLAB_SIZE = 16;
+
+  Key_Hash m_hasher;
+  std::vector<Entry *> m_buckets;
+  std::size_t m_size;
+  std::size_t m_weight;
+  // 'm_head' is the most recently used entry and 'm_tail' the least
+  Entry *m_head;
+  Entry *m_tail;
+  std::vector<std::pair<Entry *, std::size_t>> m_slabs;
+  std::size_t m_slabUsed;
+  std::size_t m_slabTotal;
+  FreeEntry *m_freeList;
+
+  Entry **bucketOf(std::size_t hash) {
+    return &m_buckets[hash & (m_buckets.size() - 1)];
+  }
+
+  template <typename Key>
+  Entry *findEntry(const Key &key, std::size_t hash) const {
+    for (Entry *entry = m_buckets[hash & (m_buckets.size() - 1)];
+         entry != nullptr; entry = entry->m_chain) {
+      if (entry->m_hash == hash && entry->m_key == key) {
+        return entry;
+      }
+    }
+    return nullptr;
+  }
+
+  // Keys of other types are converted to K unless 'Key_Hash' is transparent
+  template <typename Key> Entry *findEntry(const Key &key) const {
+    if constexpr (std::is_same<Key, K>::value ||
+                  detail::IsTransparent<Key_Hash>::value) {
+      return findEntry(key, m_hasher(key));
+    } else {
+      return findEntry(static_cast<K>(key));
+    }
+  }
+
+  void linkToBucket(Entry *entry) {
+    Entry **bucket = bucketOf(entry->m_hash);
+    entry->m_chain = *bucket;
+    *bucket = entry;
+  }
+
+  void unlinkFromBucket(Entry *entry) {
+    Entry **link = bucketOf(entry->m_hash);
+    while (*link != entry) {
+      link = &(*link)->m_chain;
+    }
+    *link = entry->m_chain;
+  }
+
+  void linkToFront(Entry *entry) {
+    entry->m_prev = nullptr;
+    entry->m_next = m_head;
+    if (m_head != nullptr) {
+      m_head->m_prev = entry;
+    } else {
+      m_tail = entry;
+    }
+    m_head = entry;
+  }
+
+  void unlinkFromList(Entry *entry) {
+    if (entry->m_prev != nullptr) {
+      entry->m_prev->m_next = entry->m_next;
+    } else {
+      m_head = entry->m_next;
+    }
+    if (entry->m_next != nullptr) {
+      entry->m_next->m_prev = entry->m_prev;
+    } else {
+      m_tail = entry->m_prev;
+    }
+  }
+
+  void moveToFront(Entry *entry) {
+    if (entry != m_head) {
+      unlinkFromList(entry);
+      linkToFront(entry);
+    }
+  }
+
+  // The bucket array holds a power of two of buckets, at least one per entry
+  static std::size_t bucketCountFor(std::size_t capacity) {
+    std::size_t count = INITIAL_BUCKET_COUNT;
+    while (count < capacity) {
+      count *= 2;
+    }
+    return count;
+  }
+
+  void rehashBuckets(std::size_t count) {
+    std::vector<Entry *> buckets(count, nullptr);
+    m_buckets.swap(buckets);
+    for (Entry *head : buckets) {
+      while (head != nullptr) {
+        Entry *next = head->m_chain;
+        linkToBucket(head);
+        head = next;
+      }
+    }
+  }
+
+  void *allocateEntry() {
+    if (m_freeList != nullptr) {
+      void *memory = m_freeList;
+      m_freeList = m_freeList->m_next;
+      return memory;
+    }
+    if (m_slabs.empty() || m_slabUsed == m_slabs.back().second) {
+      // Slabs double in size but never hold more entries than the capacity
+      std::size_t size = std::max(MINIMAL_SLAB_SIZE, m_slabTotal);
+      if (this->getCapacity() > m_slabTotal) {
+        size = std::min(size, this->getCapacity() - m_slabTotal);
+      }
+      m_slabs.emplace_back(std::allocator<Entry>().allocate(size), size);
+      m_slabUsed = 0;
+      m_slabTotal += size;
+    }
+    return m_slabs.back().first + m_slabUsed++;
+  }
+
+  // Allocates the storage of the entries up to 'capacity' in one slab, after
+  // moving what is left of the current slab to the free list
+  void reserveEntries(std::size_t capacity) {
+    if (capacity <= m_slabTotal) {
+      return;
+    }
+    if (!m_slabs.empty()) {
+      for (; m_slabUsed < m_slabs.back().second; ++m_slabUsed) {
+        Entry *entry = m_slabs.back().first + m_slabUsed;
+        m_freeList = new (static_cast<void *>(entry)) FreeEntry{m_freeList};
+      }
+    }
+    std::size_t size = capacity - m_slabTotal;
+    m_slabs.emplace_back(std::allocator<Entry>().allocate(size), size);
+    m_slabUsed = 0;
+    m_slabTotal += size;
+  }
+
+  void releaseEntry(Entry *entry) {
+    entry->~Entry();
+    m_freeList = new (static_cast<void *>(entry)) FreeEntry{m_freeList};
+  }
+
+  void removeEntry(Entry *entry) {
+    unlinkFromBucket(entry);
+    unlinkFromList(entry);
+    m_weight -= entry->getWeight();
+    releaseEntry(entry);
+    --m_size;
+  }
+
+  void evictTail() { removeEntry(m_tail); }
+
+  // The core of put() and emplace(): stores the value constructed from 'args'
+  // under 'key', whose hash is 'hash', in an entry weighing 'weight'
+  template <typename Key, typename... Args>
+  void storeWithHash(Key &&key, std::size_t hash, std::size_t weight,
+                     Args &&...args) {
+    // Corner case: an entry heavier than the whole cache is not cached
+    std::size_t capacity = this->getCapacity();
+    Entry *entry = findEntry(key, hash);
+    if (weight > capacity) {
+      if (entry != nullptr) {
+        removeEntry(entry);
+      }
+    } else if (entry != nullptr) {
+      m_weight = m_weight - entry->getWeight() + weight;
+      entry->setWeight(weight);
+      detail::assign(entry->m_value, std::forward<Args>(args)...);
+      moveToFront(entry);
+      // A heavier value may push less recently used entries out
+      while (m_weight > capacity) {
+        evictTail();
+      }
+    } else if (m_weight + weight > capacity &&
+               m_weight + weight - m_tail->getWeight() <= capacity) {
+      // The cache is full, and evicting the least recently used entry makes
+      // room, so the new entry is built in its storage, with no temporary
+      // value to assign from
+      entry = m_tail;
+      std::size_t oldWeight = entry->getWeight();
+      unlinkFromBucket(entry);
+      unlinkFromList(entry);
+      entry->~Entry();
+      try {
+        new (entry) Entry(hash, weight, std::forward<Key>(key),
+                          std::forward<Args>(args)...);
+      } catch (...) {
+        // The old entry is gone by now, so its storage is released as if it
+        // had been evicted
+        m_freeList = new (static_cast<void *>(entry)) FreeEntry{m_freeList};
+        m_weight -= oldWeight;
+        --m_size;
+        throw;
+      }
+      m_weight = m_weight - oldWeight + weight;
+      linkToBucket(entry);
+      linkToFront(entry);
+    } else {
+      while (m_weight + weight > capacity) {
+        evictTail();
+      }
+      entry = new (allocateEntry()) Entry(hash, weight, std::forward<Key>(key),
+                                          std::forward<Args>(args)...);
+      m_weight += weight;
+      linkToBucket(entry);
+      linkToFront(entry);
+      // Only a capacity in weights leaves the number of entries open
+      if (++m_size > m_buckets.size()) {
+        rehashBuckets(2 * m_buckets.size());
+      }
+    }
+  }
+
+  template <typename Key, typename... Args>
+  void store(Key &&key, std::size_t weight, Args &&...args) {
+    std::size_t hash = m_hasher(key);
+    storeWithHash(std::forward<Key>(key), hash, weight,
+                  std::forward<Args>(args)...);
+  }
+
+  void swap(BasicIntrusiveLRUCache &other) {
+    std::size_t capacity = this->getCapacity();
+    Base::setCapacity(other.getCapacity());
+    other.Base::setCapacity(capacity);
+    std::swap(m_hasher, other.m_hasher);
+    m_buckets.swap(other.m_buckets);
+    std::swap(m_size, other.m_size);
+    std::swap(m_weight, other.m_weight);
+    std::swap(m_head, other.m_head);
+    std::swap(m_tail, other.m_tail);
+    m_slabs.swap(other.m_slabs);
+    std::swap(m_slabUsed, other.m_slabUsed);
+    std::swap(m_slabTotal, other.m_slabTotal);
+    std::swap(m_freeList, other.m_freeList);
+  }
+
+public:
+  using weigher_type = Weigher;
+
+  // When the capacity counts entries, the buckets are sized for it up front,
+  // so filling the cache never rehashes them; the entries are still allocated
+  // as they are needed
+  explicit BasicIntrusiveLRUCache(std::size_t capacity)
+      : Base(capacity),
+        m_buckets(bucketCountFor(detail::entriesFor<Weigher>(capacity)),
+                  nullptr),
+        m_size(0), m_weight(0), m_head(nullptr), m_tail(nullptr), m_slabUsed(0),
+        m_slabTotal(0), m_freeList(nullptr) {}
+
+  BasicIntrusiveLRUCache(const BasicIntrusiveLRUCache &) = delete;
+
+  // The entries, their slabs and free list, and the buckets move with the
+  // cache, which leaves the one moved from empty, with the buckets of a new
+  // cache
+  BasicIntrusiveLRUCache(BasicIntrusiveLRUCache &&other)
+      : Base(other.getCapacity()), m_hasher(other.m_hasher),
+        m_buckets(INITIAL_BUCKET_COUNT, nullptr), m_size(0), m_weight(0),
+        m_head(nullptr), m_tail(nullptr), m_slabUsed(0), m_slabTotal(0),
+        m_freeList(nullptr) {
+    swap(other);
+  }
+
+  BasicIntrusiveLRUCache &operator=(const BasicIntrusiveLRUCache &) = delete;
+
+  BasicIntrusiveLRUCache &operator=(BasicIntrusiveLRUCache &&other) {
+    if (this != &other) {
+      BasicIntrusiveLRUCache moved(std::move(other));
+      swap(moved);
+    }
+    return *this;
+  }
+
+  std::size_t getWeight() const { return m_weight; }
+
+  // Shrinking keeps the storage of the evicted entries for reuse, and growing
+  // allocates the storage of the new entries it reserves room for at once
+  void setCapacity(std::size_t capacity) {
+    Base::setCapacity(capacity);
+    while (m_weight > capacity) {
+      evictTail();
+    }
+    std::size_t entries = detail::entriesFor<Weigher>(capacity);
+    if (entries > m_buckets.size()) {
+      rehashBuckets(bucketCountFor(entries));
+    }
+    reserveEntries(entries);
+  }
+
+  ~BasicIntrusiveLRUCache() {
+    clear();
+    for (auto &slab : m_slabs) {
+      std::allocator<Entry>().deallocate(slab.first, slab.second);
+    }
+  }
+
+  // 'key' may be of any type that compares with K, without conversion when
+  // 'Key_Hash' is transparent
+  template <typename Key> V *getPtr(const Key &key) {
+    Entry *entry = findEntry(key);
+    if (entry == nullptr) {
+      return nullptr;
+    }
+    moveToFront(entry);
+    return &entry->m_value;
+  }
+
+  template <typename Key> bool contains(const Key &key) const {
+    return findEntry(key) != nullptr;
+  }
+
+  template <typename Key> bool erase(const Key &key) {
+    Entry *entry = findEntry(key);
+    if (entry == nullptr) {
+      return false;
+    }
+    removeEntry(entry);
+    return true;
+  }
+
+  void getMany(const K *keys, std::size_t count,
+               std::optional<V> *results) {
+    std::size_t hashes[detail::BATCH_SIZE];
+    for (std::size_t first = 0; first < count; first += detail::BATCH_SIZE) {
+      std::size_t size = std::min(detail::BATCH_SIZE, count - first);
+      // Hash every key of the group and prefetch its bucket, then prefetch the
+      // first entry of each bucket, and only then walk the chains
+      for (std::size_t i = 0; i < size; ++i) {
+        hashes[i] = m_hasher(keys[first + i]);
+        detail::prefetch(bucketOf(hashes[i]));
+      }
+      for (std::size_t i = 0; i < size; ++i) {
+        if (Entry *head = *bucketOf(hashes[i])) {
+          detail::prefetch(head);
+        }
+      }
+      for (std::size_t i = 0; i < size; ++i) {
+        Entry *entry = findEntry(keys[first + i], hashes[i]);
+        if (entry == nullptr) {
+          results[first + i] = std::nullopt;
+        } else {
+          moveToFront(entry);
+          results[first + i] = entry->m_value;
+        }
+      }
+    }
+  }
+
+  void putMany(const K *keys, const V *values, std::size_t count) {
+    std::size_t hashes[detail::BATCH_SIZE];
+    for (std::size_t first = 0; first < count; first += detail::BATCH_SIZE) {
+      std::size_t size = std::min(detail::BATCH_SIZE, count - first);
+      for (std::size_t i = 0; i < size; ++i) {
+        hashes[i] = m_hasher(keys[first + i]);
+        detail::prefetch(bucketOf(hashes[i]));
+      }
+      for (std::size_t i = 0; i < size; ++i) {
+        storeWithHash(keys[first + i], hashes[i],
+                      Weigher()(keys[first + i], values[first + i]),
+                      values[first + i]);
+      }
+    }
+  }
+
+  void clear() {
+    while (m_head != nullptr) {
+      Entry *next = m_head->m_next;
+      releaseEntry(m_head);
+      m_head = next;
+    }
+    m_tail = nullptr;
+    m_size = 0;
+    m_weight = 0;
+    std::fill(m_buckets.begin(), m_buckets.end(), nullptr);
+  }
+};
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Weigher = UnitWeigher>
+using IntrusiveLRUCache =
+    VirtualCache<BasicIntrusiveLRUCache<K, V, Key_Hash, Weigher>>;
+
+// Estimates how often each key was seen with a count-min sketch of 4-bit
+// counters, sixteen to a 64-bit word. A key has one counter in each of four
+// rows and its frequency is the smallest of them, which can only overstate
+// it. Once the counters have been incremented ten times the capacity, they
+// are all halved, so the sketch follows changes in popularity.
+template <typename K, typename Key_Hash = std::hash<K>> class FrequencySketch {
+private:
+  static constexpr std::uint64_t SEEDS[4] = {
+      0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL,
+      0xcbf29ce484222325ULL};
+  static constexpr std::uint64_t MAXIMAL_COUNT = 15;
+
+  Key_Hash m_hasher;
+  std::vector<std::uint64_t> m_table;
+  std::size_t m_sampleSize;
+  std::size_t m_additions;
+
+  // The word and the bit offset of the counter of 'hash' in row 'row'
+  std::pair<std::size_t, unsigned> counterOf(std::uint64_t hash,
+                                             std::size_t row) const {
+    std::uint64_t mixed = (hash + SEEDS[row]) * SEEDS[row];
+    mixed ^= mixed >> 32;
+    std::size_t word = static_cast<std::size_t>(mixed) & (m_table.size() - 1);
+    return std::make_pair(word, static_cast<unsigned>(mixed >> 60) * 4);
+  }
+
+  void halve() {
+    for (auto &word : m_table) {
+      word = (word >> 1) & 0x7777777777777777ULL;
+    }
+    m_additions /= 2;
+  }
+
+  // The larger of each pair of counters of 'lhs' and 'rhs'
+  static std::uint64_t maxCounters(std::uint64_t lhs, std::uint64_t rhs) {
+    std::uint64_t result = 0;
+    for (unsigned shift = 0; shift < 64; shift += 4) {
+      result |= std::max(lhs >> shift & 15, rhs >> shift & 15) << shift;
+    }
+    return result;
+  }
+
+public:
+  explicit FrequencySketch(std::size_t capacity)
+      : m_sampleSize(0), m_additions(0) {
+    resize(capacity);
+  }
+
+  // Sizes the sketch for 'capacity' keys. A key's counters stay at the same
+  // offsets in words whose index keeps its low bits, so a larger table
+  // copies each word to every word that shares them, and a smaller one keeps
+  // the larger counter of the words that merge. The counters are then halved
+  // as when they age, so the sketch keeps its history without overstating it
+  // more than the merge does.
+  void resize(std::size_t capacity) {
+    std::size_t words = 1;
+    while (words < capacity) {
+      words *= 2;
+    }
+    m_sampleSize = 10 * std::max<std::size_t>(capacity, 1);
+    if (words == m_table.size()) {
+      return;
+    }
+    std::vector<std::uint64_t> table(words, 0);
+    if (!m_table.empty()) {
+      for (std::size_t i = 0; i < std::max(words, m_table.size()); ++i) {
+        std::uint64_t &word = table[i & (words - 1)];
+        word = maxCounters(word, m_table[i & (m_table.size() - 1)]);
+      }
+    }
+    m_table.swap(table);
+    halve();
+  }
+
+  unsigned frequency(const K &key) const {
+    auto hash = static_cast<std::uint64_t>(m_hasher(key));
+    std::uint64_t count = MAXIMAL_COUNT;
+    for (std::size_t row = 0; row < 4; ++row) {
+      auto counter = counterOf(hash, row);
+      count = std::min(count, (m_table[counter.first] >> counter.second) & 15);
+    }
+    return static_cast<unsigned>(count);
+  }
+
+  void increment(const K &key) {
+    auto hash = static_cast<std::uint64_t>(m_hasher(key));
+    bool added = false;
+    for (std::size_t row = 0; row < 4; ++row) {
+      auto counter = counterOf(hash, row);
+      if (((m_table[counter.first] >> counter.second) & 15) < MAXIMAL_COUNT) {
+        m_table[counter.first] += std::uint64_t(1) << counter.second;
+        added = true;
+      }
+    }
+    if (added && ++m_additions >= m_sampleSize) {
+      halve();
+    }
+  }
+
+  void clear() {
+    std::fill(m_table.begin(), m_table.end(), 0);
+    m_additions = 0;
+  }
+};
+
+// W-TinyLFU: new entries go to a small LRU window holding 1% of the capacity.
+// An entry leaving the window only enters the main space if the frequency
+// sketch rates it above the entry the main space would evict for it, so keys
+// seen once cannot flush out popular ones. The main space is a segmented LRU:
+// entries start in its probation segment and move to the protected segment,
+// which holds up to 80% of it, when they are hit there.
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+class BasicTinyLFUCache
+    : public BasicCache<
+          BasicTinyLFUCache<K, V, Key_Hash, Index, Weigher, Allocator>, K, V> {
+private:
+  using Base = BasicCache<
+      BasicTinyLFUCache<K, V, Key_Hash, Index, Weigher, Allocator>, K, V>;
+  friend Base;
+
+  enum class Region { Window, Probation, Protected };
+
+  struct Node : detail::EntryWeight<Weigher> {
+    K m_key;
+    V m_value;
+    Region m_region;
+
+    template <typename Key, typename... Args>
+    Node(Region region, std::size_t weight, Key &&key, Args &&...args)
+        : m_key(std::forward<Key>(key)), m_value(std::forward<Args>(args)...),
+          m_region(region) {
+      this->setWeight(weight);
+    }
+  };
+
+  using NodeList = std::list<Node, detail::Rebind<Allocator, Node>>;
+  using NodeIterator = typename NodeList::iterator;
+  using Map = typename Index::template map<
+      K, NodeIterator, Key_Hash,
+      detail::Rebind<Allocator, std::pair<const K, NodeIterator>>>;
+  using Sketch = FrequencySketch<K, Key_Hash>;
+
+  // The fronts of the lists hold the most recently used entries. Nodes are
+  // spliced between them, so all of them use the same allocator
+  NodeList m_window;
+  NodeList m_probation;
+  NodeList m_protected;
+  Map m_hashmap;
+  Sketch m_sketch;
+  // The number of keys the sketch is sized for
+  std::size_t m_sketchSize;
+  // The weights of the regions, indexed by Region
+  std::size_t m_weights[3];
+  std::size_t m_maxWindow;
+  std::size_t m_maxMain;
+  std::size_t m_maxProtected;
+
+  void computeLimits() {
+    std::size_t capacity = this->getCapacity();
+    m_maxWindow = std::min<std::size_t>(capacity, std::max<std::size_t>(
+                                                      1, capacity / 100));
+    m_maxMain = capacity - m_maxWindow;
+    m_maxProtected = m_maxMain - m_maxMain / 5;
+  }
+
+  std::size_t &weightOf(Region region) {
+    return m_weights[static_cast<std::size_t>(region)];
+  }
+
+  std::size_t mainWeight() const {
+    return m_weights[static_cast<std::size_t>(Region::Probation)] +
+           m_weights[static_cast<std::size_t>(Region::Protected)];
+  }
+
+  NodeList &listOf(Region region) {
+    switch (region) {
+    case Region::Window:
+      return m_window;
+    case Region::Probation:
+      return m_probation;
+    default:
+      return m_protected;
+    }
+  }
+
+  void moveTo(NodeIterator node, Region region) {
+    NodeList &list = listOf(region);
+    list.splice(list.begin(), listOf(node->m_region), node);
+    weightOf(node->m_region) -= node->getWeight();
+    weightOf(region) += node->getWeight();
+    node->m_region = region;
+  }
+
+  void evictNode(NodeIterator node) {
+    weightOf(node->m_region) -= node->getWeight();
+    m_hashmap.erase(node->m_key);
+    listOf(node->m_region).erase(node);
+  }
+
+  // The entry the main space gives up for a candidate from the window
+  NodeIterator mainVictim() {
+    return m_probation.empty() ? std::prev(m_protected.end())
+                               : std::prev(m_probation.end());
+  }
+
+  // Moves the least recently used entry of the window to the main space if it
+  // fits or wins against the main space's victims until it does, and evicts
+  // the losers
+  void evictFromWindow() {
+    NodeIterator candidate = std::prev(m_window.end());
+    if (candidate->getWeight() > m_maxMain) {
+      evictNode(candidate);
+      return;
+    }
+    while (mainWeight() + candidate->getWeight() > m_maxMain) {
+      NodeIterator victim = mainVictim();
+      if (m_sketch.frequency(candidate->m_key) <=
+          m_sketch.frequency(victim->m_key)) {
+        evictNode(candidate);
+        return;
+      }
+      evictNode(victim);
+    }
+    moveTo(candidate, Region::Probation);
+  }
+
+  // Demotes the least recently used protected entries over the protected
+  // share
+  void demote() {
+    while (weightOf(Region::Protected) > m_maxProtected) {
+      moveTo(std::prev(m_protected.end()), Region::Probation);
+    }
+  }
+
+  // Brings every region back within its share, as after a heavier update or
+  // a smaller capacity
+  void rebalance() {
+    demote();
+    while (weightOf(Region::Window) > m_maxWindow) {
+      evictFromWindow();
+    }
+    while (mainWeight() > m_maxMain) {
+      evictNode(mainVictim());
+    }
+  }
+
+  void touch(NodeIterator node) {
+    m_sketch.increment(node->m_key);
+    if (node->m_region == Region::Probation) {
+      moveTo(node, Region::Protected);
+      demote();
+    } else {
+      moveTo(node, node->m_region);
+    }
+  }
+
+  // The core of put() and emplace(): stores the value constructed from 'args'
+  // under 'key', in an entry weighing 'weight'
+  template <typename Key, typename... Args>
+  void store(Key &&key, std::size_t weight, Args &&...args) {
+    // Corner case: an entry heavier than the whole cache is not cached
+    if (weight > this->getCapacity()) {
+      erase<K>(key);
+      return;
+    }
+    auto iter = m_hashmap.find(key);
+    if (iter != m_hashmap.end()) {
+      NodeIterator node = iter->second;
+      weightOf(node->m_region) =
+          weightOf(node->m_region) - node->getWeight() + weight;
+      node->setWeight(weight);
+      detail::assign(node->m_value, std::forward<Args>(args)...);
+      touch(node);
+      rebalance();
+      return;
+    }
+    m_sketch.increment(key);
+    m_window.emplace_front(Region::Window, weight, std::forward<Key>(key),
+                           std::forward<Args>(args)...);
+    weightOf(Region::Window) += weight;
+    m_hashmap.emplace(m_window.front().m_key, m_window.begin());
+    while (weightOf(Region::Window) > m_maxWindow) {
+      evictFromWindow();
+    }
+    if (m_hashmap.size() > m_sketchSize) {
+      // Only a capacity in weights, or one over the entries reserved for,
+      // lets the entries outgrow the sketch
+      m_sketchSize = std::max<std::size_t>(16, 2 * m_sketchSize);
+      m_sketch.resize(m_sketchSize);
+    }
+  }
+
+public:
+  using weigher_type = Weigher;
+
+  // When the capacity is in weights, the number of entries is not known, and
+  // the sketch starts small and is resized as the entries outgrow it. The
+  // sketch is a plain array, so only the nodes and the hash map take their
+  // memory from 'allocator'
+  explicit BasicTinyLFUCache(std::size_t capacity,
+                             const Allocator &allocator = Allocator())
+      : Base(capacity), m_window(allocator), m_probation(allocator),
+        m_protected(allocator), m_hashmap(allocator),
+        m_sketch(detail::entriesFor<Weigher>(capacity)),
+        m_sketchSize(detail::entriesFor<Weigher>(capacity)), m_weights() {
+    computeLimits();
+    m_hashmap.reserve(m_sketchSize);
+    detail::expectNodes(m_hashmap.get_allocator(), m_sketchSize);
+  }
+
+  BasicTinyLFUCache(const BasicTinyLFUCache &) = delete;
+
+  // The entries and the sketch move with the cache, which leaves the one
+  // moved from empty, with a sketch sized for no keys that grows as they come
+  BasicTinyLFUCache(BasicTinyLFUCache &&other)
+      : Base(other.getCapacity()), m_window(std::move(other.m_window)),
+        m_probation(std::move(other.m_probation)),
+        m_protected(std::move(other.m_protected)),
+        m_hashmap(std::move(other.m_hashmap)),
+        m_sketch(std::exchange(other.m_sketch, Sketch(0))),
+        m_sketchSize(std::exchange(other.m_sketchSize, 0)), m_weights(),
+        m_maxWindow(other.m_maxWindow), m_maxMain(other.m_maxMain),
+        m_maxProtected(other.m_maxProtected) {
+    std::swap(m_weights, other.m_weights);
+  }
+
+  BasicTinyLFUCache &operator=(const BasicTinyLFUCache &) = delete;
+
+  BasicTinyLFUCache &
+  operator=(detail::MoveSource<BasicTinyLFUCache, Allocator> &&other) {
+    if (this != &other) {
+      Base::setCapacity(other.getCapacity());
+      m_window = std::move(other.m_window);
+      m_probation = std::move(other.m_probation);
+      m_protected = std::move(other.m_protected);
+      m_hashmap = std::move(other.m_hashmap);
+      m_sketch = std::exchange(other.m_sketch, Sketch(0));
+      m_sketchSize = std::exchange(other.m_sketchSize, 0);
+      std::copy(std::begin(other.m_weights), std::end(other.m_weights),
+                std::begin(m_weights));
+      std::fill(std::begin(other.m_weights), std::end(other.m_weights), 0);
+      m_maxWindow = other.m_maxWindow;
+      m_maxMain = other.m_maxMain;
+      m_maxProtected = other.m_maxProtected;
+    }
+    return *this;
+  }
+
+  std::size_t getWeight() const {
+    return m_weights[0] + m_weights[1] + m_weights[2];
+  }
+
+  // Shrinking evicts from each region the entries over its new share
+  void setCapacity(std::size_t capacity) {
+    Base::setCapacity(capacity);
+    computeLimits();
+    rebalance();
+    // Resizing the sketch halves its counters, so it is left alone unless
+    // the number of keys it is sized for changes
+    std::size_t sketchSize = std::max(detail::entriesFor<Weigher>(capacity),
+                                      m_hashmap.size());
+    if (sketchSize != m_sketchSize) {
+      m_sketchSize = sketchSize;
+      m_sketch.resize(m_sketchSize);
+    }
+    m_hashmap.reserve(detail::entriesFor<Weigher>(capacity));
+    detail::expectNodes(m_hashmap.get_allocator(),
+                        detail::entriesFor<Weigher>(capacity));
+  }
+
+  // 'key' may be of any type that compares with K, e.g. std::string_view for
+  // std::string keys; see detail::findKey
+  template <typename Key> V *getPtr(const Key &key) {
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end()) {
+      return nullptr;
+    }
+    touch(iter->second);
+    return &iter->second->m_value;
+  }
+
+  template <typename Key> bool contains(const Key &key) const {
+    return detail::findKey(m_hashmap, key) != m_hashmap.end();
+  }
+
+  template <typename Key> bool erase(const Key &key) {
+    auto iter = detail::findKey(m_hashmap, key);
+    if (iter == m_hashmap.end()) {
+      return false;
+    }
+    NodeIterator node = iter->second;
+    weightOf(node->m_region) -= node->getWeight();
+    m_hashmap.erase(iter);
+    listOf(node->m_region).erase(node);
+    return true;
+  }
+
+  void clear() {
+    m_window.clear();
+    m_probation.clear();
+    m_protected.clear();
+    m_hashmap.clear();
+    m_sketch.clear();
+    std::fill(std::begin(m_weights), std::end(m_weights), 0);
+  }
+};
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+using TinyLFUCache = VirtualCache<
+    BasicTinyLFUCache<K, V, Key_Hash, Index, Weigher, Allocator>>;
+
+namespace pmr {
+// A memory resource for caches of a known capacity. It is a NodePool whose
+// chunks come from a single buffer of 'bytes', allocated upstream at the
+// first allocation and grown only when it runs out, so a cache that evicts one
+// node to store the next reuses the evicted node's memory. Larger blocks, such
+// as the bucket arrays of the hash maps, are not reused. Like the caches, it
+// is not thread-safe.
+class PoolResource : public std::pmr::memory_resource {
+private:
+  std::pmr::monotonic_buffer_resource m_buffer;
+  NodePool m_pool;
+
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+    return m_pool.allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void *memory, std::size_t bytes,
+                     std::size_t alignment) override {
+    m_pool.deallocate(memory, bytes, alignment);
+  }
+
+  bool do_is_equal(
+      const std::pmr::memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+
+public:
+  explicit PoolResource(
+      std::size_t bytes,
+      std::pmr::memory_resource *upstream = std::pmr::get_default_resource())
+      : m_buffer(bytes, upstream), m_pool(&m_buffer) {}
+
+  PoolResource(const PoolResource &) = delete;
+
+  PoolResource &operator=(const PoolResource &) = delete;
+
+  // Gives all of the memory back upstream; no cache may still be using it
+  void release() {
+    m_pool.release();
+    m_buffer.release();
+  }
+};
+
+// The caches that take an allocator, allocating from a memory resource instead
+// of a NodePool of their own, e.g.
+// CacheImpl::pmr::LRUCache<int, int> cache(capacity, &resource)
+template <typename K, typename V>
+using Allocator = std::pmr::polymorphic_allocator<std::pair<const K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using BasicFILOCache =
+    CacheImpl::BasicFILOCache<K, V, Key_Hash, Index, Weigher, Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using FILOCache =
+    CacheImpl::FILOCache<K, V, Key_Hash, Index, Weigher, Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using BasicFIFOCache =
+    CacheImpl::BasicFIFOCache<K, V, Key_Hash, Index, Weigher, Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using FIFOCache =
+    CacheImpl::FIFOCache<K, V, Key_Hash, Index, Weigher, Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using BasicS3FIFOCache = CacheImpl::BasicS3FIFOCache<K, V, Key_Hash, Index,
+                                                     Weigher, Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using S3FIFOCache =
+    CacheImpl::S3FIFOCache<K, V, Key_Hash, Index, Weigher, Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Freq_Hash = std::hash<int>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using BasicLFUCache = CacheImpl::BasicLFUCache<K, V, Key_Hash, Freq_Hash, Index,
+                                               Weigher, Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Freq_Hash = std::hash<int>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using LFUCache = CacheImpl::LFUCache<K, V, Key_Hash, Freq_Hash, Index, Weigher,
+                                     Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using BasicLRUCache =
+    CacheImpl::BasicLRUCache<K, V, Key_Hash, Index, Weigher, Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using LRUCache =
+    CacheImpl::LRUCache<K, V, Key_Hash, Index, Weigher, Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using BasicSLRUCache =
+    CacheImpl::BasicSLRUCache<K, V, Key_Hash, Index, Weigher, Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using SLRUCache =
+    CacheImpl::SLRUCache<K, V, Key_Hash, Index, Weigher, Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using BasicARCCache =
+    CacheImpl::BasicARCCache<K, V, Key_Hash, Index, Weigher, Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using ARCCache =
+    CacheImpl::ARCCache<K, V, Key_Hash, Index, Weigher, Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using BasicTinyLFUCache =
+    CacheImpl::BasicTinyLFUCache<K, V, Key_Hash, Index, Weigher,
+                                 Allocator<K, V>>;
+
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Index = UnorderedMapIndex, typename Weigher = UnitWeigher>
+using TinyLFUCache =
+    CacheImpl::TinyLFUCache<K, V, Key_Hash, Index, Weigher, Allocator<K, V>>;
+} // namespace pmr
+
+// A thread-safe cache that splits the keys over independently locked shards,
+// each of them a single-threaded cache such as LRUCache<K, V, Key_Hash>. The
+// capacity is divided evenly among the shards. Values are returned by copy
+// since a pointer into a shard would not survive another thread's put().
+template <template <typename...> class Policy, typename K, typename V,
+          typename Key_Hash = std::hash<K>>
+class ShardedCache {
+private:
+  // Each shard sits on its own cache lines so that the locks do not share them
+  struct alignas(64) Shard {
+    std::mutex m_mutex;
+    Policy<K, V, Key_Hash> m_cache;
+
+    explicit Shard(std::size_t capacity) : m_cache(capacity) {}
+  };
+
+  std::size_t m_capacity;
+  Key_Hash m_hasher;
+  std::vector<std::unique_ptr<Shard>> m_shards;
+
+  template <typename Key> Shard &shardOf(const Key &key) const {
+    if constexpr (!std::is_same<Key, K>::value &&
+                  !detail::IsTransparent<Key_Hash>::value) {
+      return shardOf(static_cast<K>(key));
+    } else {
+      // Mix the hash so that the shard does not depend on the same low bits
+      // that the shard itself uses to pick a bucket
+      auto hash = static_cast<std::uint64_t>(m_hasher(key));
+      hash = (hash * 0x9e3779b97f4a7c15ULL) >> 32;
+      return *m_shards[hash % m_shards.size()];
+    }
+  }
+
+public:
+  static std::size_t defaultShardCount() {
+    return 4 * std::max(1U, std::thread::hardware_concurrency());
+  }
+
+  explicit ShardedCache(std::size_t capacity,
+                        std::size_t shardCount = defaultShardCount())
+      : m_capacity(capacity) {
+    // Every shard gets at least one entry, unless the capacity is zero
+    shardCount = std::max<std::size_t>(1, std::min(shardCount, capacity));
+    m_shards.reserve(shardCount);
+    for (std::size_t i = 0; i < shardCount; ++i) {
+      m_shards.emplace_back(std::make_unique<Shard>(
+          capacity / shardCount + (i < capacity % shardCount ? 1 : 0)));
+    }
+  }
+
+  std::size_t getCapacity() const { return m_capacity; }
+
+  std::size_t getShardCount() const { return m_shards.size(); }
+
+  // The sum of the weights of the shards, each read under its own lock
+  std::size_t getWeight() const {
+    std::size_t weight = 0;
+    for (auto &shard : m_shards) {
+      std::lock_guard<std::mutex> lock(shard->m_mutex);
+      weight += shard->m_cache.getWeight();
+    }
+    return weight;
+  }
+
+  // Splits the new capacity over the shards like the constructor does; the
+  // number of shards stays the same
+  void setCapacity(std::size_t capacity) {
+    std::size_t shardCount = m_shards.size();
+    for (std::size_t i = 0; i < shardCount; ++i) {
+      std::lock_guard<std::mutex> lock(m_shards[i]->m_mutex);
+      m_shards[i]->m_cache.setCapacity(capacity / shardCount +
+                                       (i < capacity % shardCount ? 1 : 0));
+    }
+    m_capacity = capacity;
+  }
+
+  // The lookups also take keys of other types, which are passed on to the
+  // heterogeneous lookups of the policy
+  template <typename Key = K> V get(const Key &key) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.m_mutex);
+    return shard.m_cache.get(key);
+  }
+
+  template <typename Key = K> std::optional<V> tryGet(const Key &key) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.m_mutex);
+    return shard.m_cache.tryGet(key);
+  }
+
+  bool tryGet(const K &key, V &value) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.m_mutex);
+    return shard.m_cache.tryGet(key, value);
+  }
+
+  void put(const K &key, const V &value) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.m_mutex);
+    shard.m_cache.put(key, value);
+  }
+
+  void put(const K &key, V &&value) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.m_mutex);
+    shard.m_cache.put(key, std::move(value));
+  }
+
+  void put(K &&key, V &&value) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.m_mutex);
+    shard.m_cache.put(std::move(key), std::move(value));
+  }
+
+  template <typename Key, typename... Args>
+  void emplace(Key &&key, Args &&...args) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.m_mutex);
+    shard.m_cache.emplace(std::forward<Key>(key), std::forward<Args>(args)...);
+  }
+
+  template <typename Key, typename... Args>
+  bool tryEmplace(Key &&key, Args &&...args) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.m_mutex);
+    return shard.m_cache.tryEmplace(std::forward<Key>(key),
+                                    std::forward<Args>(args)...);
+  }
+
+  template <typename Key = K> bool contains(const Key &key) const {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.m_mutex);
+    return shard.m_cache.contains(key);
+  }
+
+  template <typename Key = K> bool erase(const Key &key) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.m_mutex);
+    return shard.m_cache.erase(key);
+  }
+
+  void clear() {
+    for (auto &shard : m_shards) {
+      std::lock_guard<std::mutex> lock(shard->m_mutex);
+      shard->m_cache.clear();
+    }
+  }
+};
+
+// A thread-safe approximation of LRU using the CLOCK algorithm. Entries live in
+// an array of slots, each with a reference bit. To evict, a hand sweeps the
+// slots, clearing set bits, and evicts the first entry whose bit is already
+// clear. Writers take a mutex, but a hit takes no lock: an entry is immutable
+// once published, and readers find it through an open-addressing index whose
+// buckets are atomic pointers to the entries, then only set its bit. A writer
+// that replaces or erases an entry, or rebuilds the index, retires the old one
+// and frees it once no reader may still hold it. Readers count themselves on
+// the stripe of their thread for the epoch they entered in, and a writer
+// advances the epoch only when no reader is left in the previous one, so what
+// was retired two epochs ago is no longer seen. A hit racing a put() of the
+// same key may return the value the put() replaces. Only writers allocate, so
+// the entries and the index take their memory from an 'Allocator' such as
+// PoolAllocator that is not itself thread-safe.
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Weigher = UnitWeigher,
+          typename Allocator = PoolAllocator<std::pair<const K, V>>>
+class ClockCache {
+private:
+  struct Entry : detail::EntryWeight<Weigher> {
+    K m_key;
+    V m_value;
+    std::size_t m_hash;
+    std::atomic<bool> m_referenced;
+    // Where the entry is, only used by writers
+    std::size_t m_slot;
+    std::size_t m_bucket;
+
+    template <typename Key, typename... Args>
+    Entry(std::size_t hash, Key &&key, Args &&...args)
+        : m_key(std::forward<Key>(key)), m_value(std::forward<Args>(args)...),
+          m_hash(hash), m_referenced(false), m_slot(0), m_bucket(0) {}
+  };
+
+  // The index, with linear probing. Writers only fill empty buckets and swap
+  // the entry of a bucket for another or for erased(), so a reader probing
+  // the table as it changes still stops at an empty bucket. The table is
+  // rebuilt before half of its buckets are taken.
+  struct Table {
+    std::size_t m_mask;
+    std::atomic<Entry *> *m_buckets;
+
+    std::size_t size() const { return m_mask + 1; }
+  };
+
+  using EntryAllocator = detail::Rebind<Allocator, Entry>;
+  using EntryTraits = std::allocator_traits<EntryAllocator>;
+  using TableAllocator = detail::Rebind<Allocator, Table>;
+  using TableTraits = std::allocator_traits<TableAllocator>;
+  using BucketAllocator = detail::Rebind<Allocator, std::atomic<Entry *>>;
+  using BucketTraits = std::allocator_traits<BucketAllocator>;
+
+  static constexpr std::size_t STRIPES = 16;
+
+  // The readers inside the cache, by the parity of the epoch they entered in
+  struct alignas(64) ReaderStripe {
+    std::atomic<std::size_t> m_readers[2]{{0}, {0}};
+  };
+
+  // Counts a reader in for the scope of a lookup
+  class ReadGuard {
+  private:
+    std::atomic<std::size_t> *m_readers;
+
+  public:
+    explicit ReadGuard(const ClockCache &cache) {
+      ReaderStripe &stripe = cache.m_stripes[stripeOfThread()];
+      while (true) {
+        std::uint64_t epoch = cache.m_epoch.load();
+        m_readers = &stripe.m_readers[epoch & 1];
+        m_readers->fetch_add(1);
+        // A writer that advanced the epoch meanwhile may not have seen it
+        if (cache.m_epoch.load() == epoch) {
+          return;
+        }
+        m_readers->fetch_sub(1);
+      }
+    }
+
+    ReadGuard(const ReadGuard &) = delete;
+
+    ReadGuard &operator=(const ReadGuard &) = delete;
+
+    ~ReadGuard() { m_readers->fetch_sub(1); }
+  };
+
   std::size_t m_capacity;
+  std::size_t m_weight;
+  Key_Hash m_hasher;
+  EntryAllocator m_allocator;
+  std::vector<Entry *> m_slots;
+  std::size_t m_hand;
+  // Slots below 'm_used' have been filled at least once; the erased ones among
+  // them are kept in 'm_freeSlots'
+  std::size_t m_used;
+  std::vector<std::size_t> m_freeSlots;
+  std::atomic<Table *> m_table;
+  // The entries in the table, and its buckets left erased
+  std::size_t m_count;
+  std::size_t m_erased;
+  // The latest table freed, which the next rebuild of that size takes
+  Table *m_spareTable;
+  std::vector<std::pair<std::uint64_t, Entry *>> m_retiredEntries;
+  std::vector<std::pair<std::uint64_t, Table *>> m_retiredTables;
+  std::atomic<std::uint64_t> m_epoch;
+  mutable ReaderStripe m_stripes[STRIPES];
+  mutable std::mutex m_mutex;
 
-public:
-  explicit Cache(std::size_t capacity) : m_capacity(capacity) {}
+  static std::size_t stripeOfThread() {
+    static thread_local std::size_t stripe =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) % STRIPES;
+    return stripe;
+  }
 
-  virtual ~Cache() = default;
+  // Marks the buckets of erased entries, which probes go past
+  static Entry *erased() {
+    static char marker;
+    return reinterpret_cast<Entry *>(&marker);
+  }
 
-  size_t getCapacity() const { return m_capacity; }
+  // Mixes the hash so that keys hashing to nearby values do not probe the
+  // same buckets
+  static std::size_t homeOf(std::size_t hash, const Table &table) {
+    return static_cast<std::size_t>(
+               (static_cast<std::uint64_t>(hash) * 0x9e3779b97f4a7c15ULL) >>
+               32) &
+           table.m_mask;
+  }
 
-  void setCapacity(size_t capacity) { m_capacity = capacity; }
+  template <typename... Args> Entry *newEntry(Args &&...args) {
+    Entry *entry = EntryTraits::allocate(m_allocator, 1);
+    try {
+      new (entry) Entry(std::forward<Args>(args)...);
+    } catch (...) {
+      EntryTraits::deallocate(m_allocator, entry, 1);
+      throw;
+    }
+    return entry;
+  }
 
-  virtual V get(const K &key) = 0;
+  void deleteEntry(Entry *entry) {
+    entry->~Entry();
+    EntryTraits::deallocate(m_allocator, entry, 1);
+  }
 
-  virtual void put(const K &key, const V &value) = 0;
+  // A table of 'size' empty buckets
+  Table *newTable(std::size_t size) {
+    TableAllocator tableAllocator(m_allocator);
+    BucketAllocator bucketAllocator(m_allocator);
+    Table *table = TableTraits::allocate(tableAllocator, 1);
+    try {
+      table->m_buckets = BucketTraits::allocate(bucketAllocator, size);
+    } catch (...) {
+      TableTraits::deallocate(tableAllocator, table, 1);
+      throw;
+    }
+    table->m_mask = size - 1;
+    for (std::size_t i = 0; i < size; ++i) {
+      new (table->m_buckets + i) std::atomic<Entry *>(nullptr);
+    }
+    return table;
+  }
 
-  virtual void clear() = 0;
-};
+  void deleteTable(Table *table) {
+    if (table == nullptr) {
+      return;
+    }
+    TableAllocator tableAllocator(m_allocator);
+    BucketAllocator bucketAllocator(m_allocator);
+    BucketTraits::deallocate(bucketAllocator, table->m_buckets, table->size());
+    TableTraits::deallocate(tableAllocator, table, 1);
+  }
 
-template <typename K, typename V, typename Key_Hash = std::hash<K>>
-class FILOCache : public Cache<K, V> {
-private:
-  std::list<std::pair<K, V>> m_list;
-  std::unordered_map<K, typename std::list<std::pair<K, V>>::iterator, Key_Hash>
-      m_hashmap;
+  // Keeps at most a quarter of the buckets taken after a rebuild
+  static std::size_t tableSizeFor(std::size_t entries) {
+    std::size_t size = 16;
+    while (size < 4 * entries) {
+      size *= 2;
+    }
+    return size;
+  }
 
-public:
-  explicit FILOCache(std::size_t capacity) : Cache<K, V>(capacity) {}
+  static Entry *find(const Table &table, const K &key, std::size_t hash) {
+    for (std::size_t i = homeOf(hash, table);; i = (i + 1) & table.m_mask) {
+      Entry *entry = table.m_buckets[i].load(std::memory_order_acquire);
+      if (entry == nullptr) {
+        return nullptr;
+      }
+      if (entry != erased() && entry->m_hash == hash && entry->m_key == key) {
+        return entry;
+      }
+    }
+  }
 
-  V get(const K &key) override {
-    // We check if 'key' is in the hash map
-    auto iter = m_hashmap.find(key);
-    if (iter == m_hashmap.end()) {
-      throw std::invalid_argument(
-          "Key is not found!"); // throw an exception that indicates 'not found'
+  Table &table() const { return *m_table.load(std::memory_order_relaxed); }
+
+  // Publishes 'entry' in the first bucket on its probe path in 'table' that
+  // is free
+  void link(Table &table, Entry *entry) {
+    std::size_t i = homeOf(entry->m_hash, table);
+    while (true) {
+      Entry *taken = table.m_buckets[i].load(std::memory_order_relaxed);
+      if (taken == nullptr || taken == erased()) {
+        m_erased -= taken == erased() ? 1 : 0;
+        break;
+      }
+      i = (i + 1) & table.m_mask;
     }
-    // Return 'value' from the pair
-    return iter->second->second;
+    entry->m_bucket = i;
+    table.m_buckets[i].store(entry, std::memory_order_release);
+    ++m_count;
   }
 
-  void put(const K &key, const V &value) override {
-    // Corner case:
-    if (Cache<K, V>::getCapacity() == 0) {
+  // Publishes a table without erased buckets before a new entry would leave
+  // less than half of the buckets free. The old one is retired
+  void reserveBucket() {
+    if (2 * (m_count + m_erased + 1) <= table().size()) {
       return;
     }
-    // We check if 'key' is in the hash map
-    auto iter = m_hashmap.find(key);
-    if (iter == m_hashmap.end()) {
-      if (m_hashmap.size() == Cache<K, V>::getCapacity()) {
-        // The cache is full, we need to erase the front item from 'm_list' and
-        // update the hash map (First In Last Out / Last In First Out)
-        m_hashmap.erase(m_list.back().first);
-        m_list.pop_back();
-      }
-      m_list.emplace_back(std::make_pair(key, value));
-      m_hashmap[key] = (--m_list.end());
+    std::size_t size = tableSizeFor(m_count + 1);
+    Table *rebuilt = nullptr;
+    if (m_spareTable != nullptr && m_spareTable->size() == size) {
+      rebuilt = m_spareTable;
+      m_spareTable = nullptr;
+      for (std::size_t i = 0; i < size; ++i) {
+        rebuilt->m_buckets[i].store(nullptr, std::memory_order_relaxed);
+      }
     } else {
-      iter->second->second = value;
+      rebuilt = newTable(size);
+    }
+    try {
+      m_retiredTables.emplace_back(m_epoch.load(), &table());
+    } catch (...) {
+      deleteTable(rebuilt);
+      throw;
+    }
+    m_count = 0;
+    m_erased = 0;
+    for (Entry *entry : m_slots) {
+      if (entry != nullptr) {
+        link(*rebuilt, entry);
+      }
     }
+    m_table.store(rebuilt, std::memory_order_release);
   }
 
-  void clear() override {
-    m_list.clear();
-    m_hashmap.clear();
+  // Advances the epoch if no reader is left in the previous one, and frees
+  // what was retired two epochs ago or earlier, which no reader can still see
+  void reclaim() {
+    std::uint64_t epoch = m_epoch.load();
+    bool drained = true;
+    for (auto &stripe : m_stripes) {
+      drained = drained && stripe.m_readers[(epoch - 1) & 1].load() == 0;
+    }
+    if (drained) {
+      m_epoch.store(++epoch);
+    }
+    std::size_t entries = 0;
+    while (entries < m_retiredEntries.size() &&
+           m_retiredEntries[entries].first + 2 <= epoch) {
+      deleteEntry(m_retiredEntries[entries++].second);
+    }
+    m_retiredEntries.erase(m_retiredEntries.begin(),
+                           m_retiredEntries.begin() + entries);
+    std::size_t tables = 0;
+    while (tables < m_retiredTables.size() &&
+           m_retiredTables[tables].first + 2 <= epoch) {
+      deleteTable(m_spareTable);
+      m_spareTable = m_retiredTables[tables++].second;
+    }
+    m_retiredTables.erase(m_retiredTables.begin(),
+                          m_retiredTables.begin() + tables);
   }
-};
 
-template <typename K, typename V, typename Key_Hash = std::hash<K>>
-class FIFOCache : public Cache<K, V> {
-private:
-  std::list<std::pair<K, V>> m_list;
-  std::unordered_map<K, typename std::list<std::pair<K, V>>::iterator, Key_Hash>
-      m_hashmap;
+  // Returns the slot the hand stops at, advancing the hand past it
+  std::size_t sweep() {
+    while (m_slots[m_hand] != nullptr &&
+           m_slots[m_hand]->m_referenced.load(std::memory_order_relaxed)) {
+      m_slots[m_hand]->m_referenced.store(false, std::memory_order_relaxed);
+      m_hand = (m_hand + 1) % m_slots.size();
+    }
+    std::size_t victim = m_hand;
+    m_hand = (m_hand + 1) % m_slots.size();
+    return victim;
+  }
+
+  void release(Entry *entry) {
+    m_retiredEntries.emplace_back(m_epoch.load(), entry);
+    m_weight -= entry->getWeight();
+    table().m_buckets[entry->m_bucket].store(erased(),
+                                             std::memory_order_release);
+    --m_count;
+    ++m_erased;
+    m_slots[entry->m_slot] = nullptr;
+    m_freeSlots.push_back(entry->m_slot);
+  }
+
+  // Evicts the entry the hand stops at, if the slot holds one
+  void evict() {
+    std::size_t index = sweep();
+    if (m_slots[index] != nullptr) {
+      release(m_slots[index]);
+    }
+  }
+
+  // Moves the entries into a slot array of 'count' slots, keeping their order
+  // from the hand
+  void resizeSlots(std::size_t count) {
+    std::vector<Entry *> slots(count, nullptr);
+    std::size_t used = 0;
+    for (std::size_t i = 0; i < m_slots.size(); ++i) {
+      Entry *entry = m_slots[(m_hand + i) % m_slots.size()];
+      if (entry != nullptr) {
+        entry->m_slot = used;
+        slots[used++] = entry;
+      }
+    }
+    m_slots.swap(slots);
+    m_hand = 0;
+    m_used = used;
+    m_freeSlots.clear();
+  }
+
+  // A free slot; only a capacity in weights, or one over the entries reserved
+  // for, lets the entries outgrow the slots
+  std::size_t takeSlot() {
+    if (!m_freeSlots.empty()) {
+      std::size_t index = m_freeSlots.back();
+      m_freeSlots.pop_back();
+      return index;
+    }
+    if (m_used == m_slots.size()) {
+      resizeSlots(std::max<std::size_t>(16, 2 * m_slots.size()));
+    }
+    return m_used++;
+  }
+
+  // The core of put() and emplace(), called under the lock: stores the value
+  // constructed from 'args' under 'key', in an entry weighing 'weight'. With
+  // 'onlyIfAbsent', it returns false instead if 'key' is cached
+  template <typename Key, typename... Args>
+  bool store(bool onlyIfAbsent, Key &&key, std::size_t weight,
+             Args &&...args) {
+    std::size_t hash = m_hasher(key);
+    Entry *old = find(table(), key, hash);
+    if (onlyIfAbsent && old != nullptr) {
+      return false;
+    }
+    // Corner case: an entry heavier than the whole cache is not cached
+    if (weight > m_capacity) {
+      if (old != nullptr) {
+        release(old);
+      }
+      return true;
+    }
+    if (old != nullptr) {
+      // Readers may still be copying the old value, so the new one takes a
+      // new entry in the same slot and bucket
+      Entry *entry = newEntry(hash, std::forward<Key>(key),
+                              std::forward<Args>(args)...);
+      try {
+        m_retiredEntries.emplace_back(m_epoch.load(), old);
+      } catch (...) {
+        deleteEntry(entry);
+        throw;
+      }
+      entry->setWeight(weight);
+      entry->m_referenced.store(true, std::memory_order_relaxed);
+      entry->m_slot = old->m_slot;
+      entry->m_bucket = old->m_bucket;
+      m_slots[entry->m_slot] = entry;
+      table().m_buckets[entry->m_bucket].store(entry,
+                                               std::memory_order_release);
+      m_weight = m_weight - old->getWeight() + weight;
+      // A heavier value may push other entries out, or itself
+      while (m_weight > m_capacity) {
+        evict();
+      }
+      return true;
+    }
+    // Only sweep once the entries fill the cache
+    while (m_weight + weight > m_capacity) {
+      evict();
+    }
+    Entry *entry =
+        newEntry(hash, std::forward<Key>(key), std::forward<Args>(args)...);
+    std::size_t index = 0;
+    try {
+      reserveBucket();
+      index = takeSlot();
+    } catch (...) {
+      deleteEntry(entry);
+      throw;
+    }
+    entry->setWeight(weight);
+    entry->m_slot = index;
+    m_slots[index] = entry;
+    m_weight += weight;
+    link(table(), entry);
+    return true;
+  }
+
+  // Looks 'key' up without a lock and, on a hit, sets the reference bit of
+  // its entry and hands its value to 'hit'
+  template <typename Hit> bool lookUp(const K &key, Hit hit) const {
+    ReadGuard guard(*this);
+    Entry *entry = find(*m_table.load(std::memory_order_acquire), key,
+                        m_hasher(key));
+    if (entry == nullptr) {
+      return false;
+    }
+    // Hot entries keep their bit set, so their cache line is only read
+    if (!entry->m_referenced.load(std::memory_order_relaxed)) {
+      entry->m_referenced.store(true, std::memory_order_relaxed);
+    }
+    hit(entry->m_value);
+    return true;
+  }
 
 public:
-  explicit FIFOCache(std::size_t capacity) : Cache<K, V>(capacity) {}
+  // When the capacity is in weights, or counts more entries than are reserved
+  // for, the slot array grows as it fills. The entries and the index take
+  // their memory from 'allocator'.
+  explicit ClockCache(std::size_t capacity,
+                      const Allocator &allocator = Allocator())
+      : m_capacity(capacity), m_weight(0), m_allocator(allocator),
+        m_slots(detail::entriesFor<Weigher>(capacity), nullptr), m_hand(0),
+        m_used(0), m_table(newTable(tableSizeFor(m_slots.size()))),
+        m_count(0), m_erased(0), m_spareTable(nullptr), m_epoch(1) {
+    detail::expectNodes(m_allocator, m_slots.size());
+  }
 
-  V get(const K &key) override {
-    // We check if 'key' is in the hash map
-    auto iter = m_hashmap.find(key);
-    if (iter == m_hashmap.end()) {
+  ClockCache(const ClockCache &) = delete;
+
+  ClockCache &operator=(const ClockCache &) = delete;
+
+  ~ClockCache() {
+    for (Entry *entry : m_slots) {
+      if (entry != nullptr) {
+        deleteEntry(entry);
+      }
+    }
+    for (auto &retired : m_retiredEntries) {
+      deleteEntry(retired.second);
+    }
+    for (auto &retired : m_retiredTables) {
+      deleteTable(retired.second);
+    }
+    deleteTable(m_spareTable);
+    deleteTable(m_table.load());
+  }
+
+  std::size_t getCapacity() const { return m_capacity; }
+
+  std::size_t getWeight() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_weight;
+  }
+
+  // Evicts with the hand as put() would until the entries fit, then moves them
+  // into a slot array of the new size
+  void setCapacity(std::size_t capacity) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while (m_weight > capacity) {
+      evict();
+    }
+    m_capacity = capacity;
+    resizeSlots(std::max(detail::entriesFor<Weigher>(capacity), m_count));
+    reclaim();
+  }
+
+  V get(const K &key) {
+    std::optional<V> value = tryGet(key);
+    if (!value) {
       throw std::invalid_argument(
           "Key is not found!"); // throw an exception that indicates 'not found'
     }
-    // Return 'value' from the pair
-    return iter->second->second;
+    return std::move(*value);
   }
 
-  void put(const K &key, const V &value) override {
-    // Corner case:
-    if (Cache<K, V>::getCapacity() == 0) {
-      return;
+  std::optional<V> tryGet(const K &key) {
+    std::optional<V> result;
+    lookUp(key, [&result](const V &value) { result.emplace(value); });
+    return result;
+  }
+
+  bool tryGet(const K &key, V &value) {
+    return lookUp(key, [&value](const V &found) { value = found; });
+  }
+
+  void put(const K &key, const V &value) { emplace(key, value); }
+
+  void put(const K &key, V &&value) { emplace(key, std::move(value)); }
+
+  void put(K &&key, V &&value) { emplace(std::move(key), std::move(value)); }
+
+  // Like the emplace() of the other policies. A weigher other than UnitWeigher
+  // weighs the value before the lock is taken
+  template <typename Key, typename... Args>
+  void emplace(Key &&key, Args &&...args) {
+    detail::emplaceWeighed<K, V, Weigher>(
+        [this](auto &&newKey, std::size_t weight, auto &&...valueArgs) {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          store(false, std::forward<decltype(newKey)>(newKey), weight,
+                std::forward<decltype(valueArgs)>(valueArgs)...);
+          reclaim();
+        },
+        std::forward<Key>(key), std::forward<Args>(args)...);
+  }
+
+  // Like the tryEmplace() of the other policies. Another thread may store the
+  // key between the lookup and the lock, so the key is checked again before
+  // storing
+  template <typename Key, typename... Args>
+  bool tryEmplace(Key &&key, Args &&...args) {
+    if (contains(key)) {
+      return false;
     }
-    // We check if 'key' is in the hash map
-    auto iter = m_hashmap.find(key);
-    if (iter == m_hashmap.end()) {
-      if (m_hashmap.size() == Cache<K, V>::getCapacity()) {
-        // The cache is full, we need to erase the front item from 'm_list' and
-        // update the hash map (First In First Out)
-        m_hashmap.erase(m_list.front().first);
-        m_list.pop_front();
-      }
-      m_list.emplace_back(std::make_pair(key, value));
-      m_hashmap[key] = (--m_list.end());
-    } else {
-      iter->second->second = value;
+    bool stored = false;
+    detail::emplaceWeighed<K, V, Weigher>(
+        [this, &stored](auto &&newKey, std::size_t weight,
+                        auto &&...valueArgs) {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          stored = store(true, std::forward<decltype(newKey)>(newKey), weight,
+                         std::forward<decltype(valueArgs)>(valueArgs)...);
+          reclaim();
+        },
+        std::forward<Key>(key), std::forward<Args>(args)...);
+    return stored;
+  }
+
+  bool contains(const K &key) const {
+    ReadGuard guard(*this);
+    return find(*m_table.load(std::memory_order_acquire), key,
+                m_hasher(key)) != nullptr;
+  }
+
+  bool erase(const K &key) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Entry *entry = find(table(), key, m_hasher(key));
+    if (entry == nullptr) {
+      return false;
     }
+    release(entry);
+    reclaim();
+    return true;
   }
 
-  void clear() override {
-    m_list.clear();
-    m_hashmap.clear();
+  void clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_retiredEntries.reserve(m_retiredEntries.size() + m_count);
+    Table &current = table();
+    for (std::size_t i = 0; i < current.size(); ++i) {
+      current.m_buckets[i].store(nullptr, std::memory_order_release);
+    }
+    for (auto &entry : m_slots) {
+      if (entry != nullptr) {
+        m_retiredEntries.emplace_back(m_epoch.load(), entry);
+        entry = nullptr;
+      }
+    }
+    m_freeSlots.clear();
+    m_count = 0;
+    m_erased = 0;
+    m_weight = 0;
+    m_hand = 0;
+    m_used = 0;
+    reclaim();
   }
 };
 
-template <typename K, typename V, typename Key_Hash = std::hash<K>,
-          typename Freq_Hash = std::hash<int>>
-class LFUCache : public Cache<K, V> {
-private:
-  // Define the inner node
-  struct Node {
-    K m_key;
-    V m_value;
-    int m_freq;
+// Keeps a deadline for each of its keys in a hierarchical timing wheel:
+// LEVELS wheels of SLOTS slots each, where a slot of level i spans SLOTS^i
+// ticks. A key waits in the coarsest level that its remaining time needs, and
+// as time advances, the slots that come due are emptied, their keys either
+// expired or moved down to a finer level. A key moves at most LEVELS times,
+// so scheduling, cancelling and expiring one take amortized O(1), and
+// advancing visits at most SLOTS slots per level however far time jumps.
+template <typename K, typename Key_Hash = std::hash<K>> class TimingWheel {
+public:
+  static constexpr unsigned LEVELS = 5;
+  static constexpr unsigned SLOT_BITS = 6;
+  static constexpr std::uint64_t SLOTS = std::uint64_t(1) << SLOT_BITS;
+  // The deadline of a key without a timer
+  static constexpr std::uint64_t NEVER = UINT64_MAX;
 
-    explicit Node(K key, V value, int freq)
-        : m_key(key), m_value(value), m_freq(freq) {}
+private:
+  struct Timer {
+    const K *m_key = nullptr;
+    std::uint64_t m_deadline = 0;
+    // The neighbours in the slot, and in the list of all timers that
+    // collect() walks
+    Timer *m_prev = nullptr;
+    Timer *m_next = nullptr;
+    Timer *m_older = nullptr;
+    Timer *m_newer = nullptr;
   };
 
-  int m_minimalFreq;
-  std::unordered_map<K, typename std::list<Node>::iterator, Key_Hash> m_hashmap;
-  std::unordered_map<int, std::list<Node>, Freq_Hash> m_freqHashmap;
+  std::unordered_map<K, Timer, Key_Hash> m_timers;
+  // The list heads of the slots, level by level
+  std::vector<Timer> m_slots;
+  Timer m_all;
+  Timer *m_cursor;
+  std::uint64_t m_now;
+
+  static void unlink(Timer *timer) {
+    timer->m_prev->m_next = timer->m_next;
+    timer->m_next->m_prev = timer->m_prev;
+  }
+
+  static void linkBefore(Timer *head, Timer *timer) {
+    timer->m_prev = head->m_prev;
+    timer->m_next = head;
+    head->m_prev->m_next = timer;
+    head->m_prev = timer;
+  }
+
+  void place(Timer *timer) {
+    // A deadline that has already passed goes to the next tick
+    std::uint64_t deadline = std::max(timer->m_deadline, m_now + 1);
+    unsigned level = 0;
+    while (level + 1 < LEVELS &&
+           deadline - m_now >= std::uint64_t(1) << (SLOT_BITS * (level + 1))) {
+      ++level;
+    }
+    std::uint64_t slot = (deadline >> (SLOT_BITS * level)) & (SLOTS - 1);
+    linkBefore(&m_slots[level * SLOTS + slot], timer);
+  }
+
+  void remove(Timer *timer) {
+    unlink(timer);
+    if (m_cursor == timer) {
+      m_cursor = timer->m_newer;
+    }
+    timer->m_older->m_newer = timer->m_newer;
+    timer->m_newer->m_older = timer->m_older;
+    m_timers.erase(m_timers.find(*timer->m_key));
+  }
+
+  void reset() {
+    for (auto &head : m_slots) {
+      head.m_prev = head.m_next = &head;
+    }
+    m_all.m_older = m_all.m_newer = &m_all;
+    m_cursor = &m_all;
+  }
 
 public:
-  explicit LFUCache(std::size_t capacity)
-      : Cache<K, V>(capacity), m_minimalFreq(0) {}
+  explicit TimingWheel(std::uint64_t now = 0)
+      : m_slots(LEVELS * SLOTS), m_now(now) {
+    reset();
+  }
 
-  V get(const K &key) override {
-    auto iter = m_hashmap.find(key);
-    if (iter == m_hashmap.end()) {
-      throw std::invalid_argument(
-          "Key is not found!"); // throw an exception that indicates 'not found'
+  // The timers point into the wheel
+  TimingWheel(const TimingWheel &) = delete;
+
+  TimingWheel &operator=(const TimingWheel &) = delete;
+
+  std::size_t size() const { return m_timers.size(); }
+
+  bool empty() const { return m_timers.empty(); }
+
+  // The tick the wheel was last advanced to
+  std::uint64_t now() const { return m_now; }
+
+  std::uint64_t deadlineOf(const K &key) const {
+    auto found = m_timers.find(key);
+    return found == m_timers.end() ? NEVER : found->second.m_deadline;
+  }
+
+  // Sets the deadline of 'key', replacing its previous one
+  void schedule(const K &key, std::uint64_t deadline) {
+    auto found = m_timers.find(key);
+    Timer *timer;
+    if (found == m_timers.end()) {
+      found = m_timers.emplace(key, Timer()).first;
+      timer = &found->second;
+      timer->m_key = &found->first;
+      timer->m_older = m_all.m_older;
+      timer->m_newer = &m_all;
+      m_all.m_older->m_newer = timer;
+      m_all.m_older = timer;
+    } else {
+      timer = &found->second;
+      unlink(timer);
+    }
+    timer->m_deadline = deadline;
+    place(timer);
+  }
+
+  // Removes the timer of 'key' and returns whether it had one
+  bool cancel(const K &key) {
+    if (m_timers.empty()) {
+      return false;
+    }
+    auto found = m_timers.find(key);
+    if (found == m_timers.end()) {
+      return false;
     }
-    auto iter_in_list = iter->second;
-    V value = iter_in_list->m_value;
-    int freq = iter_in_list->m_freq;
-    // Update 'm_freqHashmap'
-    m_freqHashmap[freq].erase(iter_in_list);
-    if (m_freqHashmap[freq].empty()) {
-      m_freqHashmap.erase(freq);
-      if (m_minimalFreq == freq) {
-        ++m_minimalFreq;
-      }
-    }
-    // Update the frequency
-    ++freq;
-    m_freqHashmap[freq].emplace_front(Node(key, value, freq));
-    // Update 'm_freqHashmap'
-    iter->second = m_freqHashmap[freq].begin();
-    // Return 'value'
-    return value;
-  }
-
-  void put(const K &key, const V &value) override {
-    // Corner case:
-    if (Cache<K, V>::getCapacity() == 0) {
+    remove(&found->second);
+    return true;
+  }
+
+  // Moves the wheel on to tick 'now', calling 'expire' with every key whose
+  // deadline has passed and removing its timer; 'expire' must not modify the
+  // wheel
+  template <typename Function>
+  void advance(std::uint64_t now, Function &&expire) {
+    if (now <= m_now) {
       return;
     }
-    auto iter = m_hashmap.find(key);
-    if (iter == m_hashmap.end()) {
-      // Delete the least frequently used item in both hashmaps
-      if (m_hashmap.size() == Cache<K, V>::getCapacity()) {
-        auto iter_to_lfu_item = m_freqHashmap[m_minimalFreq].back();
-        m_hashmap.erase(iter_to_lfu_item.m_key);
-        m_freqHashmap[m_minimalFreq].pop_back();
-        if (m_freqHashmap[m_minimalFreq].empty()) {
-          m_freqHashmap.erase(m_minimalFreq);
-        }
+    std::uint64_t previous = m_now;
+    m_now = now;
+    Timer pending;
+    for (unsigned level = 0; level < LEVELS; ++level) {
+      std::uint64_t from = previous >> (SLOT_BITS * level);
+      std::uint64_t to = now >> (SLOT_BITS * level);
+      if (from == to) {
+        // The coarser levels have not turned either
+        break;
       }
-      // Update 'm_minimalFreq'
-      m_minimalFreq = 1;
-      // Update 'm_freqHashmap'
-      m_freqHashmap[m_minimalFreq].emplace_front(
-          Node(key, value, m_minimalFreq));
-      // Update 'm_hashmap'
-      m_hashmap[key] = m_freqHashmap[m_minimalFreq].begin();
-    } else {
-      auto iter_in_list = iter->second;
-      int freq = iter_in_list->m_freq;
-      // Update 'freqHashmap'
-      m_freqHashmap[freq].erase(iter_in_list);
-      if (m_freqHashmap[freq].empty()) {
-        m_freqHashmap.erase(freq);
-        if (m_minimalFreq == freq) {
-          ++m_minimalFreq;
+      std::uint64_t last = from + std::min(to - from, SLOTS);
+      for (std::uint64_t tick = from + 1; tick <= last; ++tick) {
+        Timer *head = &m_slots[level * SLOTS + (tick & (SLOTS - 1))];
+        if (head->m_next == head) {
+          continue;
+        }
+        // Detach the slot first, since timers that are not due yet may be
+        // placed back into it
+        pending.m_next = head->m_next;
+        pending.m_prev = head->m_prev;
+        pending.m_next->m_prev = pending.m_prev->m_next = &pending;
+        head->m_prev = head->m_next = head;
+        while (pending.m_next != &pending) {
+          Timer *timer = pending.m_next;
+          if (timer->m_deadline <= now) {
+            expire(*timer->m_key);
+            remove(timer);
+          } else {
+            unlink(timer);
+            place(timer);
+          }
         }
       }
-      // Update frequency
-      ++freq;
-      m_freqHashmap[freq].emplace_front(Node(key, value, freq));
-      // Update 'm_hashmap'
-      iter->second = m_freqHashmap[freq].begin();
     }
   }
 
-  void clear() override {
-    m_minimalFreq = 0;
-    m_hashmap.clear();
-    m_freqHashmap.clear();
+  // Checks the next 'count' timers in a round-robin walk over all of them,
+  // removing those for which 'isLive' returns false
+  template <typename Predicate>
+  void collect(std::size_t count, Predicate &&isLive) {
+    for (; count > 0 && !m_timers.empty(); --count) {
+      if (m_cursor == &m_all) {
+        m_cursor = m_all.m_newer;
+      }
+      Timer *timer = m_cursor;
+      m_cursor = timer->m_newer;
+      if (!isLive(*timer->m_key)) {
+        remove(timer);
+      }
+    }
+  }
+
+  void clear() {
+    m_timers.clear();
+    reset();
   }
 };
 
-template <typename K, typename V, typename Key_Hash = std::hash<K>>
-class LRUCache : public Cache<K, V> {
+// Wraps a policy such as LRUCache<K, V, Key_Hash> to give entries a time to
+// live. put(key, value, ttl) schedules the entry's deadline in a TimingWheel
+// of millisecond ticks, while put(key, value) stores an entry that does not
+// expire. Expiry is lazy and incremental, never a scan: a lookup drops an
+// expired entry it comes across, and every put() advances the wheel, erasing
+// the entries that came due before the policy has to make room. The timer of
+// an entry the policy evicts is left behind, so each put() also checks the
+// next two timers and drops those whose entry is gone. Tests substitute a
+// Clock they set by hand for std::chrono::steady_clock.
+template <template <typename...> class Policy, typename K, typename V,
+          typename Key_Hash = std::hash<K>,
+          typename Clock = std::chrono::steady_clock>
+class BasicExpiringCache
+    : public BasicCache<BasicExpiringCache<Policy, K, V, Key_Hash, Clock>, K,
+                        V> {
 private:
-  std::list<std::pair<K, V>> m_list;
-  std::unordered_map<K, typename std::list<std::pair<K, V>>::iterator, Key_Hash>
-      m_hashmap;
+  using Base =
+      BasicCache<BasicExpiringCache<Policy, K, V, Key_Hash, Clock>, K, V>;
+
+  Policy<K, V, Key_Hash> m_cache;
+  TimingWheel<K, Key_Hash> m_wheel;
+  typename Clock::time_point m_epoch;
+
+  std::uint64_t now() const {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                                                              m_epoch)
+            .count());
+  }
+
+  bool isExpired(const K &key) const {
+    std::uint64_t deadline = m_wheel.deadlineOf(key);
+    return deadline != TimingWheel<K, Key_Hash>::NEVER && deadline <= now();
+  }
+
+  void advance() {
+    if (m_wheel.empty()) {
+      return;
+    }
+    m_wheel.advance(now(), [this](const K &key) { m_cache.erase(key); });
+    m_wheel.collect(2, [this](const K &key) { return m_cache.contains(key); });
+  }
 
 public:
-  explicit LRUCache(std::size_t capacity) : Cache<K, V>(capacity) {}
+  explicit BasicExpiringCache(std::size_t capacity)
+      : Base(capacity), m_cache(capacity), m_epoch(Clock::now()) {}
 
-  V get(const K &key) override {
-    // We check if 'key' is in the hash map
-    auto iter = m_hashmap.find(key);
-    if (iter == m_hashmap.end()) {
-      throw std::invalid_argument(
-          "Key is not found!"); // throw an exception that indicates 'not found'
+  std::size_t getWeight() const { return m_cache.getWeight(); }
+
+  // Erases the expired entries before the policy evicts any live ones
+  void setCapacity(std::size_t capacity) {
+    Base::setCapacity(capacity);
+    advance();
+    m_cache.setCapacity(capacity);
+  }
+
+  V *getPtr(const K &key) {
+    if (!m_wheel.empty() && isExpired(key)) {
+      erase(key);
+      return nullptr;
     }
-    // Otherwise, push the (key, value) pair to the front of 'm_list' and update
-    // the hash map
-    m_list.emplace_front(std::make_pair(key, iter->second->second));
-    m_list.erase(iter->second);
-    iter->second = m_list.begin();
-    // Return 'value' from the pair
-    return m_list.begin()->second;
+    return m_cache.getPtr(key);
+  }
+
+  using Base::put;
+
+  // Like the emplace() of the policy; the entry does not expire
+  template <typename Key, typename... Args>
+  void emplace(Key &&key, Args &&...args) {
+    advance();
+    m_wheel.cancel(key);
+    m_cache.emplace(std::forward<Key>(key), std::forward<Args>(args)...);
   }
 
-  void put(const K &key, const V &value) override {
-    // Corner case:
-    if (Cache<K, V>::getCapacity() == 0) {
+  // Stores an entry that expires once 'ttl' has passed. The deadline rounds
+  // up to a whole tick, so the entry may outlive 'ttl' by less than a
+  // millisecond but never expires early.
+  template <typename Value, typename Rep, typename Period>
+  void put(const K &key, Value &&value,
+           std::chrono::duration<Rep, Period> ttl) {
+    advance();
+    auto deadline = std::chrono::ceil<std::chrono::milliseconds>(
+                        Clock::now() + ttl - m_epoch)
+                        .count();
+    // Corner case: an entry that has already expired is not cached
+    if (deadline <= 0 || static_cast<std::uint64_t>(deadline) <= now()) {
+      erase(key);
       return;
     }
-    // We check if 'key' is in the hash map
-    auto iter = m_hashmap.find(key);
-    if (iter == m_hashmap.end()) {
-      if (m_hashmap.size() == Cache<K, V>::getCapacity()) {
-        // The cache is full, we need to erase the least recently used item from
-        // 'm_list' and update the hash map
-        m_hashmap.erase(m_list.back().first);
-        m_list.pop_back();
+    m_cache.emplace(key, std::forward<Value>(value));
+    m_wheel.schedule(key, static_cast<std::uint64_t>(deadline));
+  }
+
+  bool contains(const K &key) const {
+    return m_cache.contains(key) && !isExpired(key);
+  }
+
+  bool erase(const K &key) {
+    m_wheel.cancel(key);
+    return m_cache.erase(key);
+  }
+
+  void clear() {
+    m_cache.clear();
+    m_wheel.clear();
+  }
+};
+
+template <template <typename...> class Policy, typename K, typename V,
+          typename Key_Hash = std::hash<K>,
+          typename Clock = std::chrono::steady_clock>
+using ExpiringCache =
+    VirtualCache<BasicExpiringCache<Policy, K, V, Key_Hash, Clock>>;
+
+// Computes the hit ratio an LRUCache would reach on a stream of keys, for
+// every capacity at once, from the reuse distance of each access: the number
+// of distinct keys accessed since the previous access to the same key. An
+// access hits in an LRU cache of capacity c exactly when its reuse distance
+// is below c. The distances come from a Fenwick tree over the access times
+// that holds a one at the latest access of every key.
+//
+// To bound the memory, only the keys whose hash falls below a threshold are
+// tracked (spatial sampling as in SHARDS), and each sampled distance stands
+// for 1 / rate distances of the whole stream. With 'maxKeys' set, the
+// threshold is lowered whenever more keys than that are tracked, dropping the
+// keys above it. A rate of 1 without 'maxKeys' gives exact results.
+template <typename K, typename Key_Hash = std::hash<K>> class MissRatioCurve {
+private:
+  static constexpr std::uint32_t MODULUS = 1U << 24;
+  static constexpr std::size_t MINIMAL_TREE_SIZE = 1024;
+  static constexpr std::size_t MAXIMAL_BIN_COUNT = 1 << 20;
+
+  struct Tracked {
+    std::uint64_t m_time;
+    std::uint32_t m_sample;
+  };
+
+  Key_Hash m_hasher;
+  std::uint32_t m_threshold;
+  std::size_t m_maxKeys;
+  std::unordered_map<K, Tracked, Key_Hash> m_lastAccess;
+  // A max-heap of the tracked keys by sample, kept only with 'maxKeys'
+  std::vector<std::pair<std::uint32_t, K>> m_heap;
+  std::vector<std::int64_t> m_tree;
+  std::uint64_t m_time;
+  // m_bins[i] holds the weight of the hits at scaled reuse distances in
+  // [i * m_binWidth, (i + 1) * m_binWidth)
+  std::vector<double> m_bins;
+  double m_binWidth;
+  double m_totalWeight;
+  std::size_t m_accessCount;
+
+  static bool heapLess(const std::pair<std::uint32_t, K> &lhs,
+                       const std::pair<std::uint32_t, K> &rhs) {
+    return lhs.first < rhs.first;
+  }
+
+  // The sample of a key is 24 well-mixed bits of its hash
+  std::uint32_t sampleOf(const K &key) const {
+    auto hash = static_cast<std::uint64_t>(m_hasher(key));
+    return static_cast<std::uint32_t>((hash * 0x9e3779b97f4a7c15ULL) >> 40);
+  }
+
+  void mark(std::uint64_t time, std::int64_t delta) {
+    for (std::size_t i = time + 1; i <= m_tree.size(); i += i & (~i + 1)) {
+      m_tree[i - 1] += delta;
+    }
+  }
+
+  // The number of tracked keys last accessed at or before 'time'
+  std::int64_t countUpTo(std::uint64_t time) const {
+    std::int64_t count = 0;
+    for (std::size_t i = time + 1; i > 0; i -= i & (~i + 1)) {
+      count += m_tree[i - 1];
+    }
+    return count;
+  }
+
+  // Renumbers the latest accesses as 0, 1, ... in order, once the times have
+  // reached the end of the tree, so that the tree never outgrows the keys
+  void compact() {
+    std::vector<Tracked *> tracked;
+    tracked.reserve(m_lastAccess.size());
+    for (auto &entry : m_lastAccess) {
+      tracked.push_back(&entry.second);
+    }
+    std::sort(tracked.begin(), tracked.end(),
+              [](const Tracked *lhs, const Tracked *rhs) {
+                return lhs->m_time < rhs->m_time;
+              });
+    m_tree.assign(std::max(MINIMAL_TREE_SIZE, 2 * tracked.size()), 0);
+    for (m_time = 0; m_time < tracked.size(); ++m_time) {
+      tracked[m_time]->m_time = m_time;
+      mark(m_time, 1);
+    }
+  }
+
+  void addHit(double distance, double weight) {
+    auto bin = static_cast<std::size_t>(distance / m_binWidth);
+    while (bin >= MAXIMAL_BIN_COUNT) {
+      // Halve the resolution by merging neighbouring bins
+      std::vector<double> merged((m_bins.size() + 1) / 2, 0.0);
+      for (std::size_t i = 0; i < m_bins.size(); ++i) {
+        merged[i / 2] += m_bins[i];
       }
-      m_list.emplace_front(std::make_pair(key, value));
-      m_hashmap[key] = m_list.begin();
+      m_bins.swap(merged);
+      m_binWidth *= 2;
+      bin /= 2;
+    }
+    if (bin >= m_bins.size()) {
+      m_bins.resize(bin + 1, 0.0);
+    }
+    m_bins[bin] += weight;
+  }
+
+  // Samples below the largest tracked sample from now on, and drops the keys
+  // that no longer qualify
+  void lowerThreshold() {
+    m_threshold = m_heap.front().first;
+    while (!m_heap.empty() && m_heap.front().first >= m_threshold) {
+      std::pop_heap(m_heap.begin(), m_heap.end(), heapLess);
+      auto iter = m_lastAccess.find(m_heap.back().second);
+      mark(iter->second.m_time, -1);
+      m_lastAccess.erase(iter);
+      m_heap.pop_back();
+    }
+  }
+
+public:
+  explicit MissRatioCurve(double samplingRate = 1.0, std::size_t maxKeys = 0)
+      : m_threshold(static_cast<std::uint32_t>(
+            std::min(1.0, std::max(samplingRate, 1.0 / MODULUS)) * MODULUS)),
+        m_maxKeys(maxKeys), m_tree(MINIMAL_TREE_SIZE, 0), m_time(0),
+        m_binWidth(std::max(1.0, static_cast<double>(MODULUS) / m_threshold)),
+        m_totalWeight(0), m_accessCount(0) {}
+
+  std::size_t getAccessCount() const { return m_accessCount; }
+
+  // The current share of the keys that is tracked
+  double getSamplingRate() const {
+    return static_cast<double>(m_threshold) / MODULUS;
+  }
+
+  void access(const K &key) {
+    ++m_accessCount;
+    std::uint32_t sample = sampleOf(key);
+    if (sample >= m_threshold) {
+      return;
+    }
+    double weight = static_cast<double>(MODULUS) / m_threshold;
+    m_totalWeight += weight;
+    if (m_time == m_tree.size()) {
+      compact();
+    }
+    auto iter = m_lastAccess.find(key);
+    if (iter != m_lastAccess.end()) {
+      // Every key accessed after the previous access to 'key' is counted once
+      std::int64_t distance =
+          static_cast<std::int64_t>(m_lastAccess.size()) -
+          countUpTo(iter->second.m_time);
+      addHit(static_cast<double>(distance) * weight, weight);
+      mark(iter->second.m_time, -1);
+      iter->second.m_time = m_time;
     } else {
-      m_list.erase(iter->second);
-      m_list.emplace_front(std::make_pair(key, value));
-      iter->second = m_list.begin();
+      m_lastAccess.emplace(key, Tracked{m_time, sample});
+      if (m_maxKeys != 0) {
+        m_heap.emplace_back(sample, key);
+        std::push_heap(m_heap.begin(), m_heap.end(), heapLess);
+      }
+    }
+    mark(m_time, 1);
+    ++m_time;
+    if (m_maxKeys != 0 && m_lastAccess.size() > m_maxKeys) {
+      lowerThreshold();
     }
   }
 
-  void clear() override {
-    m_list.clear();
-    m_hashmap.clear();
+  // The estimated hit ratio of an LRUCache of 'capacity' over all accesses so
+  // far, counting the first access to every key as a miss
+  double hitRatio(std::size_t capacity) const {
+    if (capacity == 0 || m_totalWeight == 0) {
+      return 0;
+    }
+    double limit = static_cast<double>(capacity) / m_binWidth;
+    std::size_t full = std::min(static_cast<std::size_t>(limit), m_bins.size());
+    double hits = 0;
+    for (std::size_t i = 0; i < full; ++i) {
+      hits += m_bins[i];
+    }
+    if (full < m_bins.size()) {
+      // Assume the hits of the bin that 'capacity' splits spread evenly
+      hits += m_bins[full] * (limit - static_cast<double>(full));
+    }
+    // As in SHARDS-adj, the sampled keys may have drawn more or fewer
+    // accesses than their share; the difference goes to the shortest distance
+    hits += static_cast<double>(m_accessCount) - m_totalWeight;
+    return std::min(1.0,
+                    std::max(0.0, hits / static_cast<double>(m_accessCount)));
+  }
+
+  double missRatio(std::size_t capacity) const {
+    return 1 - hitRatio(capacity);
   }
 };
 } // namespace CacheImpl
@@ -0,0 +1,823 @@
+#include "CacheImpl.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Counts heap allocations so that benchmarks can report allocations per op
+static std::atomic<std::size_t> g_allocations(0);
+
+// Counts the bytes of live heap blocks, so that benchmarks can report the
+// memory a cache holds per entry; stays zero where the size of a block is not
+// known
+static std::atomic<std::size_t> g_liveBytes(0);
+
+static std::size_t blockSize(void *memory) {
+#ifdef __GLIBC__
+  return malloc_usable_size(memory);
+#else
+  (void)memory;
+  return 0;
+#endif
+}
+
+void *operator new(std::size_t size) {
+  if (void *memory = operator new(size, std::nothrow)) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  ++g_allocations;
+  void *memory = std::malloc(size == 0 ? 1 : size);
+  if (memory != nullptr) {
+    g_liveBytes += blockSize(memory);
+  }
+  return memory;
+}
+
+void operator delete(void *memory) noexcept {
+  if (memory != nullptr) {
+    g_liveBytes -= blockSize(memory);
+  }
+  std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+  operator delete(memory);
+}
+
+// Over-aligned blocks, such as the node chunks of CacheImpl::NodePool, which
+// come from std::pmr::new_delete_resource()
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  ++g_allocations;
+  std::size_t align = static_cast<std::size_t>(alignment);
+  std::size_t rounded = (size + align - 1) / align * align;
+  void *memory = std::aligned_alloc(align, rounded == 0 ? align : rounded);
+  if (memory == nullptr) {
+    throw std::bad_alloc();
+  }
+  g_liveBytes += blockSize(memory);
+  return memory;
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+  operator delete(memory);
+}
+
+void operator delete(void *memory, std::size_t, std::align_val_t) noexcept {
+  operator delete(memory);
+}
+
+namespace {
+constexpr std::size_t CAPACITY = 1 << 16;
+constexpr std::size_t OPERATIONS = 1 << 21;
+
+// Keeps the optimizer from discarding the lookups being measured
+volatile long long g_sink;
+
+// LFUCache as it was before its frequency buckets became a linked list, kept
+// for the head-to-head comparison below
+template <typename K, typename V, typename Key_Hash = std::hash<K>,
+          typename Freq_Hash = std::hash<int>>
+class LegacyLFUCache : public CacheImpl::Cache<K, V> {
+private:
+  // Define the inner node
+  struct Node {
+    K m_key;
+    V m_value;
+    int m_freq;
+
+    explicit Node(K key, V value, int freq)
+        : m_key(key), m_value(value), m_freq(freq) {}
+  };
+
+  int m_minimalFreq;
+  std::unordered_map<K, typename std::list<Node>::iterator, Key_Hash> m_hashmap;
+  std::unordered_map<int, std::list<Node>, Freq_Hash> m_freqHashmap;
+
+public:
+  explicit LegacyLFUCache(std::size_t capacity)
+      : CacheImpl::Cache<K, V>(capacity), m_minimalFreq(0) {}
+
+  std::size_t getWeight() const override { return m_hashmap.size(); }
+
+  V *getPtr(const K &key) override {
+    auto iter = m_hashmap.find(key);
+    if (iter == m_hashmap.end()) {
+      return nullptr;
+    }
+    auto iter_in_list = iter->second;
+    V value = iter_in_list->m_value;
+    int freq = iter_in_list->m_freq;
+    // Update 'm_freqHashmap'
+    m_freqHashmap[freq].erase(iter_in_list);
+    if (m_freqHashmap[freq].empty()) {
+      m_freqHashmap.erase(freq);
+      if (m_minimalFreq == freq) {
+        ++m_minimalFreq;
+      }
+    }
+    // Update the frequency
+    ++freq;
+    m_freqHashmap[freq].emplace_front(Node(key, value, freq));
+    // Update 'm_freqHashmap'
+    iter->second = m_freqHashmap[freq].begin();
+    // Return 'value'
+    return &iter->second->m_value;
+  }
+
+  void put(const K &key, const V &value) override {
+    // Corner case:
+    if (CacheImpl::Cache<K, V>::getCapacity() == 0) {
+      return;
+    }
+    auto iter = m_hashmap.find(key);
+    if (iter == m_hashmap.end()) {
+      // Delete the least frequently used item in both hashmaps
+      if (m_hashmap.size() == CacheImpl::Cache<K, V>::getCapacity()) {
+        auto iter_to_lfu_item = m_freqHashmap[m_minimalFreq].back();
+        m_hashmap.erase(iter_to_lfu_item.m_key);
+        m_freqHashmap[m_minimalFreq].pop_back();
+        if (m_freqHashmap[m_minimalFreq].empty()) {
+          m_freqHashmap.erase(m_minimalFreq);
+        }
+      }
+      // Update 'm_minimalFreq'
+      m_minimalFreq = 1;
+      // Update 'm_freqHashmap'
+      m_freqHashmap[m_minimalFreq].emplace_front(
+          Node(key, value, m_minimalFreq));
+      // Update 'm_hashmap'
+      m_hashmap[key] = m_freqHashmap[m_minimalFreq].begin();
+    } else {
+      auto iter_in_list = iter->second;
+      int freq = iter_in_list->m_freq;
+      // Update 'freqHashmap'
+      m_freqHashmap[freq].erase(iter_in_list);
+      if (m_freqHashmap[freq].empty()) {
+        m_freqHashmap.erase(freq);
+        if (m_minimalFreq == freq) {
+          ++m_minimalFreq;
+        }
+      }
+      // Update frequency
+      ++freq;
+      m_freqHashmap[freq].emplace_front(Node(key, value, freq));
+      // Update 'm_hashmap'
+      iter->second = m_freqHashmap[freq].begin();
+    }
+  }
+
+  bool contains(const K &key) const override {
+    return m_hashmap.count(key) != 0;
+  }
+
+  bool erase(const K &key) override {
+    auto iter = m_hashmap.find(key);
+    if (iter == m_hashmap.end()) {
+      return false;
+    }
+    int freq = iter->second->m_freq;
+    m_freqHashmap[freq].erase(iter->second);
+    m_hashmap.erase(iter);
+    if (m_freqHashmap[freq].empty()) {
+      m_freqHashmap.erase(freq);
+      // Rescan for the new minimal frequency
+      if (m_minimalFreq == freq && !m_freqHashmap.empty()) {
+        m_minimalFreq = m_freqHashmap.begin()->first;
+        for (auto &bucket : m_freqHashmap) {
+          m_minimalFreq = std::min(m_minimalFreq, bucket.first);
+        }
+      }
+    }
+    return true;
+  }
+
+  void clear() override {
+    m_minimalFreq = 0;
+    m_hashmap.clear();
+    m_freqHashmap.clear();
+  }
+};
+
+template <typename Function>
+double nanosecondsPerOperation(std::size_t operations, Function &&function) {
+  auto start = std::chrono::steady_clock::now();
+  function();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+         static_cast<double>(operations);
+}
+
+// Half of the generated keys are resident and half of them miss
+std::vector<int> missHeavyKeys() {
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> distribution(0, 2 * CAPACITY - 1);
+  std::vector<int> keys(OPERATIONS);
+  for (auto &key : keys) {
+    key = distribution(generator);
+  }
+  return keys;
+}
+
+template <typename CacheType>
+void benchmarkMissHeavyLookups(const char *name,
+                               const std::vector<int> &keys) {
+  CacheType cache(CAPACITY);
+  for (int i = 0; i < static_cast<int>(CAPACITY); ++i) {
+    cache.put(i, i);
+  }
+  long long sum = 0;
+  double throwing = nanosecondsPerOperation(keys.size(), [&] {
+    for (int key : keys) {
+      try {
+        sum += cache.get(key);
+      } catch (const std::invalid_argument &) {
+        --sum;
+      }
+    }
+  });
+  double nonThrowing = nanosecondsPerOperation(keys.size(), [&] {
+    for (int key : keys) {
+      if (auto value = cache.tryGet(key)) {
+        sum += *value;
+      } else {
+        --sum;
+      }
+    }
+  });
+  g_sink = sum;
+  std::printf("%-10s get()+catch %8.1f ns/op  tryGet() %8.1f ns/op  "
+              "speedup %5.1fx\n",
+              name, throwing, nonThrowing, throwing / nonThrowing);
+}
+
+// Inserts fresh keys into a full cache while re-reading recent ones, so every
+// put() evicts and every get() hits
+template <typename CacheType, typename... Args>
+void benchmarkSteadyStateLRU(const char *name, Args &&...args) {
+  CacheType cache(CAPACITY, std::forward<Args>(args)...);
+  int next = 0;
+  for (; next < static_cast<int>(CAPACITY); ++next) {
+    cache.put(next, next);
+  }
+  long long sum = 0;
+  std::size_t allocations = g_allocations;
+  double time = nanosecondsPerOperation(2 * OPERATIONS, [&] {
+    for (std::size_t i = 0; i < OPERATIONS; ++i, ++next) {
+      cache.put(next, next);
+      sum += *cache.getPtr(next - static_cast<int>(CAPACITY) / 4);
+    }
+  });
+  g_sink = sum;
+  std::printf("%-14s %8.1f ns/op  %6.3f allocations/op\n", name, time,
+              static_cast<double>(g_allocations - allocations) /
+                  static_cast<double>(2 * OPERATIONS));
+}
+
+// Repeatedly hits a full cache holding std::string values of 'valueSize'
+// bytes; the cost of a hit should not depend on the size of the value
+template <typename CacheType>
+void benchmarkLargeValueHits(const char *name, std::size_t valueSize) {
+  constexpr std::size_t ENTRIES = 1 << 12;
+  CacheType cache(ENTRIES);
+  for (int i = 0; i < static_cast<int>(ENTRIES); ++i) {
+    cache.put(i, std::string(valueSize, 'x'));
+  }
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> distribution(0, ENTRIES - 1);
+  std::vector<int> keys(OPERATIONS);
+  for (auto &key : keys) {
+    key = distribution(generator);
+  }
+  long long sum = 0;
+  std::size_t allocations = g_allocations;
+  double time = nanosecondsPerOperation(keys.size(), [&] {
+    for (int key : keys) {
+      sum += static_cast<long long>(cache.getPtr(key)->size());
+    }
+  });
+  g_sink = sum;
+  std::printf("%-6s %6zu-byte values %8.1f ns/op  %6.3f allocations/op\n",
+              name, valueSize, time,
+              static_cast<double>(g_allocations - allocations) /
+                  static_cast<double>(keys.size()));
+}
+
+// Looks up std::string keys by std::string_view, as a parser or a network
+// handler holding views into its buffer would
+template <typename CacheType> void benchmarkStringKeyLookups(const char *name) {
+  CacheType cache(CAPACITY);
+  std::vector<std::string> keys;
+  for (std::size_t i = 0; i < 2 * CAPACITY; ++i) {
+    // Long enough that a temporary std::string allocates
+    keys.push_back("session/" + std::to_string(i) + "/user-preferences");
+  }
+  for (std::size_t i = 0; i < CAPACITY; ++i) {
+    cache.put(keys[i], static_cast<int>(i));
+  }
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<std::size_t> distribution(0, keys.size() - 1);
+  std::vector<std::string_view> lookups(OPERATIONS);
+  for (auto &lookup : lookups) {
+    lookup = keys[distribution(generator)];
+  }
+  long long sum = 0;
+  std::size_t allocations = g_allocations;
+  double time = nanosecondsPerOperation(lookups.size(), [&] {
+    for (std::string_view lookup : lookups) {
+      if (auto value = cache.tryGet(lookup)) {
+        sum += *value;
+      }
+    }
+  });
+  g_sink = sum;
+  std::printf("%-26s %8.1f ns/op  %6.3f allocations/op\n", name, time,
+              static_cast<double>(g_allocations - allocations) /
+                  static_cast<double>(lookups.size()));
+}
+
+// Looks up Zipf-like keys and inserts them on a miss, as a cache in front of a
+// slower store would
+template <typename CacheType> void benchmarkLFU(const char *name) {
+  CacheType cache(CAPACITY);
+  std::mt19937 generator(42);
+  // The square of a uniform variable skews the keys towards small values
+  std::uniform_real_distribution<double> distribution(0.0, 1.0);
+  std::vector<int> keys(OPERATIONS);
+  for (auto &key : keys) {
+    double x = distribution(generator);
+    key = static_cast<int>(x * x * 8 * CAPACITY);
+  }
+  long long sum = 0;
+  std::size_t hits = 0;
+  std::size_t allocations = g_allocations;
+  double time = nanosecondsPerOperation(keys.size(), [&] {
+    for (int key : keys) {
+      if (int *value = cache.getPtr(key)) {
+        sum += *value;
+        ++hits;
+      } else {
+        cache.put(key, key);
+      }
+    }
+  });
+  g_sink = sum;
+  std::printf("%-10s %8.1f ns/op  %6.3f allocations/op  hit ratio %.3f\n",
+              name, time,
+              static_cast<double>(g_allocations - allocations) /
+                  static_cast<double>(keys.size()),
+              static_cast<double>(hits) / static_cast<double>(keys.size()));
+}
+
+// Looks up groups of 256 keys on a cache too large for the CPU caches, one
+// virtual get at a time and then with getMany()
+template <typename CacheType> void benchmarkBatchedLookups(const char *name) {
+  constexpr std::size_t ENTRIES = 1 << 21;
+  constexpr std::size_t GROUP = 256;
+  CacheType cache(ENTRIES);
+  for (int i = 0; i < static_cast<int>(ENTRIES); ++i) {
+    cache.put(i, i);
+  }
+  CacheImpl::Cache<int, int> &base = cache;
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> distribution(0, 2 * ENTRIES - 1);
+  std::vector<int> keys(OPERATIONS);
+  for (auto &key : keys) {
+    key = distribution(generator);
+  }
+  std::vector<std::optional<int>> results(GROUP);
+  long long sum = 0;
+  double single = nanosecondsPerOperation(keys.size(), [&] {
+    for (std::size_t first = 0; first < keys.size(); first += GROUP) {
+      for (std::size_t i = 0; i < GROUP; ++i) {
+        results[i] = base.tryGet(keys[first + i]);
+      }
+      sum += results[0].value_or(0);
+    }
+  });
+  double batched = nanosecondsPerOperation(keys.size(), [&] {
+    for (std::size_t first = 0; first < keys.size(); first += GROUP) {
+      base.getMany(keys.data() + first, GROUP, results.data());
+      sum += results[0].value_or(0);
+    }
+  });
+  g_sink = sum;
+  std::printf("%-14s tryGet() %8.1f ns/key  getMany() %8.1f ns/key\n", name,
+              single, batched);
+}
+
+template <typename CacheType>
+double smallCacheAccesses(CacheType &cache, const std::vector<int> &keys) {
+  long long sum = 0;
+  double time = nanosecondsPerOperation(keys.size(), [&] {
+    for (int key : keys) {
+      if (int *value = cache.getPtr(key)) {
+        sum += *value;
+      } else {
+        cache.put(key, key);
+      }
+    }
+  });
+  g_sink = sum;
+  return time;
+}
+
+// Gets with puts on misses on a cache small enough to stay in the CPU caches,
+// where the cost of the call itself shows: on a BasicLRUCache, whose methods
+// inline, and on an LRUCache through the virtual Cache<K, V> interface
+void benchmarkDispatch() {
+  constexpr std::size_t ENTRIES = 256;
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> distribution(0, ENTRIES + ENTRIES / 8);
+  std::vector<int> keys(OPERATIONS);
+  for (auto &key : keys) {
+    key = distribution(generator);
+  }
+  CacheImpl::BasicLRUCache<int, int> direct(ENTRIES);
+  std::unique_ptr<CacheImpl::Cache<int, int>> base =
+      std::make_unique<CacheImpl::LRUCache<int, int>>(ENTRIES);
+  double inlined = smallCacheAccesses(direct, keys);
+  double virtualCalls = smallCacheAccesses(*base, keys);
+  std::printf("BasicLRUCache %8.1f ns/op  Cache<K, V> %8.1f ns/op\n", inlined,
+              virtualCalls);
+}
+
+// The setup ShardedCache replaces: one LRUCache behind one mutex
+class GloballyLockedLRUCache {
+private:
+  std::mutex m_mutex;
+  CacheImpl::LRUCache<int, int> m_cache;
+
+public:
+  explicit GloballyLockedLRUCache(std::size_t capacity) : m_cache(capacity) {}
+
+  std::optional<int> tryGet(int key) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cache.tryGet(key);
+  }
+
+  void put(int key, int value) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cache.put(key, value);
+  }
+};
+
+// Every thread looks up random keys, of which about 90% hit, and puts the
+// missing ones back; returns the total throughput in millions of ops/sec
+template <typename CacheType>
+double concurrentThroughput(CacheType &cache, std::size_t threadCount) {
+  constexpr std::size_t OPERATIONS_PER_THREAD = 1 << 18;
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t t = 0; t < threadCount; ++t) {
+    threads.emplace_back([&cache, t] {
+      std::mt19937 generator(static_cast<unsigned>(t));
+      std::uniform_int_distribution<int> distribution(
+          0, static_cast<int>(CAPACITY + CAPACITY / 9));
+      long long sum = 0;
+      for (std::size_t i = 0; i < OPERATIONS_PER_THREAD; ++i) {
+        int key = distribution(generator);
+        if (auto value = cache.tryGet(key)) {
+          sum += *value;
+        } else {
+          cache.put(key, key);
+        }
+      }
+      g_sink = sum;
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return static_cast<double>(threadCount * OPERATIONS_PER_THREAD) /
+         std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+void benchmarkConcurrentLRU() {
+  std::printf("%-8s %16s %16s %16s\n", "threads", "global mutex",
+              "ShardedCache", "ClockCache");
+  for (std::size_t threadCount : {1, 2, 4, 8, 16, 32}) {
+    GloballyLockedLRUCache locked(CAPACITY);
+    CacheImpl::ShardedCache<CacheImpl::LRUCache, int, int> sharded(CAPACITY,
+                                                                   64);
+    CacheImpl::ClockCache<int, int> clock(CAPACITY);
+    double lockedThroughput = concurrentThroughput(locked, threadCount);
+    double shardedThroughput = concurrentThroughput(sharded, threadCount);
+    double clockThroughput = concurrentThroughput(clock, threadCount);
+    std::printf("%-8zu %10.2f Mop/s %10.2f Mop/s %10.2f Mop/s\n",
+                threadCount, lockedThroughput, shardedThroughput,
+                clockThroughput);
+  }
+}
+
+// Compares how close CLOCK gets to the hit ratio of LRU on skewed keys
+template <typename CacheType> double skewedHitRatio() {
+  CacheType cache(CAPACITY);
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<double> distribution(0.0, 1.0);
+  std::size_t hits = 0;
+  for (std::size_t i = 0; i < OPERATIONS; ++i) {
+    double x = distribution(generator);
+    int key = static_cast<int>(x * x * 8 * CAPACITY);
+    if (cache.tryGet(key)) {
+      ++hits;
+    } else {
+      cache.put(key, key);
+    }
+  }
+  return static_cast<double>(hits) / static_cast<double>(OPERATIONS);
+}
+
+// The suite runs every policy on every combination of key type, access
+// pattern and hit ratio. Each operation is a get that puts the key back on a
+// miss, as a cache in front of a slower store would do.
+constexpr std::size_t SUITE_OPERATIONS = 1 << 20;
+
+// Operations are timed in blocks, so that reading the clock does not dominate
+// them; the percentiles are over the mean ns/op of each block
+constexpr std::size_t BLOCK_SIZE = 32;
+
+enum class Workload { Uniform, Zipfian, Scan };
+
+// The keys an operation uses, as indices into a universe of 'universe' keys
+std::vector<std::uint32_t> workloadIndices(Workload workload,
+                                           std::size_t universe) {
+  std::vector<std::uint32_t> indices(SUITE_OPERATIONS);
+  std::mt19937 generator(42);
+  switch (workload) {
+  case Workload::Uniform: {
+    std::uniform_int_distribution<std::uint32_t> distribution(
+        0, static_cast<std::uint32_t>(universe - 1));
+    for (auto &index : indices) {
+      index = distribution(generator);
+    }
+    break;
+  }
+  case Workload::Zipfian: {
+    // Key i is drawn with a probability proportional to 1 / (i + 1)^0.99
+    std::vector<double> cumulative(universe);
+    double total = 0;
+    for (std::size_t i = 0; i < universe; ++i) {
+      total += 1.0 / std::pow(static_cast<double>(i + 1), 0.99);
+      cumulative[i] = total;
+    }
+    std::uniform_real_distribution<double> distribution(0.0, total);
+    for (auto &index : indices) {
+      auto iter = std::lower_bound(cumulative.begin(), cumulative.end(),
+                                   distribution(generator));
+      index = static_cast<std::uint32_t>(
+          std::min<std::size_t>(iter - cumulative.begin(), universe - 1));
+    }
+    break;
+  }
+  case Workload::Scan:
+    // Loops over the universe in order
+    for (std::size_t i = 0; i < indices.size(); ++i) {
+      indices[i] = static_cast<std::uint32_t>(i % universe);
+    }
+    break;
+  }
+  return indices;
+}
+
+template <typename Key> std::vector<Key> suiteKeys(std::size_t universe);
+
+template <> std::vector<int> suiteKeys<int>(std::size_t universe) {
+  std::vector<int> keys(universe);
+  for (std::size_t i = 0; i < universe; ++i) {
+    keys[i] = static_cast<int>(i);
+  }
+  return keys;
+}
+
+// Longer than the small string buffer, like most real string keys
+template <>
+std::vector<std::string> suiteKeys<std::string>(std::size_t universe) {
+  std::vector<std::string> keys(universe);
+  for (std::size_t i = 0; i < universe; ++i) {
+    keys[i] = "benchmark/key/" + std::to_string(i * 2654435761U % universe);
+  }
+  return keys;
+}
+
+struct SuiteResult {
+  double hitRatio;
+  double operationsPerSecond;
+  double p50;
+  double p99;
+  double p999;
+  double allocationsPerOperation;
+  double bytesPerEntry;
+};
+
+template <typename CacheType, typename Key>
+SuiteResult runSuiteWorkload(const std::vector<Key> &keys,
+                             const std::vector<std::uint32_t> &indices) {
+  long long sum = 0;
+  std::size_t hits = 0;
+  auto access = [&](CacheType &cache, const Key &key) {
+    if (int *value = cache.getPtr(key)) {
+      sum += *value;
+      ++hits;
+    } else {
+      cache.put(key, static_cast<int>(sum));
+    }
+  };
+  SuiteResult result;
+  std::size_t liveBytes = g_liveBytes;
+  CacheType cache(CAPACITY);
+  // Warm up on the start of the sequence so that the cache is full
+  for (std::size_t i = 0; i < 2 * CAPACITY; ++i) {
+    access(cache, keys[indices[i]]);
+  }
+  std::size_t entries = 0;
+  for (const auto &key : keys) {
+    entries += cache.contains(key) ? 1 : 0;
+  }
+  result.bytesPerEntry =
+      static_cast<double>(static_cast<long long>(g_liveBytes - liveBytes)) /
+      static_cast<double>(std::max<std::size_t>(entries, 1));
+  hits = 0;
+  std::vector<double> blocks;
+  blocks.reserve(indices.size() / BLOCK_SIZE);
+  std::size_t allocations = g_allocations;
+  double total = nanosecondsPerOperation(indices.size(), [&] {
+    for (std::size_t first = 0; first + BLOCK_SIZE <= indices.size();
+         first += BLOCK_SIZE) {
+      auto start = std::chrono::steady_clock::now();
+      for (std::size_t i = first; i < first + BLOCK_SIZE; ++i) {
+        access(cache, keys[indices[i]]);
+      }
+      auto end = std::chrono::steady_clock::now();
+      blocks.push_back(
+          std::chrono::duration<double, std::nano>(end - start).count() /
+          BLOCK_SIZE);
+    }
+  });
+  result.allocationsPerOperation =
+      static_cast<double>(g_allocations - allocations) /
+      static_cast<double>(indices.size());
+  g_sink = sum;
+  result.hitRatio =
+      static_cast<double>(hits) / static_cast<double>(indices.size());
+  result.operationsPerSecond = 1e9 / total;
+  std::sort(blocks.begin(), blocks.end());
+  auto percentile = [&](double p) {
+    return blocks[static_cast<std::size_t>(p * (blocks.size() - 1))];
+  };
+  result.p50 = percentile(0.5);
+  result.p99 = percentile(0.99);
+  result.p999 = percentile(0.999);
+  return result;
+}
+
+template <template <typename...> class Policy, typename Key>
+void benchmarkSuiteKeys(const char *policyName, const char *keyName,
+                        const char *filter) {
+  const std::pair<Workload, const char *> workloads[] = {
+      {Workload::Uniform, "uniform"},
+      {Workload::Zipfian, "zipf"},
+      {Workload::Scan, "scan"}};
+  // A universe slightly larger than the cache mostly hits, and one four
+  // times larger mostly misses
+  const std::pair<std::size_t, const char *> mixes[] = {
+      {CAPACITY + CAPACITY / 8, "hit-heavy"}, {4 * CAPACITY, "miss-heavy"}};
+  for (const auto &mix : mixes) {
+    auto keys = suiteKeys<Key>(mix.first);
+    for (const auto &workload : workloads) {
+      std::string name = std::string(policyName) + "/" + keyName + "/" +
+                         workload.second + "/" + mix.second;
+      if (filter != nullptr && name.find(filter) == std::string::npos) {
+        continue;
+      }
+      auto result = runSuiteWorkload<Policy<Key, int>>(
+          keys, workloadIndices(workload.first, mix.first));
+      std::printf("%-38s %5.1f%% %8.2f %7.1f %7.1f %8.1f %9.3f %8.1f\n",
+                  name.c_str(), 100 * result.hitRatio,
+                  result.operationsPerSecond / 1e6, result.p50, result.p99,
+                  result.p999, result.allocationsPerOperation,
+                  result.bytesPerEntry);
+    }
+  }
+}
+
+template <template <typename...> class Policy>
+void benchmarkSuitePolicy(const char *name, const char *filter) {
+  benchmarkSuiteKeys<Policy, int>(name, "int", filter);
+  benchmarkSuiteKeys<Policy, std::string>(name, "string", filter);
+}
+
+void benchmarkSuite(const char *filter) {
+  std::printf("Policy suite (capacity %zu, %zu ops, get with put on miss)\n",
+              CAPACITY, SUITE_OPERATIONS);
+  std::printf("%-38s %6s %8s %7s %7s %8s %9s %8s\n", "benchmark", "hits",
+              "Mop/s", "p50 ns", "p99 ns", "p99.9 ns", "allocs/op",
+              "B/entry");
+  benchmarkSuitePolicy<CacheImpl::FILOCache>("FILO", filter);
+  benchmarkSuitePolicy<CacheImpl::FIFOCache>("FIFO", filter);
+  benchmarkSuitePolicy<CacheImpl::S3FIFOCache>("S3FIFO", filter);
+  benchmarkSuitePolicy<CacheImpl::LFUCache>("LFU", filter);
+  benchmarkSuitePolicy<CacheImpl::LRUCache>("LRU", filter);
+  benchmarkSuitePolicy<CacheImpl::SLRUCache>("SLRU", filter);
+  benchmarkSuitePolicy<CacheImpl::TinyLFUCache>("TinyLFU", filter);
+  benchmarkSuitePolicy<CacheImpl::ARCCache>("ARC", filter);
+  benchmarkSuitePolicy<CacheImpl::IntrusiveLRUCache>("IntrusiveLRU", filter);
+}
+} // namespace
+
+// With an argument, runs only the rows of the suite whose name contains it,
+// e.g. "LRU/string" or "zipf"
+int main(int argc, char **argv) {
+  const char *filter = argc > 1 ? argv[1] : nullptr;
+  benchmarkSuite(filter);
+  if (filter != nullptr) {
+    return 0;
+  }
+
+  std::printf("\nMiss-heavy lookups (50%% misses, capacity %zu, %zu ops)\n",
+              CAPACITY, OPERATIONS);
+  auto keys = missHeavyKeys();
+  benchmarkMissHeavyLookups<CacheImpl::FILOCache<int, int>>("FILO", keys);
+  benchmarkMissHeavyLookups<CacheImpl::FIFOCache<int, int>>("FIFO", keys);
+  benchmarkMissHeavyLookups<CacheImpl::LFUCache<int, int>>("LFU", keys);
+  benchmarkMissHeavyLookups<CacheImpl::LRUCache<int, int>>("LRU", keys);
+  benchmarkMissHeavyLookups<CacheImpl::LRUCache<
+      int, int, std::hash<int>, CacheImpl::FlatHashMapIndex>>("LRU (flat)",
+                                                              keys);
+
+  std::printf("\nSteady-state LRU put with eviction and get hits "
+              "(capacity %zu)\n",
+              CAPACITY);
+  benchmarkSteadyStateLRU<CacheImpl::LRUCache<int, int>>("LRU");
+  benchmarkSteadyStateLRU<CacheImpl::LRUCache<
+      int, int, std::hash<int>, CacheImpl::UnorderedMapIndex,
+      CacheImpl::UnitWeigher, std::allocator<std::pair<const int, int>>>>(
+      "LRU (malloc)");
+  benchmarkSteadyStateLRU<CacheImpl::IntrusiveLRUCache<int, int>>(
+      "IntrusiveLRU");
+  CacheImpl::pmr::PoolResource resource(CAPACITY * 256);
+  benchmarkSteadyStateLRU<CacheImpl::pmr::LRUCache<int, int>>("LRU (pool)",
+                                                               &resource);
+
+  std::printf("\nLFU get-or-put on skewed keys (capacity %zu)\n", CAPACITY);
+  benchmarkLFU<LegacyLFUCache<int, int>>("LegacyLFU");
+  benchmarkLFU<CacheImpl::LFUCache<int, int>>("LFU");
+
+  std::printf("\nLRU hits on large std::string values\n");
+  for (std::size_t valueSize : {16, 1024, 65536}) {
+    benchmarkLargeValueHits<CacheImpl::LRUCache<int, std::string>>("LRU",
+                                                                   valueSize);
+  }
+
+  std::printf("\nstd::string_view lookups of std::string keys (50%% misses)\n");
+  benchmarkStringKeyLookups<CacheImpl::LRUCache<std::string, int>>("LRU");
+  benchmarkStringKeyLookups<CacheImpl::LRUCache<
+      std::string, int, CacheImpl::StringHash, CacheImpl::FlatHashMapIndex>>(
+      "LRU (StringHash, flat)");
+  benchmarkStringKeyLookups<
+      CacheImpl::IntrusiveLRUCache<std::string, int, CacheImpl::StringHash>>(
+      "IntrusiveLRU (StringHash)");
+
+  std::printf("\nLookups in groups of 256 keys (2M entries, 50%% misses)\n");
+  benchmarkBatchedLookups<CacheImpl::FIFOCache<int, int>>("FIFO");
+  benchmarkBatchedLookups<CacheImpl::LRUCache<int, int>>("LRU");
+  benchmarkBatchedLookups<CacheImpl::FIFOCache<int, int, std::hash<int>,
+                                               CacheImpl::FlatHashMapIndex>>(
+      "FIFO (flat)");
+  benchmarkBatchedLookups<CacheImpl::LRUCache<int, int, std::hash<int>,
+                                              CacheImpl::FlatHashMapIndex>>(
+      "LRU (flat)");
+  benchmarkBatchedLookups<CacheImpl::IntrusiveLRUCache<int, int>>(
+      "IntrusiveLRU");
+
+  std::printf("\nLRU gets with puts on misses, direct and virtual "
+              "(256 entries)\n");
+  benchmarkDispatch();
+
+  std::printf("\nConcurrent LRU lookups with puts on misses "
+              "(capacity %zu, %u hardware threads)\n",
+              CAPACITY, std::thread::hardware_concurrency());
+  benchmarkConcurrentLRU();
+  std::printf("Hit ratio on skewed keys: LRU %.3f, CLOCK %.3f\n",
+              skewedHitRatio<CacheImpl::LRUCache<int, int>>(),
+              skewedHitRatio<CacheImpl::ClockCache<int, int>>());
+  return 0;
+}
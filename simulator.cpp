@@ -0,0 +1,299 @@
+// Replays a key trace through the cache policies at many capacities side by
+// side and prints their hit ratios as CSV, one row per capacity:
+//
+//   caches_sim [-p POLICIES] [-c CAPACITIES] [-r RATE] [-k KEYS] TRACE
+//
+// Each line of TRACE holds one access; its key is the line up to the first
+// comma, space or tab, so CSV traces with extra columns work as they are.
+// POLICIES is a comma-separated subset of filo, fifo, s3fifo, lfu, lru, slru,
+// tinylfu, arc and lru-mrc (all but lru-mrc by default) and CAPACITIES a
+// comma-separated list of cache sizes. By default they are the powers of two
+// from 16 up to the first that holds every distinct key of the trace, and at
+// most 2^20: larger caches would never evict, yet each policy sizes its
+// caches for their capacity up front. Finding them takes a first pass over
+// the trace, which stops once it has seen more than 2^20 distinct keys.
+//
+// lru-mrc estimates the hit ratios of lru for all capacities at once with a
+// MissRatioCurve, which is much faster on long traces. It tracks a RATE share
+// of the keys (1 by default, which is exact), and at most KEYS keys if given.
+#include "CacheImpl.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CACHES_SIM_MMAP
+#endif
+
+namespace {
+constexpr std::size_t MAX_DEFAULT_CAPACITY = 1 << 20;
+
+// The caches store views into the trace, which outlives them, so replaying
+// a record allocates nothing beyond the cache entry itself
+using Key = std::string_view;
+using SimulatedCache = CacheImpl::Cache<Key, char>;
+
+// The contents of a trace file, memory-mapped where possible so that traces
+// larger than the memory are paged in as the replay reaches them
+class TraceFile {
+private:
+  const char *m_data;
+  std::size_t m_size;
+#ifdef CACHES_SIM_MMAP
+  void *m_mapping;
+#else
+  std::string m_contents;
+#endif
+
+public:
+  explicit TraceFile(const char *path) : m_data(nullptr), m_size(0) {
+#ifdef CACHES_SIM_MMAP
+    m_mapping = nullptr;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error(std::string("Cannot open ") + path);
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+      close(fd);
+      throw std::runtime_error(std::string("Cannot read ") + path);
+    }
+    m_size = static_cast<std::size_t>(status.st_size);
+    if (m_size > 0) {
+      m_mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m_mapping == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error(std::string("Cannot map ") + path);
+      }
+      // The replay reads the trace once from start to end
+      madvise(m_mapping, m_size, MADV_SEQUENTIAL);
+      m_data = static_cast<const char *>(m_mapping);
+    }
+    close(fd);
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      throw std::runtime_error(std::string("Cannot open ") + path);
+    }
+    m_contents.assign(std::istreambuf_iterator<char>(file),
+                      std::istreambuf_iterator<char>());
+    m_data = m_contents.data();
+    m_size = m_contents.size();
+#endif
+  }
+
+  TraceFile(const TraceFile &) = delete;
+
+  TraceFile &operator=(const TraceFile &) = delete;
+
+  ~TraceFile() {
+#ifdef CACHES_SIM_MMAP
+    if (m_mapping != nullptr) {
+      munmap(m_mapping, m_size);
+    }
+#endif
+  }
+
+  // Calls 'function' with the key of every record, in order, until it
+  // returns false
+  template <typename Function> void forEachKey(Function &&function) const {
+    const char *end = m_data + m_size;
+    for (const char *line = m_data; line < end;) {
+      const char *key = line;
+      while (line < end && *line != '\n' && *line != '\r' && *line != ',' &&
+             *line != ' ' && *line != '\t') {
+        ++line;
+      }
+      if (line > key &&
+          !function(Key(key, static_cast<std::size_t>(line - key)))) {
+        return;
+      }
+      // Skip the other columns and the line break
+      while (line < end && *line != '\n') {
+        ++line;
+      }
+      if (line < end) {
+        ++line;
+      }
+    }
+  }
+};
+
+std::unique_ptr<SimulatedCache> makeCache(const std::string &policy,
+                                          std::size_t capacity) {
+  if (policy == "filo") {
+    return std::make_unique<CacheImpl::FILOCache<Key, char>>(capacity);
+  }
+  if (policy == "fifo") {
+    return std::make_unique<CacheImpl::FIFOCache<Key, char>>(capacity);
+  }
+  if (policy == "s3fifo") {
+    return std::make_unique<CacheImpl::S3FIFOCache<Key, char>>(capacity);
+  }
+  if (policy == "lfu") {
+    return std::make_unique<CacheImpl::LFUCache<Key, char>>(capacity);
+  }
+  if (policy == "lru") {
+    return std::make_unique<CacheImpl::LRUCache<Key, char>>(capacity);
+  }
+  if (policy == "slru") {
+    return std::make_unique<CacheImpl::SLRUCache<Key, char>>(capacity);
+  }
+  if (policy == "tinylfu") {
+    return std::make_unique<CacheImpl::TinyLFUCache<Key, char>>(capacity);
+  }
+  if (policy == "arc") {
+    return std::make_unique<CacheImpl::ARCCache<Key, char>>(capacity);
+  }
+  throw std::invalid_argument("Unknown policy " + policy);
+}
+
+std::vector<std::string> splitList(const std::string &list) {
+  std::vector<std::string> items;
+  std::size_t start = 0;
+  while (start <= list.size()) {
+    std::size_t comma = list.find(',', start);
+    if (comma == std::string::npos) {
+      comma = list.size();
+    }
+    if (comma > start) {
+      items.push_back(list.substr(start, comma - start));
+    }
+    start = comma + 1;
+  }
+  return items;
+}
+
+int usage() {
+  std::fprintf(stderr,
+               "usage: caches_sim [-p POLICIES] [-c CAPACITIES] "
+               "[-r RATE] [-k KEYS] TRACE\n"
+               "policies: filo,fifo,s3fifo,lfu,lru,slru,tinylfu,arc,lru-mrc\n");
+  return 2;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  std::vector<std::string> policies = {"filo", "fifo",    "s3fifo", "lfu",
+                                       "lru",  "slru",    "tinylfu", "arc"};
+  std::vector<std::size_t> capacities;
+  double samplingRate = 1.0;
+  std::size_t maxKeys = 0;
+  const char *path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    std::string argument = argv[i];
+    if (argument == "-r" && i + 1 < argc) {
+      samplingRate = std::strtod(argv[++i], nullptr);
+    } else if (argument == "-k" && i + 1 < argc) {
+      maxKeys = std::strtoull(argv[++i], nullptr, 10);
+    } else if ((argument == "-p" || argument == "-c") && i + 1 < argc) {
+      auto items = splitList(argv[++i]);
+      if (argument == "-p") {
+        policies = items;
+      } else {
+        for (const auto &item : items) {
+          capacities.push_back(std::strtoull(item.c_str(), nullptr, 10));
+        }
+      }
+    } else if (path == nullptr && argument[0] != '-') {
+      path = argv[i];
+    } else {
+      return usage();
+    }
+  }
+  if (path == nullptr || policies.empty()) {
+    return usage();
+  }
+
+  try {
+    TraceFile trace(path);
+    if (capacities.empty()) {
+      // Beyond the largest default capacity, the number of keys no longer
+      // matters, so the set never holds more than one key over it
+      std::unordered_set<Key> keys;
+      trace.forEachKey([&keys](Key key) {
+        keys.insert(key);
+        return keys.size() <= MAX_DEFAULT_CAPACITY;
+      });
+      for (std::size_t capacity = 16; capacity <= MAX_DEFAULT_CAPACITY;
+           capacity *= 2) {
+        capacities.push_back(capacity);
+        if (capacity >= keys.size()) {
+          break;
+        }
+      }
+    }
+    // caches[p * capacities.size() + c] simulates policy p at capacity c,
+    // except for lru-mrc, which leaves its slots empty
+    std::vector<std::unique_ptr<SimulatedCache>> caches;
+    std::unique_ptr<CacheImpl::MissRatioCurve<Key>> curve;
+    for (const auto &policy : policies) {
+      for (std::size_t capacity : capacities) {
+        if (policy != "lru-mrc") {
+          caches.push_back(makeCache(policy, capacity));
+        } else {
+          caches.emplace_back();
+        }
+      }
+      if (policy == "lru-mrc") {
+        curve = std::make_unique<CacheImpl::MissRatioCurve<Key>>(samplingRate,
+                                                                 maxKeys);
+      }
+    }
+    std::vector<std::size_t> hits(caches.size(), 0);
+    std::size_t records = 0;
+    trace.forEachKey([&](Key key) {
+      ++records;
+      if (curve) {
+        curve->access(key);
+      }
+      for (std::size_t i = 0; i < caches.size(); ++i) {
+        if (!caches[i]) {
+          continue;
+        }
+        if (caches[i]->getPtr(key) != nullptr) {
+          ++hits[i];
+        } else {
+          caches[i]->put(key, 0);
+        }
+      }
+      return true;
+    });
+
+    std::printf("capacity");
+    for (const auto &policy : policies) {
+      std::printf(",%s", policy.c_str());
+    }
+    std::printf("\n");
+    for (std::size_t c = 0; c < capacities.size(); ++c) {
+      std::printf("%zu", capacities[c]);
+      for (std::size_t p = 0; p < policies.size(); ++p) {
+        std::size_t hitCount = hits[p * capacities.size() + c];
+        if (policies[p] == "lru-mrc") {
+          std::printf(",%.6f", curve->hitRatio(capacities[c]));
+        } else {
+          std::printf(",%.6f", records == 0
+                                   ? 0.0
+                                   : static_cast<double>(hitCount) /
+                                         static_cast<double>(records));
+        }
+      }
+      std::printf("\n");
+    }
+    std::fprintf(stderr, "%zu records\n", records);
+  } catch (const std::exception &error) {
+    std::fprintf(stderr, "caches_sim: %s\n", error.what());
+    return 1;
+  }
+  return 0;
+}
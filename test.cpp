@@ -6,8 +6,64 @@
 #endif
 
 #include "CacheImpl.hpp"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdlib>
+#include <limits>
 #include <memory>
+#include <memory_resource>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Counts heap allocations so that tests can check allocation-free paths
+static std::atomic<std::size_t> g_allocations(0);
+
+void *operator new(std::size_t size) {
+  ++g_allocations;
+  if (void *memory = std::malloc(size == 0 ? 1 : size)) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  ++g_allocations;
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+
+void operator delete(void *memory, std::size_t) noexcept { std::free(memory); }
+
+// Over-aligned blocks, such as those of std::pmr::new_delete_resource()
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  ++g_allocations;
+  std::size_t align = static_cast<std::size_t>(alignment);
+  std::size_t rounded = (size + align - 1) / align * align;
+  if (rounded == 0) {
+    rounded = align;
+  }
+  if (void *memory = std::aligned_alloc(align, rounded)) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+  std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t, std::align_val_t) noexcept {
+  std::free(memory);
+}
 
 struct custom_hash {
   static uint64_t splitmix64(uint64_t x) {
@@ -51,6 +107,34 @@ TEST_CASE("LFU Test 2 with integers as keys and zero capacity") {
   REQUIRE_THROWS_AS(cache.get(0), std::invalid_argument);
 }
 
+TEST_CASE("LFU Test 3 with frequency ties and recycled nodes") {
+  constexpr std::size_t CAPACITY = 3;
+  auto cache = CacheImpl::LFUCache<int, int>(CAPACITY);
+  cache.put(1, 1);
+  cache.put(2, 2);
+  cache.put(3, 3);
+  REQUIRE(cache.get(1) == 1);
+  REQUIRE(cache.get(1) == 1);
+  REQUIRE(cache.get(2) == 2);
+  REQUIRE(cache.get(3) == 3);
+  // 2 and 3 share the lowest frequency and 2 was used less recently
+  cache.put(4, 4);
+  REQUIRE_FALSE(cache.tryGet(2).has_value());
+  cache.put(5, 5); // evicts key 4, the only key with frequency 1
+  REQUIRE_FALSE(cache.tryGet(4).has_value());
+  std::size_t allocations = g_allocations;
+  for (int i = 0; i < 100; ++i) {
+    cache.getPtr(1 + i % 2 * 2);
+    cache.put(6 + i, i); // always evicts the newest key of frequency 1
+  }
+  REQUIRE(g_allocations == allocations);
+  REQUIRE(cache.get(1) == 1);
+  REQUIRE(cache.get(3) == 3);
+  REQUIRE(cache.get(105) == 99);
+  cache.clear();
+  REQUIRE_FALSE(cache.tryGet(1).has_value());
+}
+
 TEST_CASE("FIFO Test 1 with integers as keys") {
   constexpr std::size_t CAPACITY = 3;
   auto cache =
@@ -87,6 +171,67 @@ TEST_CASE("FIFO Test 2 with std::strings as keys") {
   REQUIRE(cache->get("fifth_item") == 0);
 }
 
+TEST_CASE("FIFO evicts in insertion order around erased entries") {
+  // Erasing leaves holes in the ring of entries, which the cache skips and
+  // closes; the keys it holds must match a plain list of them
+  constexpr std::size_t CAPACITY = 20;
+  CacheImpl::FIFOCache<int, int> cache(CAPACITY);
+  std::vector<int> expected;
+  std::mt19937 generator(7);
+  std::uniform_int_distribution<int> keys(0, 59);
+  for (int i = 0; i < 100000; ++i) {
+    int key = keys(generator);
+    auto found = std::find(expected.begin(), expected.end(), key);
+    if (i % 3 == 0) {
+      REQUIRE(cache.erase(key) == (found != expected.end()));
+      if (found != expected.end()) {
+        expected.erase(found);
+      }
+    } else {
+      cache.put(key, i);
+      if (found == expected.end()) {
+        if (expected.size() == CAPACITY) {
+          expected.erase(expected.begin());
+        }
+        expected.push_back(key);
+      }
+      REQUIRE(cache.get(key) == i);
+    }
+    if (i % 97 == 0) {
+      for (int other = 0; other < 60; ++other) {
+        REQUIRE(cache.contains(other) ==
+                (std::find(expected.begin(), expected.end(), other) !=
+                 expected.end()));
+      }
+    }
+  }
+  cache.clear();
+  REQUIRE_FALSE(cache.contains(expected.back()));
+  cache.put(1, 1);
+  REQUIRE(cache.get(1) == 1);
+}
+
+TEST_CASE("FIFO with a huge capacity grows its ring as it fills") {
+  // A capacity past the largest power of two must neither overflow the size
+  // of the ring nor make it up front
+  constexpr int COUNT = 200000;
+  for (std::size_t capacity : {std::numeric_limits<std::size_t>::max(),
+                               (std::numeric_limits<std::size_t>::max() >> 1) +
+                                   2}) {
+    CacheImpl::FIFOCache<int, int> cache(capacity);
+    for (int i = 0; i < COUNT; ++i) {
+      cache.put(i, i);
+    }
+    REQUIRE(cache.getWeight() == COUNT);
+    for (int i = 0; i < COUNT; ++i) {
+      REQUIRE(cache.get(i) == i);
+    }
+    cache.setCapacity(2);
+    REQUIRE(cache.getWeight() == 2);
+    REQUIRE(cache.get(COUNT - 1) == COUNT - 1);
+  }
+}
+
 TEST_CASE("FILO Test 1 with integers as keys") {
   constexpr std::size_t CAPACITY = 3;
   auto cache = CacheImpl::FILOCache<int, int>(CAPACITY);
@@ -102,6 +247,51 @@ TEST_CASE("FILO Test 1 with integers as keys") {
   REQUIRE(cache.get(1) == 2);
 }
 
+TEST_CASE("FILO evicts the newest entry around erased entries") {
+  // Erasing leaves holes in the stack of entries, which the cache drops and
+  // closes; the keys it holds must match a plain stack of them
+  constexpr std::size_t CAPACITY = 20;
+  CacheImpl::FILOCache<int, int> cache(CAPACITY);
+  std::vector<int> expected;
+  std::mt19937 generator(9);
+  std::uniform_int_distribution<int> keys(0, 59);
+  for (int i = 0; i < 100000; ++i) {
+    int key = keys(generator);
+    auto found = std::find(expected.begin(), expected.end(), key);
+    if (i % 3 == 0) {
+      REQUIRE(cache.erase(key) == (found != expected.end()));
+      if (found != expected.end()) {
+        expected.erase(found);
+      }
+    } else {
+      cache.put(key, i);
+      if (found == expected.end()) {
+        if (expected.size() == CAPACITY) {
+          expected.pop_back();
+        }
+        expected.push_back(key);
+      }
+      REQUIRE(cache.get(key) == i);
+    }
+    if (i % 97 == 0) {
+      for (int other = 0; other < 60; ++other) {
+        REQUIRE(cache.contains(other) ==
+                (std::find(expected.begin(), expected.end(), other) !=
+                 expected.end()));
+      }
+    }
+  }
+  // clear() keeps the storage of the stack, so refilling it only allocates
+  // the nodes of the hash map, which come back from its pool
+  cache.clear();
+  std::size_t allocations = g_allocations;
+  for (int i = 0; i < static_cast<int>(CAPACITY); ++i) {
+    cache.put(i, i);
+  }
+  REQUIRE(g_allocations == allocations);
+  REQUIRE(cache.get(0) == 0);
+}
+
 TEST_CASE("LRU Test 1 with integers as keys") {
   constexpr std::size_t CAPACITY = 2;
   auto cache = CacheImpl::LRUCache<int, int>(CAPACITY);
@@ -115,6 +305,1821 @@ TEST_CASE("LRU Test 1 with integers as keys") {
   REQUIRE(cache.get(3) == 3);
   REQUIRE(cache.get(4) == 4);
 }
+
+TEST_CASE("Non-throwing lookups on every policy") {
+  constexpr std::size_t CAPACITY = 2;
+  std::shared_ptr<CacheImpl::Cache<int, int>> caches[] = {
+      std::make_shared<CacheImpl::FILOCache<int, int>>(CAPACITY),
+      std::make_shared<CacheImpl::FIFOCache<int, int>>(CAPACITY),
+      std::make_shared<CacheImpl::LFUCache<int, int>>(CAPACITY),
+      std::make_shared<CacheImpl::LRUCache<int, int>>(CAPACITY)};
+  for (auto &cache : caches) {
+    cache->put(1, 10);
+    REQUIRE(cache->tryGet(1) == std::optional<int>(10));
+    REQUIRE_FALSE(cache->tryGet(2).has_value());
+    int value = 0;
+    REQUIRE(cache->tryGet(1, value));
+    REQUIRE(value == 10);
+    REQUIRE_FALSE(cache->tryGet(2, value));
+    REQUIRE(value == 10);
+    REQUIRE(cache->getPtr(2) == nullptr);
+    *cache->getPtr(1) = 11;
+    REQUIRE(cache->get(1) == 11);
+    REQUIRE_THROWS_AS(cache->get(2), std::invalid_argument);
+  }
+}
+
+// Batched calls must leave the cache in the same state as the equivalent
+// sequence of single calls
+template <typename CacheType> void checkBatchMatchesSequence() {
+  constexpr std::size_t CAPACITY = 20;
+  CacheType batched(CAPACITY), sequential(CAPACITY);
+  std::vector<int> keys, values;
+  for (int i = 0; i < 30; ++i) {
+    keys.push_back(i * 7 % 25);
+    values.push_back(i);
+  }
+  batched.putMany(keys.data(), values.data(), keys.size());
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    sequential.put(keys[i], values[i]);
+  }
+  std::vector<int> lookups = {3, 24, 3, 100, 0, 17, 17, 5, -1, 12, 9, 1,
+                              2,  4, 6, 8,   10, 11, 13, 14, 15, 16};
+  std::vector<std::optional<int>> results(lookups.size());
+  batched.getMany(lookups.data(), lookups.size(), results.data());
+  for (std::size_t i = 0; i < lookups.size(); ++i) {
+    REQUIRE(results[i] == sequential.tryGet(lookups[i]));
+  }
+  for (int key = 100; key < 110; ++key) {
+    batched.put(key, key);
+    sequential.put(key, key);
+  }
+  for (int key = 0; key < 110; ++key) {
+    REQUIRE(batched.tryGet(key) == sequential.tryGet(key));
+  }
+}
+
+TEST_CASE("Batched lookups and puts behave like single ones") {
+  checkBatchMatchesSequence<CacheImpl::FILOCache<int, int>>();
+  checkBatchMatchesSequence<CacheImpl::FIFOCache<int, int>>();
+  checkBatchMatchesSequence<CacheImpl::LFUCache<int, int>>();
+  checkBatchMatchesSequence<CacheImpl::LRUCache<int, int>>();
+  checkBatchMatchesSequence<CacheImpl::IntrusiveLRUCache<int, int>>();
+  // A cache without room stores nothing, as put() would
+  CacheImpl::IntrusiveLRUCache<int, int> empty(0);
+  int key = 1, value = 1;
+  empty.putMany(&key, &value, 1);
+  REQUIRE_FALSE(empty.contains(1));
+  REQUIRE(empty.getWeight() == 0);
+}
+
+TEST_CASE("Flat hash map behaves like std::unordered_map") {
+  CacheImpl::FlatHashMap<int, int> map;
+  std::unordered_map<int, int> reference;
+  REQUIRE(map.find(1) == map.end());
+  REQUIRE(map.erase(1) == 0);
+  std::mt19937 generator(7);
+  std::uniform_int_distribution<int> keys(0, 3000);
+  for (int i = 0; i < 100000; ++i) {
+    int key = keys(generator);
+    switch (i % 4) {
+    case 0:
+    case 1:
+      REQUIRE(map.emplace(key, i).second == reference.emplace(key, i).second);
+      break;
+    case 2:
+      REQUIRE(map.erase(key) == reference.erase(key));
+      break;
+    default:
+      auto iter = map.find(key);
+      REQUIRE((iter == map.end()) == (reference.count(key) == 0));
+      if (iter != map.end()) {
+        REQUIRE(iter->second == reference[key]);
+      }
+    }
+    REQUIRE(map.size() == reference.size());
+  }
+  std::size_t visited = 0;
+  for (const auto &element : map) {
+    REQUIRE(reference.at(element.first) == element.second);
+    ++visited;
+  }
+  REQUIRE(visited == reference.size());
+  // Replacing keys at a constant size leaves deleted slots behind until the
+  // map rehashes in place
+  std::vector<int> live;
+  for (const auto &element : reference) {
+    live.push_back(element.first);
+  }
+  for (int i = 0; i < 50000; ++i) {
+    int &key = live[static_cast<std::size_t>(i * 31) % live.size()];
+    REQUIRE(map.erase(key) == 1);
+    reference.erase(key);
+    key = 10000 + i;
+    REQUIRE(map.emplace(key, i).second);
+    reference.emplace(key, i);
+  }
+  for (const auto &element : reference) {
+    REQUIRE(map.find(element.first)->second == element.second);
+  }
+  auto copy = map;
+  map.clear();
+  REQUIRE(map.empty());
+  REQUIRE(map.find(keys(generator)) == map.end());
+  REQUIRE(copy.size() == reference.size());
+  for (const auto &element : reference) {
+    REQUIRE(copy[element.first] == element.second);
+  }
+}
+
+TEST_CASE("Flat hash map does not allocate below its reserved size") {
+  CacheImpl::FlatHashMap<std::string, int> map;
+  map.reserve(1000);
+  std::vector<std::string> keys;
+  for (int i = 0; i < 1000; ++i) {
+    keys.push_back(std::to_string(i));
+  }
+  std::size_t allocations = g_allocations;
+  for (int round = 0; round < 10; ++round) {
+    for (const auto &key : keys) {
+      map.emplace(key, round);
+    }
+    for (const auto &key : keys) {
+      map.erase(key);
+    }
+  }
+  REQUIRE(g_allocations == allocations);
+  REQUIRE(map.empty());
+}
+
+TEST_CASE("Policies work with the flat hash map as index") {
+  using Index = CacheImpl::FlatHashMapIndex;
+  checkBatchMatchesSequence<
+      CacheImpl::FILOCache<int, int, std::hash<int>, Index>>();
+  checkBatchMatchesSequence<
+      CacheImpl::FIFOCache<int, int, std::hash<int>, Index>>();
+  checkBatchMatchesSequence<
+      CacheImpl::LFUCache<int, int, std::hash<int>, std::hash<int>, Index>>();
+  checkBatchMatchesSequence<
+      CacheImpl::LRUCache<int, int, std::hash<int>, Index>>();
+  CacheImpl::LRUCache<std::string, int, std::hash<std::string>, Index> lru(2);
+  lru.put("first_item", 1);
+  lru.put("second_item", 2);
+  REQUIRE(lru.get("first_item") == 1);
+  lru.put("third_item", 3); // evicts "second_item"
+  REQUIRE_THROWS_AS(lru.get("second_item"), std::invalid_argument);
+  CacheImpl::LFUCache<int, int, custom_hash, custom_hash, Index> lfu(100);
+  for (int i = 0; i < 1000; ++i) {
+    lfu.put(i, i);
+  }
+  std::size_t allocations = g_allocations;
+  for (int i = 1000; i < 10000; ++i) {
+    lfu.put(i, i);
+    lfu.getPtr(i / 2);
+  }
+  REQUIRE(g_allocations == allocations);
+}
+
+TEST_CASE("String keys are looked up without temporaries") {
+  using Index = CacheImpl::FlatHashMapIndex;
+  // Keys longer than the small string buffer, so a temporary would allocate
+  const char *first = "a key too long for the small string buffer #1";
+  const char *second = "a key too long for the small string buffer #2";
+  CacheImpl::FIFOCache<std::string, int, CacheImpl::StringHash, Index> fifo(2);
+  CacheImpl::LRUCache<std::string, int, CacheImpl::StringHash, Index> lru(2);
+  CacheImpl::IntrusiveLRUCache<std::string, int, CacheImpl::StringHash>
+      intrusive(2);
+  fifo.put(first, 1);
+  lru.put(first, 1);
+  intrusive.put(first, 1);
+  std::size_t allocations = g_allocations;
+  REQUIRE(fifo.get(first) == 1);
+  REQUIRE(lru.get(std::string_view(first)) == 1);
+  REQUIRE(*intrusive.tryGet(first) == 1);
+  REQUIRE(fifo.contains(std::string_view(first)));
+  REQUIRE_FALSE(lru.contains(second));
+  REQUIRE_FALSE(intrusive.contains(second));
+  REQUIRE_FALSE(fifo.tryGet(second));
+  REQUIRE(lru.erase(first));
+  REQUIRE(intrusive.erase(std::string_view(first)));
+  REQUIRE(g_allocations == allocations);
+  REQUIRE_FALSE(lru.contains(first));
+  REQUIRE_FALSE(intrusive.contains(first));
+  // Without a transparent hash the key is converted, with the same results
+  CacheImpl::LRUCache<std::string, int> plain(2);
+  plain.put(first, 1);
+  REQUIRE(plain.get(std::string_view(first)) == 1);
+  REQUIRE(plain.erase(first));
+  REQUIRE_FALSE(plain.contains(first));
+}
+
+TEST_CASE("contains and erase on every policy") {
+  std::vector<std::shared_ptr<CacheImpl::Cache<int, int>>> caches = {
+      std::make_shared<CacheImpl::FILOCache<int, int>>(3),
+      std::make_shared<CacheImpl::FIFOCache<int, int>>(3),
+      std::make_shared<CacheImpl::S3FIFOCache<int, int>>(3),
+      std::make_shared<CacheImpl::LFUCache<int, int>>(3),
+      std::make_shared<CacheImpl::LRUCache<int, int>>(3),
+      std::make_shared<CacheImpl::IntrusiveLRUCache<int, int>>(3),
+      std::make_shared<CacheImpl::SLRUCache<int, int>>(3),
+      std::make_shared<CacheImpl::ARCCache<int, int>>(3),
+      std::make_shared<CacheImpl::LRUCache<int, int, std::hash<int>,
+                                           CacheImpl::FlatHashMapIndex>>(3)};
+  for (auto &cache : caches) {
+    cache->put(1, 1);
+    cache->put(2, 2);
+    cache->put(3, 3);
+    REQUIRE(cache->contains(2));
+    REQUIRE(cache->erase(2));
+    REQUIRE_FALSE(cache->erase(2));
+    REQUIRE_FALSE(cache->contains(2));
+    REQUIRE_FALSE(cache->tryGet(2));
+    // The erased entry leaves room for another one without evicting
+    cache->put(4, 4);
+    REQUIRE(cache->contains(1));
+    REQUIRE(cache->contains(3));
+    REQUIRE(cache->get(4) == 4);
+    cache->put(5, 5);
+    REQUIRE_FALSE((cache->contains(5) && cache->contains(1) &&
+                   cache->contains(3) && cache->contains(4)));
+  }
+  // contains() is not an access, so it does not protect an entry
+  CacheImpl::LFUCache<int, int> lfu(2);
+  lfu.put(1, 1);
+  lfu.put(2, 2);
+  lfu.get(1);
+  for (int i = 0; i < 10; ++i) {
+    REQUIRE(lfu.contains(2));
+  }
+  lfu.put(3, 3);
+  REQUIRE_FALSE(lfu.contains(2));
+  CacheImpl::ClockCache<int, int> clock(2);
+  clock.put(1, 1);
+  clock.put(2, 2);
+  REQUIRE(clock.erase(1));
+  REQUIRE_FALSE(clock.contains(1));
+  clock.put(3, 3);
+  REQUIRE(clock.contains(2));
+  REQUIRE(clock.contains(3));
+  clock.put(4, 4);
+  REQUIRE(clock.contains(4));
+  CacheImpl::ShardedCache<CacheImpl::LRUCache, int, int> sharded(16, 4);
+  sharded.put(1, 1);
+  REQUIRE(sharded.contains(1));
+  REQUIRE(sharded.erase(1));
+  REQUIRE_FALSE(sharded.contains(1));
+}
+
+TEST_CASE("setCapacity evicts in policy order when shrinking") {
+  auto fill = [](CacheImpl::Cache<int, int> &cache) {
+    for (int i = 1; i <= 4; ++i) {
+      cache.put(i, i);
+    }
+  };
+  auto residents = [](CacheImpl::Cache<int, int> &cache) {
+    std::vector<int> keys;
+    for (int i = 1; i <= 4; ++i) {
+      if (cache.contains(i)) {
+        keys.push_back(i);
+      }
+    }
+    return keys;
+  };
+  CacheImpl::FILOCache<int, int> filo(4);
+  fill(filo);
+  filo.setCapacity(2);
+  REQUIRE(residents(filo) == std::vector<int>{1, 2});
+  CacheImpl::FIFOCache<int, int> fifo(4);
+  fill(fifo);
+  fifo.setCapacity(2);
+  REQUIRE(residents(fifo) == std::vector<int>{3, 4});
+  CacheImpl::LRUCache<int, int> lru(4);
+  CacheImpl::IntrusiveLRUCache<int, int> intrusive(4);
+  for (CacheImpl::Cache<int, int> *cache :
+       {static_cast<CacheImpl::Cache<int, int> *>(&lru),
+        static_cast<CacheImpl::Cache<int, int> *>(&intrusive)}) {
+    fill(*cache);
+    cache->get(1);
+    cache->setCapacity(2);
+    REQUIRE(cache->getCapacity() == 2);
+    REQUIRE(residents(*cache) == std::vector<int>{1, 4});
+    cache->put(5, 5); // evicts key 4
+    REQUIRE(residents(*cache) == std::vector<int>{1});
+    cache->setCapacity(0);
+    REQUIRE_FALSE(cache->contains(1));
+  }
+  CacheImpl::LFUCache<int, int> lfu(4);
+  fill(lfu);
+  lfu.get(1);
+  lfu.get(1);
+  lfu.get(3);
+  lfu.setCapacity(2);
+  REQUIRE(residents(lfu) == std::vector<int>{1, 3});
+  lfu.put(5, 5); // evicts key 3, the only key with frequency 2
+  REQUIRE(residents(lfu) == std::vector<int>{1});
+  REQUIRE(lfu.get(5) == 5);
+  CacheImpl::ClockCache<int, int> clock(4);
+  for (int i = 1; i <= 4; ++i) {
+    clock.put(i, i);
+  }
+  clock.get(1);
+  clock.setCapacity(2); // the hand spares key 1 and evicts keys 2 and 3
+  REQUIRE(clock.getCapacity() == 2);
+  REQUIRE(clock.contains(1));
+  REQUIRE(clock.contains(4));
+  clock.setCapacity(8);
+  for (int i = 5; i <= 10; ++i) {
+    clock.put(i, i);
+  }
+  for (int i : {1, 4, 5, 6, 7, 8, 9, 10}) {
+    REQUIRE(clock.get(i) == i);
+  }
+  CacheImpl::ShardedCache<CacheImpl::LRUCache, int, int> sharded(8, 2);
+  for (int i = 0; i < 8; ++i) {
+    sharded.put(i, i);
+  }
+  sharded.setCapacity(2);
+  REQUIRE(sharded.getCapacity() == 2);
+  int count = 0;
+  for (int i = 0; i < 8; ++i) {
+    count += sharded.contains(i) ? 1 : 0;
+  }
+  REQUIRE(count <= 2);
+}
+
+TEST_CASE("setCapacity reserves room when growing") {
+  using Index = CacheImpl::FlatHashMapIndex;
+  // With the index sized up front and the node pool told the capacity,
+  // filling the cache allocates a single chunk of nodes
+  CacheImpl::LRUCache<int, int, std::hash<int>, Index> constructed(1000);
+  CacheImpl::LRUCache<int, int, std::hash<int>, Index> grown(10);
+  grown.setCapacity(1000);
+  for (auto *cache : {&constructed, &grown}) {
+    std::size_t allocations = g_allocations;
+    for (int i = 0; i < 1000; ++i) {
+      cache->put(i, i);
+    }
+    REQUIRE(g_allocations - allocations == 1);
+    REQUIRE(cache->get(0) == 0);
+  }
+  // IntrusiveLRUCache also reserves the storage of the entries
+  CacheImpl::IntrusiveLRUCache<int, int> intrusive(10);
+  for (int i = 0; i < 7; ++i) {
+    intrusive.put(i, i);
+  }
+  intrusive.setCapacity(1000);
+  std::size_t allocations = g_allocations;
+  for (int i = 7; i < 1000; ++i) {
+    intrusive.put(i, i);
+  }
+  REQUIRE(g_allocations == allocations);
+  for (int i = 0; i < 1000; ++i) {
+    REQUIRE(intrusive.get(i) == i);
+  }
+}
+
+// A cache that is never full reserves only a bounded amount up front, and
+// grows as the entries come
+template <typename CacheType> void checkUnboundedCapacity() {
+  constexpr std::size_t UNBOUNDED = std::numeric_limits<std::size_t>::max();
+  CacheType cache(UNBOUNDED);
+  REQUIRE(cache.getCapacity() == UNBOUNDED);
+  for (int i = 0; i < 1000; ++i) {
+    cache.put(i, i);
+  }
+  for (int i = 0; i < 1000; ++i) {
+    REQUIRE(cache.get(i) == i);
+  }
+  CacheType grown(10);
+  grown.setCapacity(UNBOUNDED);
+  for (int i = 0; i < 1000; ++i) {
+    grown.put(i, i);
+  }
+  REQUIRE(grown.contains(0));
+  REQUIRE(grown.contains(999));
+}
+
+TEST_CASE("Caches with an unbounded capacity reserve a bounded amount") {
+  checkUnboundedCapacity<CacheImpl::FILOCache<int, int>>();
+  checkUnboundedCapacity<CacheImpl::FIFOCache<int, int>>();
+  checkUnboundedCapacity<CacheImpl::S3FIFOCache<int, int>>();
+  checkUnboundedCapacity<CacheImpl::LFUCache<int, int>>();
+  checkUnboundedCapacity<CacheImpl::LRUCache<int, int>>();
+  checkUnboundedCapacity<CacheImpl::SLRUCache<int, int>>();
+  checkUnboundedCapacity<CacheImpl::ARCCache<int, int>>();
+  checkUnboundedCapacity<CacheImpl::IntrusiveLRUCache<int, int>>();
+  checkUnboundedCapacity<CacheImpl::TinyLFUCache<int, int>>();
+  checkUnboundedCapacity<CacheImpl::ClockCache<int, int>>();
+  checkUnboundedCapacity<
+      CacheImpl::ShardedCache<CacheImpl::LRUCache, int, int>>();
+  checkUnboundedCapacity<
+      CacheImpl::ExpiringCache<CacheImpl::LRUCache, int, int>>();
+}
+
+// Weighs an entry by the length of its value
+struct LengthWeigher {
+  std::size_t operator()(int, const std::string &value) const {
+    return value.size();
+  }
+};
+
+template <typename K, typename V, typename Hash>
+using WeightedLRUCache =
+    CacheImpl::LRUCache<K, V, Hash, CacheImpl::UnorderedMapIndex,
+                        LengthWeigher>;
+
+TEST_CASE("Weighers turn the capacity into a byte budget") {
+  using Index = CacheImpl::UnorderedMapIndex;
+  using Hash = std::hash<int>;
+  std::vector<std::shared_ptr<CacheImpl::Cache<int, std::string>>> caches = {
+      std::make_shared<
+          CacheImpl::FILOCache<int, std::string, Hash, Index, LengthWeigher>>(
+          1000),
+      std::make_shared<
+          CacheImpl::FIFOCache<int, std::string, Hash, Index, LengthWeigher>>(
+          1000),
+      std::make_shared<CacheImpl::S3FIFOCache<int, std::string, Hash, Index,
+                                              LengthWeigher>>(1000),
+      std::make_shared<CacheImpl::LFUCache<int, std::string, Hash, Hash, Index,
+                                           LengthWeigher>>(1000),
+      std::make_shared<WeightedLRUCache<int, std::string, Hash>>(1000),
+      std::make_shared<
+          CacheImpl::SLRUCache<int, std::string, Hash, Index, LengthWeigher>>(
+          1000),
+      std::make_shared<
+          CacheImpl::ARCCache<int, std::string, Hash, Index, LengthWeigher>>(
+          1000),
+      std::make_shared<CacheImpl::TinyLFUCache<int, std::string, Hash, Index,
+                                               LengthWeigher>>(1000),
+      std::make_shared<
+          CacheImpl::IntrusiveLRUCache<int, std::string, Hash, LengthWeigher>>(
+          1000)};
+  for (auto &cache : caches) {
+    // One heavy entry pushes out as many light ones as it needs
+    for (int i = 0; i < 10; ++i) {
+      cache->put(i, std::string(100, 'a'));
+    }
+    // TinyLFU may turn away the last entry for the ones it has seen as often
+    REQUIRE(cache->getWeight() >= 900);
+    REQUIRE(cache->getWeight() <= 1000);
+    cache->put(10, std::string(450, 'b'));
+    REQUIRE(cache->getWeight() <= 1000);
+    REQUIRE(cache->getWeight() >= 900);
+    // An entry heavier than the whole cache is not cached, and drops the old
+    // value of its key
+    cache->put(11, std::string(1001, 'c'));
+    REQUIRE_FALSE(cache->contains(11));
+    cache->put(10, std::string(1001, 'c'));
+    REQUIRE_FALSE(cache->contains(10));
+    std::mt19937 generator(11);
+    std::uniform_int_distribution<int> keys(0, 99);
+    std::uniform_int_distribution<std::size_t> lengths(1, 300);
+    for (int i = 0; i < 20000; ++i) {
+      int key = keys(generator);
+      if (i % 5 == 0) {
+        cache->erase(key);
+      } else if (cache->getPtr(key) == nullptr || i % 3 == 0) {
+        cache->put(key, std::string(lengths(generator), 'd'));
+      }
+      REQUIRE(cache->getWeight() <= 1000);
+    }
+    // The accounting matches the entries left
+    std::size_t weight = 0;
+    for (int key = 0; key < 100; ++key) {
+      if (cache->contains(key)) {
+        weight += cache->get(key).size();
+      }
+    }
+    REQUIRE(cache->getWeight() == weight);
+    cache->setCapacity(200);
+    REQUIRE(cache->getWeight() <= 200);
+    cache->clear();
+    REQUIRE(cache->getWeight() == 0);
+  }
+  // Under the default weigher, the weight counts the entries
+  CacheImpl::LRUCache<int, int> counted(3);
+  for (int i = 0; i < 5; ++i) {
+    counted.put(i, i);
+  }
+  REQUIRE(counted.getWeight() == 3);
+  CacheImpl::ClockCache<int, std::string, Hash, LengthWeigher> clock(1000);
+  CacheImpl::ShardedCache<WeightedLRUCache, int, std::string> sharded(4000, 4);
+  for (int i = 0; i < 1000; ++i) {
+    clock.put(i, std::string(i % 200 + 1, 'e'));
+    sharded.put(i, std::string(i % 200 + 1, 'e'));
+    REQUIRE(clock.getWeight() <= 1000);
+  }
+  REQUIRE(clock.tryGet(999) == std::string(200, 'e'));
+  REQUIRE(sharded.getWeight() <= 4000);
+  REQUIRE(sharded.getWeight() > 2000);
+  clock.setCapacity(100);
+  REQUIRE(clock.getWeight() <= 100);
+}
+
+// A weighted cache that was moved from weighs nothing, and fills up to its
+// capacity again without being cleared
+template <typename CacheType> void checkWeightAfterMove() {
+  CacheType original(1000);
+  for (int i = 0; i < 10; ++i) {
+    original.put(i, std::string(100, 'a'));
+  }
+  CacheType moved(std::move(original));
+  REQUIRE(original.getWeight() == 0);
+  REQUIRE(moved.getWeight() >= 900);
+  for (int i = 0; i < 20; ++i) {
+    original.put(i, std::string(100, 'b'));
+    REQUIRE(original.getWeight() <= 1000);
+  }
+  REQUIRE(original.getWeight() >= 900);
+  CacheType assigned(1000);
+  assigned = std::move(moved);
+  REQUIRE(moved.getWeight() == 0);
+  for (int i = 0; i < 20; ++i) {
+    moved.put(i, std::string(100, 'c'));
+    REQUIRE(moved.getWeight() <= 1000);
+  }
+  REQUIRE(moved.getWeight() >= 900);
+  REQUIRE(assigned.getWeight() >= 900);
+}
+
+TEST_CASE("Weighted caches moved from take new entries") {
+  using Index = CacheImpl::UnorderedMapIndex;
+  using Hash = std::hash<int>;
+  checkWeightAfterMove<
+      CacheImpl::LFUCache<int, std::string, Hash, Hash, Index, LengthWeigher>>();
+  checkWeightAfterMove<WeightedLRUCache<int, std::string, Hash>>();
+  checkWeightAfterMove<
+      CacheImpl::SLRUCache<int, std::string, Hash, Index, LengthWeigher>>();
+  checkWeightAfterMove<
+      CacheImpl::ARCCache<int, std::string, Hash, Index, LengthWeigher>>();
+  checkWeightAfterMove<CacheImpl::TinyLFUCache<int, std::string, Hash, Index,
+                                               LengthWeigher>>();
+}
+
+// A value that counts how often it is copied
+struct CopyCounted {
+  static inline int copies = 0;
+  int m_value;
+
+  explicit CopyCounted(int value = 0) : m_value(value) {}
+
+  CopyCounted(int first, int second) : m_value(first + second) {}
+
+  CopyCounted(const CopyCounted &other) : m_value(other.m_value) { ++copies; }
+
+  CopyCounted(CopyCounted &&other) = default;
+
+  CopyCounted &operator=(const CopyCounted &other) {
+    m_value = other.m_value;
+    ++copies;
+    return *this;
+  }
+
+  CopyCounted &operator=(CopyCounted &&other) = default;
+};
+
+template <typename CacheType> void checkMovesAndEmplace() {
+  CacheType cache(2);
+  CopyCounted::copies = 0;
+  cache.put(1, CopyCounted(1));
+  CopyCounted value(2);
+  cache.put(2, std::move(value));
+  // A new key is constructed in place, and an update assigns a new value
+  cache.emplace(3, 1, 2);
+  cache.emplace(3, 4, 5);
+  REQUIRE_FALSE(cache.tryEmplace(3, 100, 0));
+  REQUIRE(cache.contains(3));
+  REQUIRE(CopyCounted::copies == 0);
+  REQUIRE(cache.get(3).m_value == 9);
+  // Only a put() of an lvalue copies
+  cache.put(3, value);
+  REQUIRE(CopyCounted::copies == 2);
+}
+
+TEST_CASE("put() moves values and emplace() builds them in place") {
+  using Value = CopyCounted;
+  checkMovesAndEmplace<CacheImpl::FILOCache<int, Value>>();
+  checkMovesAndEmplace<CacheImpl::FIFOCache<int, Value>>();
+  checkMovesAndEmplace<CacheImpl::S3FIFOCache<int, Value>>();
+  checkMovesAndEmplace<CacheImpl::LFUCache<int, Value>>();
+  checkMovesAndEmplace<CacheImpl::LRUCache<int, Value>>();
+  checkMovesAndEmplace<CacheImpl::SLRUCache<int, Value>>();
+  checkMovesAndEmplace<CacheImpl::ARCCache<int, Value>>();
+  checkMovesAndEmplace<CacheImpl::TinyLFUCache<int, Value>>();
+  checkMovesAndEmplace<CacheImpl::IntrusiveLRUCache<int, Value>>();
+  checkMovesAndEmplace<CacheImpl::ClockCache<int, Value>>();
+  checkMovesAndEmplace<CacheImpl::ShardedCache<CacheImpl::LRUCache, int,
+                                               Value>>();
+  checkMovesAndEmplace<CacheImpl::ExpiringCache<CacheImpl::LRUCache, int,
+                                                Value>>();
+  // tryEmplace() does not construct a value for a cached key, and emplace()
+  // converts a key of another type once
+  CacheImpl::LRUCache<std::string, std::string> strings(2);
+  REQUIRE(strings.tryEmplace("key", 3, 'a'));
+  REQUIRE_FALSE(strings.tryEmplace("key", 3, 'b'));
+  REQUIRE(strings.get("key") == "aaa");
+  strings.emplace(std::string_view("other"), "value");
+  REQUIRE(strings.get("other") == "value");
+  // A weigher weighs the value before it is moved into place
+  WeightedLRUCache<int, std::string, std::hash<int>> weighted(10);
+  weighted.emplace(1, 6, 'a');
+  weighted.emplace(2, 4, 'b');
+  REQUIRE(weighted.getWeight() == 10);
+  weighted.emplace(3, 5, 'c');
+  REQUIRE_FALSE(weighted.contains(1));
+  REQUIRE(weighted.getWeight() == 9);
+  REQUIRE_FALSE(weighted.tryEmplace(2, 11, 'd'));
+  REQUIRE(weighted.tryEmplace(4, 11, 'd'));
+  REQUIRE_FALSE(weighted.contains(4));
+}
+
+// A value that counts its assignments, and whose construction from a negative
+// number throws
+struct Fragile {
+  static inline int assignments = 0;
+  int m_value;
+
+  explicit Fragile(int value) : m_value(value) {
+    if (value < 0) {
+      throw std::runtime_error("negative value");
+    }
+  }
+
+  Fragile(const Fragile &) = default;
+
+  Fragile(Fragile &&) noexcept = default;
+
+  Fragile &operator=(const Fragile &other) {
+    ++assignments;
+    m_value = other.m_value;
+    return *this;
+  }
+
+  Fragile &operator=(Fragile &&other) noexcept {
+    ++assignments;
+    m_value = other.m_value;
+    return *this;
+  }
+};
+
+TEST_CASE("Recycled entries are built in place") {
+  CacheImpl::IntrusiveLRUCache<int, Fragile> intrusive(2);
+  CacheImpl::LFUCache<int, Fragile> lfu(2);
+  Fragile::assignments = 0;
+  for (int i = 0; i < 10; ++i) {
+    intrusive.emplace(i, i);
+    lfu.put(i, Fragile(i));
+  }
+  REQUIRE(Fragile::assignments == 0);
+  // A construction that throws loses the entry that was to be recycled, and
+  // leaves the rest of the cache as it was
+  REQUIRE_THROWS_AS(intrusive.emplace(10, -1), std::runtime_error);
+  REQUIRE_FALSE(intrusive.contains(10));
+  REQUIRE_FALSE(intrusive.contains(8));
+  REQUIRE(intrusive.get(9).m_value == 9);
+  REQUIRE(intrusive.getWeight() == 1);
+  intrusive.emplace(11, 11);
+  intrusive.emplace(12, 12);
+  REQUIRE(intrusive.contains(11));
+  REQUIRE(intrusive.contains(12));
+  REQUIRE_THROWS_AS(lfu.emplace(10, -1), std::runtime_error);
+  REQUIRE_FALSE(lfu.contains(10));
+  REQUIRE(lfu.get(9).m_value == 9);
+  lfu.put(11, Fragile(11));
+  REQUIRE(lfu.getWeight() == 2);
+}
+
+// Replays the same accesses on a policy used directly and on the same policy
+// behind the virtual Cache<K, V> interface, which must agree on every hit
+template <typename BasicType, typename VirtualType> void checkSameAsVirtual() {
+  static_assert(!std::is_polymorphic<BasicType>::value,
+                "a policy used directly has no vtable");
+  static_assert(std::is_base_of<BasicType, VirtualType>::value,
+                "the virtual cache adapts the policy");
+  BasicType direct(64);
+  VirtualType adapted(64);
+  CacheImpl::Cache<int, int> &base = adapted;
+  std::mt19937 generator(7);
+  std::uniform_int_distribution<int> distribution(0, 127);
+  for (int i = 0; i < 10000; ++i) {
+    int key = distribution(generator);
+    int *hit = direct.getPtr(key);
+    int *virtualHit = base.getPtr(key);
+    REQUIRE((hit == nullptr) == (virtualHit == nullptr));
+    if (hit == nullptr) {
+      direct.put(key, i);
+      base.put(key, i);
+    } else {
+      REQUIRE(*hit == *virtualHit);
+    }
+  }
+  REQUIRE(direct.getWeight() == base.getWeight());
+  direct.setCapacity(16);
+  base.setCapacity(16);
+  REQUIRE(base.getCapacity() == 16);
+  REQUIRE(adapted.getCapacity() == 16);
+  REQUIRE(direct.getWeight() == base.getWeight());
+}
+
+TEST_CASE("Policies used directly match their virtual adapters") {
+  using namespace CacheImpl;
+  checkSameAsVirtual<BasicFILOCache<int, int>, FILOCache<int, int>>();
+  checkSameAsVirtual<BasicFIFOCache<int, int>, FIFOCache<int, int>>();
+  checkSameAsVirtual<BasicS3FIFOCache<int, int>, S3FIFOCache<int, int>>();
+  checkSameAsVirtual<BasicLFUCache<int, int>, LFUCache<int, int>>();
+  checkSameAsVirtual<BasicLRUCache<int, int>, LRUCache<int, int>>();
+  checkSameAsVirtual<BasicSLRUCache<int, int>, SLRUCache<int, int>>();
+  checkSameAsVirtual<BasicARCCache<int, int>, ARCCache<int, int>>();
+  checkSameAsVirtual<BasicTinyLFUCache<int, int>, TinyLFUCache<int, int>>();
+  checkSameAsVirtual<BasicIntrusiveLRUCache<int, int>,
+                     IntrusiveLRUCache<int, int>>();
+  checkSameAsVirtual<BasicExpiringCache<LRUCache, int, int>,
+                     ExpiringCache<LRUCache, int, int>>();
+  // The policy-specific methods stay available through the adapter
+  SLRUCache<int, int> segmented(10, 0.5);
+  REQUIRE(segmented.getProtectedRatio() == 0.5);
+  BasicLRUCache<std::string, int> strings(2);
+  strings.put("key", 1);
+  REQUIRE(strings.get(std::string_view("key")) == 1);
+}
+
+// Allocates with malloc rather than the counted operator new, and counts the
+// blocks it holds
+template <typename T> struct MallocAllocator {
+  using value_type = T;
+  std::size_t *m_blocks;
+
+  explicit MallocAllocator(std::size_t *blocks) : m_blocks(blocks) {}
+
+  template <typename U>
+  MallocAllocator(const MallocAllocator<U> &other) : m_blocks(other.m_blocks) {}
+
+  T *allocate(std::size_t count) {
+    ++*m_blocks;
+    return static_cast<T *>(std::malloc(count * sizeof(T)));
+  }
+
+  void deallocate(T *memory, std::size_t) {
+    --*m_blocks;
+    std::free(memory);
+  }
+
+  friend bool operator==(const MallocAllocator &lhs,
+                         const MallocAllocator &rhs) {
+    return lhs.m_blocks == rhs.m_blocks;
+  }
+
+  friend bool operator!=(const MallocAllocator &lhs,
+                         const MallocAllocator &rhs) {
+    return lhs.m_blocks != rhs.m_blocks;
+  }
+};
+
+using IntAllocator = MallocAllocator<std::pair<const int, int>>;
+
+// All of the memory of the cache must come from its allocator. 'args' are
+// the constructor arguments between the capacity and the allocator
+template <typename CacheType, typename... Args>
+void checkAllocatorIsUsed(Args... args) {
+  std::size_t blocks = 0;
+  std::size_t allocations = g_allocations;
+  {
+    CacheType cache(16, args..., IntAllocator(&blocks));
+    for (int i = 0; i < 100; ++i) {
+      cache.put(i, i);
+      cache.getPtr(i - i % 3);
+    }
+    cache.erase(99);
+    cache.put(200, 200);
+    REQUIRE(cache.get(200) == 200);
+    REQUIRE(blocks > 0);
+    cache.clear();
+    cache.put(1, 1);
+  }
+  REQUIRE(blocks == 0);
+  REQUIRE(g_allocations == allocations);
+}
+
+TEST_CASE("Caches allocate through their allocator") {
+  using namespace CacheImpl;
+  checkAllocatorIsUsed<FILOCache<int, int, std::hash<int>, UnorderedMapIndex,
+                                 UnitWeigher, IntAllocator>>();
+  checkAllocatorIsUsed<FIFOCache<int, int, std::hash<int>, UnorderedMapIndex,
+                                 UnitWeigher, IntAllocator>>();
+  checkAllocatorIsUsed<LFUCache<int, int, std::hash<int>, std::hash<int>,
+                                UnorderedMapIndex, UnitWeigher,
+                                IntAllocator>>();
+  checkAllocatorIsUsed<LRUCache<int, int, std::hash<int>, UnorderedMapIndex,
+                                UnitWeigher, IntAllocator>>();
+  checkAllocatorIsUsed<BasicLRUCache<int, int, std::hash<int>, FlatHashMapIndex,
+                                     UnitWeigher, IntAllocator>>();
+  checkAllocatorIsUsed<BasicLFUCache<int, int, std::hash<int>, std::hash<int>,
+                                     FlatHashMapIndex, UnitWeigher,
+                                     IntAllocator>>();
+  checkAllocatorIsUsed<SLRUCache<int, int, std::hash<int>, UnorderedMapIndex,
+                                 UnitWeigher, IntAllocator>>(0.8);
+  checkAllocatorIsUsed<ARCCache<int, int, std::hash<int>, UnorderedMapIndex,
+                                UnitWeigher, IntAllocator>>();
+}
+
+// Once a default-constructed cache has been full for a while, put() reuses
+// the nodes it evicts and never goes to the heap
+template <typename CacheType> void checkSteadyStateDoesNotAllocate() {
+  constexpr std::size_t CAPACITY = 100;
+  CacheType cache(CAPACITY);
+  std::mt19937 generator(3);
+  std::uniform_int_distribution<int> keys(0, 4 * CAPACITY);
+  auto access = [&]() {
+    int key = keys(generator);
+    if (!cache.tryGet(key)) {
+      cache.put(key, key);
+    }
+  };
+  for (std::size_t i = 0; i < 1000 * CAPACITY; ++i) {
+    access();
+  }
+  std::size_t allocations = g_allocations;
+  for (std::size_t i = 0; i < 100 * CAPACITY; ++i) {
+    access();
+  }
+  REQUIRE(g_allocations == allocations);
+  REQUIRE(cache.getWeight() == CAPACITY);
+}
+
+TEST_CASE("Caches take their nodes from a pool once warmed up") {
+  using namespace CacheImpl;
+  checkSteadyStateDoesNotAllocate<FILOCache<int, int>>();
+  checkSteadyStateDoesNotAllocate<FIFOCache<int, int>>();
+  checkSteadyStateDoesNotAllocate<S3FIFOCache<int, int>>();
+  checkSteadyStateDoesNotAllocate<LFUCache<int, int>>();
+  checkSteadyStateDoesNotAllocate<LRUCache<int, int>>();
+  checkSteadyStateDoesNotAllocate<SLRUCache<int, int>>();
+  checkSteadyStateDoesNotAllocate<ARCCache<int, int>>();
+  checkSteadyStateDoesNotAllocate<TinyLFUCache<int, int>>();
+  checkSteadyStateDoesNotAllocate<
+      LRUCache<int, int, std::hash<int>, FlatHashMapIndex>>();
+  checkSteadyStateDoesNotAllocate<ClockCache<int, int>>();
+  // A cache's nodes are allocated in chunks sized for its capacity
+  std::size_t allocations = g_allocations;
+  {
+    LRUCache<int, int> cache(1000);
+    for (int i = 0; i < 1000; ++i) {
+      cache.put(i, i);
+    }
+  }
+  REQUIRE(g_allocations - allocations < 10);
+}
+
+TEST_CASE("A cache's pool goes away with the cache") {
+  // LFUCache moves recycled nodes to their new key within the hash map,
+  // which must not keep copies of the allocator alive
+  auto pool = std::make_shared<CacheImpl::NodePool>();
+  std::weak_ptr<CacheImpl::NodePool> weak = pool;
+  {
+    CacheImpl::LFUCache<int, int> cache(
+        3, CacheImpl::PoolAllocator<std::pair<const int, int>>(
+               std::move(pool)));
+    for (int i = 0; i < 100; ++i) {
+      cache.put(i, i);
+      cache.getPtr(i - i % 2);
+    }
+  }
+  REQUIRE(weak.expired());
+}
+
+// A cache that was moved from is empty and takes new entries as it is
+template <typename CacheType> void checkReuseAfterMove() {
+  CacheType original(4);
+  for (int i = 0; i < 6; ++i) {
+    original.put(i, i);
+  }
+  CacheType moved(std::move(original));
+  REQUIRE(original.getPtr(5) == nullptr);
+  original.put(6, 6);
+  REQUIRE(*original.getPtr(6) == 6);
+  REQUIRE_FALSE(original.contains(5));
+  REQUIRE(*moved.getPtr(5) == 5);
+  CacheType assigned(4);
+  assigned.put(9, 9);
+  assigned = std::move(moved);
+  REQUIRE(moved.getPtr(5) == nullptr);
+  for (int i = 0; i < 8; ++i) {
+    moved.put(i, i);
+  }
+  REQUIRE(*moved.getPtr(7) == 7);
+  REQUIRE(*assigned.getPtr(5) == 5);
+  REQUIRE_FALSE(assigned.contains(9));
+}
+
+TEST_CASE("Caches indexing their lists move but do not copy") {
+  using namespace CacheImpl;
+  static_assert(!std::is_copy_constructible<BasicLRUCache<int, int>>::value,
+                "a copy would index the lists of the original");
+  static_assert(!std::is_copy_assignable<BasicLRUCache<int, int>>::value,
+                "a copy would index the lists of the original");
+  static_assert(!std::is_copy_constructible<BasicLFUCache<int, int>>::value,
+                "a copy would index the lists of the original");
+  static_assert(!std::is_copy_constructible<BasicSLRUCache<int, int>>::value,
+                "a copy would index the lists of the original");
+  static_assert(!std::is_copy_constructible<BasicARCCache<int, int>>::value,
+                "a copy would index the lists of the original");
+  static_assert(
+      !std::is_copy_constructible<BasicTinyLFUCache<int, int>>::value,
+      "a copy would index the lists of the original");
+  BasicLRUCache<int, int> original(4);
+  original.put(1, 1);
+  original.put(2, 2);
+  BasicLRUCache<int, int> moved(std::move(original));
+  REQUIRE(moved.erase(1));
+  REQUIRE(moved.get(2) == 2);
+  BasicLRUCache<int, int> assigned(1);
+  assigned = std::move(moved);
+  assigned.put(3, 3);
+  REQUIRE(assigned.get(2) == 2);
+  // A copy of a cache whose index holds positions has a pool of its own
+  BasicFIFOCache<int, int> fifo(4);
+  fifo.put(1, 1);
+  BasicFIFOCache<int, int> copy(fifo);
+  REQUIRE(copy.erase(1));
+  copy.put(2, 2);
+  REQUIRE(fifo.get(1) == 1);
+  REQUIRE_FALSE(fifo.contains(2));
+  checkReuseAfterMove<BasicFILOCache<int, int>>();
+  checkReuseAfterMove<BasicFIFOCache<int, int>>();
+  checkReuseAfterMove<BasicS3FIFOCache<int, int>>();
+  checkReuseAfterMove<BasicLFUCache<int, int>>();
+  checkReuseAfterMove<BasicLRUCache<int, int>>();
+  checkReuseAfterMove<BasicSLRUCache<int, int>>();
+  checkReuseAfterMove<BasicARCCache<int, int>>();
+  checkReuseAfterMove<BasicTinyLFUCache<int, int>>();
+  checkReuseAfterMove<BasicIntrusiveLRUCache<int, int>>();
+  checkReuseAfterMove<IntrusiveLRUCache<int, int>>();
+}
+
+// A cache shares no pool with the cache it was moved from, nor with the one
+// it was move-assigned from, so each of them may be used on a thread of its
+// own; ThreadSanitizer catches a pool they still share
+template <typename CacheType> void checkMovedFromOnAnotherThread() {
+  constexpr std::size_t CAPACITY = 64;
+  CacheType original(CAPACITY);
+  original.put(1, 1);
+  CacheType moved(std::move(original));
+  CacheType source(CAPACITY);
+  source.put(1, 1);
+  CacheType assigned(CAPACITY);
+  assigned.put(2, 2);
+  assigned = std::move(source);
+  auto use = [](CacheType *cache) {
+    for (int i = 0; i < 20000; ++i) {
+      cache->put(i % 256, i);
+      cache->getPtr(i % 32);
+      if (i % 7 == 0) {
+        cache->erase(i % 128);
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (CacheType *cache : {&original, &moved, &source, &assigned}) {
+    threads.emplace_back(use, cache);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (CacheType *cache : {&original, &moved, &source, &assigned}) {
+    REQUIRE(cache->getWeight() <= CAPACITY);
+    cache->put(1000, 1000);
+    REQUIRE(*cache->getPtr(1000) == 1000);
+  }
+}
+
+TEST_CASE("Caches moved from share no pool with their targets") {
+  using namespace CacheImpl;
+  checkMovedFromOnAnotherThread<BasicFILOCache<int, int>>();
+  checkMovedFromOnAnotherThread<BasicFIFOCache<int, int>>();
+  checkMovedFromOnAnotherThread<BasicS3FIFOCache<int, int>>();
+  checkMovedFromOnAnotherThread<BasicLFUCache<int, int>>();
+  checkMovedFromOnAnotherThread<BasicLRUCache<int, int>>();
+  checkMovedFromOnAnotherThread<BasicSLRUCache<int, int>>();
+  checkMovedFromOnAnotherThread<BasicARCCache<int, int>>();
+  checkMovedFromOnAnotherThread<BasicTinyLFUCache<int, int>>();
+  checkMovedFromOnAnotherThread<
+      BasicLRUCache<int, int, std::hash<int>, FlatHashMapIndex>>();
+  checkMovedFromOnAnotherThread<
+      BasicFIFOCache<int, int, std::hash<int>, FlatHashMapIndex>>();
+}
+
+// Counts the allocations it passes on to the default resource
+class CountingResource : public std::pmr::memory_resource {
+public:
+  std::size_t m_allocations = 0;
+  std::size_t m_bytes = 0;
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+    ++m_allocations;
+    m_bytes += bytes;
+    return std::pmr::get_default_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void *memory, std::size_t bytes,
+                     std::size_t alignment) override {
+    std::pmr::get_default_resource()->deallocate(memory, bytes, alignment);
+  }
+
+  bool do_is_equal(
+      const std::pmr::memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+};
+
+TEST_CASE("A node pool sizes only its classes of nodes for the capacity") {
+  CountingResource upstream;
+  CacheImpl::NodePool pool(&upstream);
+  pool.expect(10000);
+  // An array of a few pointers, such as a small bucket array, only takes a
+  // small chunk
+  void *array = pool.allocate(8 * sizeof(void *), alignof(void *));
+  REQUIRE(upstream.m_allocations == 1);
+  REQUIRE(upstream.m_bytes < 100 * 8 * sizeof(void *));
+  // A node takes a chunk for all of the nodes expected
+  void *node = pool.allocate(24, alignof(void *), true);
+  REQUIRE(upstream.m_allocations == 2);
+  REQUIRE(upstream.m_bytes > 10000 * 24);
+  for (int i = 1; i < 10000; ++i) {
+    pool.allocate(24, alignof(void *), true);
+  }
+  REQUIRE(upstream.m_allocations == 2);
+  pool.deallocate(node, 24, alignof(void *));
+  pool.deallocate(array, 8 * sizeof(void *), alignof(void *));
+}
+
+TEST_CASE("pmr caches draw their memory from a pool resource") {
+  constexpr std::size_t CAPACITY = 64;
+  std::size_t allocations = g_allocations;
+  CountingResource upstream;
+  CacheImpl::pmr::PoolResource resource(1 << 16, &upstream);
+  CacheImpl::pmr::LRUCache<int, std::string> cache(CAPACITY, &resource);
+  CacheImpl::pmr::BasicLFUCache<int, int> counts(CAPACITY, &resource);
+  // The slots and the queues of S3-FIFO come from the resource too
+  CacheImpl::pmr::S3FIFOCache<int, int> queues(CAPACITY, &resource);
+  for (int i = 0; i < 1000; ++i) {
+    cache.put(i, "value");
+    counts.put(i % 100, i);
+    counts.getPtr(i % 10);
+    queues.put(i % 100, i);
+    queues.getPtr(i % 10);
+  }
+  std::size_t heapAllocations = g_allocations - allocations;
+  // One buffer allocated at the start, and none as the caches evict and
+  // refill
+  REQUIRE(upstream.m_allocations == 1);
+  REQUIRE(heapAllocations == 1);
+  REQUIRE(cache.get(999) == "value");
+  REQUIRE(cache.getWeight() == CAPACITY);
+  REQUIRE(counts.get(5) == 905);
+  REQUIRE(queues.get(5) == 905);
+  std::pmr::unsynchronized_pool_resource pool;
+  CacheImpl::pmr::FIFOCache<int, int, std::hash<int>,
+                            CacheImpl::FlatHashMapIndex>
+      flat(CAPACITY, &pool);
+  flat.put(1, 1);
+  REQUIRE(flat.get(1) == 1);
+}
+
+// A cache of 'CacheType' on one resource is moved to a cache on another
+template <typename CacheType> void checkMoveBetweenResources() {
+  CacheImpl::pmr::PoolResource first(1 << 12);
+  CacheImpl::pmr::PoolResource second(1 << 12);
+  CacheType source(4, &first);
+  CacheType target(4, &second);
+  for (int i = 0; i < 6; ++i) {
+    source.put(i, i);
+  }
+  target.put(9, 9);
+  target = std::move(source);
+  REQUIRE_FALSE(target.contains(9));
+  REQUIRE(target.get(5) == 5);
+  REQUIRE(target.erase(5));
+  target.put(6, 6);
+  REQUIRE(target.get(6) == 6);
+  REQUIRE(target.getWeight() == 4);
+}
+
+TEST_CASE("pmr caches move between resources") {
+  using namespace CacheImpl::pmr;
+  // The lists of these caches would move each entry into nodes of the
+  // target's resource, leaving their index pointing into the source
+  static_assert(!std::is_move_assignable<BasicLRUCache<int, int>>::value,
+                "the index would point into the source");
+  static_assert(!std::is_move_assignable<BasicLFUCache<int, int>>::value,
+                "the index would point into the source");
+  static_assert(!std::is_move_assignable<BasicSLRUCache<int, int>>::value,
+                "the index would point into the source");
+  static_assert(!std::is_move_assignable<BasicARCCache<int, int>>::value,
+                "the index would point into the source");
+  static_assert(!std::is_move_assignable<BasicTinyLFUCache<int, int>>::value,
+                "the index would point into the source");
+  static_assert(
+      std::is_move_assignable<CacheImpl::BasicLRUCache<int, int>>::value,
+      "a PoolAllocator moves along with the nodes");
+  // Moving one constructs the new cache on the same resource
+  PoolResource resource(1 << 12);
+  BasicLRUCache<int, int> source(4, &resource);
+  source.put(1, 1);
+  BasicLRUCache<int, int> moved(std::move(source));
+  moved.put(2, 2);
+  REQUIRE(moved.get(1) == 1);
+  // The index of these holds positions, which stay valid as the entries move
+  checkMoveBetweenResources<BasicFILOCache<int, int>>();
+  checkMoveBetweenResources<BasicFIFOCache<int, int>>();
+  checkMoveBetweenResources<BasicS3FIFOCache<int, int>>();
+}
+
+// The hit ratio of an LRUCache of 'capacity' replaying 'trace'
+double lruHitRatio(const std::vector<int> &trace, std::size_t capacity) {
+  CacheImpl::LRUCache<int, int> cache(capacity);
+  std::size_t hits = 0;
+  for (int key : trace) {
+    if (cache.getPtr(key) != nullptr) {
+      ++hits;
+    } else {
+      cache.put(key, key);
+    }
+  }
+  return static_cast<double>(hits) / static_cast<double>(trace.size());
+}
+
+TEST_CASE("Miss ratio curve matches LRU replays") {
+  std::mt19937 generator(7);
+  // Squaring a uniform variable skews the keys towards small values
+  std::uniform_real_distribution<double> distribution(0.0, 1.0);
+  std::vector<int> trace(300000);
+  for (auto &key : trace) {
+    double x = distribution(generator);
+    key = static_cast<int>(x * x * 50000);
+  }
+  CacheImpl::MissRatioCurve<int> exact;
+  CacheImpl::MissRatioCurve<int> sampled(0.1);
+  CacheImpl::MissRatioCurve<int> bounded(1.0, 2000);
+  for (int key : trace) {
+    exact.access(key);
+    sampled.access(key);
+    bounded.access(key);
+  }
+  REQUIRE(exact.getAccessCount() == trace.size());
+  REQUIRE(bounded.getSamplingRate() < 0.1);
+  for (std::size_t capacity : {1, 10, 100, 1000, 10000, 40000}) {
+    double expected = lruHitRatio(trace, capacity);
+    REQUIRE(exact.hitRatio(capacity) == Approx(expected));
+    REQUIRE(exact.missRatio(capacity) == Approx(1 - expected));
+    REQUIRE(sampled.hitRatio(capacity) == Approx(expected).margin(0.015));
+    REQUIRE(bounded.hitRatio(capacity) == Approx(expected).margin(0.015));
+  }
+  REQUIRE(exact.hitRatio(0) == 0);
+  REQUIRE(CacheImpl::MissRatioCurve<int>().hitRatio(10) == 0);
+}
+
+TEST_CASE("Frequency sketch counts and ages") {
+  CacheImpl::FrequencySketch<int> sketch(64);
+  for (int i = 0; i < 5; ++i) {
+    sketch.increment(1);
+  }
+  sketch.increment(2);
+  REQUIRE(sketch.frequency(1) >= 5);
+  REQUIRE(sketch.frequency(2) >= 1);
+  REQUIRE(sketch.frequency(1) > sketch.frequency(2));
+  for (int i = 0; i < 100; ++i) {
+    sketch.increment(3);
+  }
+  REQUIRE(sketch.frequency(3) == 15); // counters saturate
+  // 640 increments halve every counter
+  for (int i = 0; i < 640; ++i) {
+    sketch.increment(1000 + i);
+  }
+  REQUIRE(sketch.frequency(3) <= 8);
+  sketch.clear();
+  REQUIRE(sketch.frequency(3) == 0);
+  // Resizing keeps the counts, halved
+  for (int i = 0; i < 8; ++i) {
+    sketch.increment(4);
+  }
+  sketch.resize(64);
+  REQUIRE(sketch.frequency(4) >= 8);
+  sketch.resize(1024);
+  REQUIRE(sketch.frequency(4) >= 4);
+  REQUIRE(sketch.frequency(4) > sketch.frequency(5));
+  sketch.resize(16);
+  REQUIRE(sketch.frequency(4) >= 2);
+}
+
+TEST_CASE("TinyLFU Test 1 with integers as keys") {
+  CacheImpl::TinyLFUCache<int, int> cache(3);
+  cache.put(1, 1);
+  cache.put(2, 2);
+  cache.put(1, 15);
+  REQUIRE(cache.get(1) == 15);
+  REQUIRE(cache.contains(2));
+  REQUIRE(cache.erase(2));
+  REQUIRE_THROWS_AS(cache.get(2), std::invalid_argument);
+  for (int i = 3; i < 100; ++i) {
+    cache.put(i, i);
+  }
+  // Key 1 was seen twice and every other key once, so it is never evicted
+  REQUIRE(cache.get(1) == 15);
+  int residents = 0;
+  for (int i = 0; i < 100; ++i) {
+    residents += cache.contains(i) ? 1 : 0;
+  }
+  REQUIRE(residents == 3);
+  // Setting the same capacity keeps the frequencies, so key 1 still wins
+  cache.setCapacity(3);
+  for (int i = 100; i < 200; ++i) {
+    cache.put(i, i);
+  }
+  REQUIRE(cache.get(1) == 15);
+  cache.setCapacity(1);
+  REQUIRE_FALSE((cache.contains(1) && cache.contains(99)));
+  cache.clear();
+  REQUIRE_FALSE(cache.contains(1));
+  CacheImpl::TinyLFUCache<int, int> empty(0);
+  empty.put(1, 1);
+  REQUIRE_FALSE(empty.contains(1));
+}
+
+// The hit ratio of 'cache' on a popular set of keys mixed with keys that are
+// seen only once, first with one popular set and then with another
+template <typename CacheType> std::pair<double, double> scanHitRatios() {
+  CacheType cache(100);
+  std::mt19937 generator(3);
+  std::uniform_int_distribution<int> popular(0, 79);
+  int next = 1000000;
+  std::size_t hits[2] = {0, 0};
+  for (int phase = 0; phase < 2; ++phase) {
+    for (int i = 0; i < 50000; ++i) {
+      int key = i % 2 == 0 ? popular(generator) + phase * 1000 : next++;
+      if (cache.getPtr(key) != nullptr) {
+        ++hits[phase];
+      } else {
+        cache.put(key, key);
+      }
+    }
+  }
+  return std::make_pair(hits[0] / 50000.0, hits[1] / 50000.0);
+}
+
+TEST_CASE("TinyLFU keeps popular keys through one-hit wonders") {
+  auto lru = scanHitRatios<CacheImpl::LRUCache<int, int>>();
+  auto lfu = scanHitRatios<CacheImpl::LFUCache<int, int>>();
+  auto tinyLFU = scanHitRatios<CacheImpl::TinyLFUCache<int, int>>();
+  REQUIRE(tinyLFU.first > 0.45);
+  REQUIRE(tinyLFU.first > lru.first + 0.1);
+  // Aging lets the second popular set replace the first, which exact LFU
+  // counts only allow once the old keys' counts are matched
+  REQUIRE(tinyLFU.second > 0.45);
+  REQUIRE(tinyLFU.second > lfu.second);
+}
+
+TEST_CASE("S3-FIFO Test 1 with integers as keys") {
+  CacheImpl::S3FIFOCache<int, int> cache(10);
+  for (int i = 1; i <= 10; ++i) {
+    cache.put(i, i);
+  }
+  REQUIRE(cache.get(1) == 1);
+  // Key 1 was hit in the small queue, so it moves to the main queue, and key
+  // 2 is evicted instead
+  cache.put(11, 11);
+  REQUIRE(cache.contains(1));
+  REQUIRE_FALSE(cache.contains(2));
+  // Key 2 is still a ghost, so it goes to the main queue and key 3 is evicted
+  cache.put(2, 2);
+  REQUIRE(cache.contains(2));
+  REQUIRE_FALSE(cache.contains(3));
+  cache.put(1, 100);
+  REQUIRE(cache.get(1) == 100);
+  REQUIRE(cache.erase(4));
+  REQUIRE_THROWS_AS(cache.get(4), std::invalid_argument);
+  cache.put(12, 12); // takes the erased slot without evicting
+  REQUIRE(cache.contains(5));
+  cache.setCapacity(2); // evicts the whole small queue
+  REQUIRE(cache.contains(1));
+  REQUIRE(cache.contains(2));
+  // The main queue reinserts key 1, which was hit, and evicts key 2
+  cache.put(13, 13);
+  REQUIRE(cache.contains(1));
+  REQUIRE(cache.contains(13));
+  REQUIRE_FALSE(cache.contains(2));
+  cache.clear();
+  REQUIRE_FALSE(cache.contains(1));
+  CacheImpl::S3FIFOCache<int, int> empty(0);
+  empty.put(1, 1);
+  REQUIRE_FALSE(empty.contains(1));
+}
+
+TEST_CASE("S3-FIFO stays consistent under erase") {
+  constexpr std::size_t CAPACITY = 50;
+  CacheImpl::S3FIFOCache<int, int> cache(CAPACITY);
+  std::mt19937 generator(5);
+  std::uniform_int_distribution<int> keys(0, 199);
+  for (int i = 0; i < 100000; ++i) {
+    int key = keys(generator);
+    switch (i % 4) {
+    case 0:
+      cache.erase(key);
+      break;
+    case 1:
+      if (auto value = cache.tryGet(key)) {
+        REQUIRE(*value == key);
+      }
+      break;
+    default:
+      cache.put(key, key);
+    }
+  }
+  std::size_t cached = 0;
+  for (int key = 0; key < 200; ++key) {
+    cached += cache.contains(key) ? 1 : 0;
+  }
+  REQUIRE(cached <= CAPACITY);
+  REQUIRE(cached > CAPACITY / 2);
+  // Erased and evicted entries release their values at once
+  auto value = std::make_shared<int>(1);
+  CacheImpl::S3FIFOCache<int, std::shared_ptr<int>> values(2);
+  values.put(1, value);
+  REQUIRE(values.erase(1));
+  REQUIRE(value.use_count() == 1);
+  values.put(2, value);
+  values.put(3, nullptr);
+  values.put(4, nullptr);
+  REQUIRE_FALSE(values.contains(2));
+  REQUIRE(value.use_count() == 1);
+}
+
+TEST_CASE("S3-FIFO with a huge capacity grows its queues as it fills") {
+  // The slots and the queues are made for a bounded number of entries up
+  // front, however large the capacity
+  constexpr int COUNT = 200000;
+  for (std::size_t capacity :
+       {std::size_t(100000000), std::numeric_limits<std::size_t>::max()}) {
+    CacheImpl::S3FIFOCache<int, int> cache(capacity);
+    for (int i = 0; i < COUNT; ++i) {
+      cache.put(i, i);
+    }
+    REQUIRE(cache.getWeight() == COUNT);
+    for (int i = 0; i < COUNT; ++i) {
+      REQUIRE(cache.get(i) == i);
+    }
+    cache.setCapacity(COUNT / 2);
+    REQUIRE(cache.getWeight() == COUNT / 2);
+  }
+}
+
+TEST_CASE("SLRU Test 1 with integers as keys") {
+  CacheImpl::SLRUCache<int, int> cache(4, 0.5);
+  REQUIRE(cache.getProtectedRatio() == 0.5);
+  for (int i = 1; i <= 4; ++i) {
+    cache.put(i, i);
+  }
+  REQUIRE(cache.get(1) == 1); // promotes key 1
+  REQUIRE(cache.get(2) == 2); // promotes key 2
+  cache.put(5, 5);            // evicts key 3, the oldest probationary key
+  REQUIRE_FALSE(cache.contains(3));
+  cache.put(6, 6); // evicts key 4
+  REQUIRE_FALSE(cache.contains(4));
+  REQUIRE(cache.get(5) == 5); // promotes key 5 and demotes key 1
+  cache.put(7, 7);            // evicts key 6
+  cache.put(8, 8);            // evicts key 1
+  REQUIRE_FALSE(cache.contains(6));
+  REQUIRE_FALSE(cache.contains(1));
+  REQUIRE(cache.get(2) == 2);
+  cache.put(2, 20);
+  REQUIRE(cache.get(2) == 20);
+  REQUIRE(cache.erase(2));
+  REQUIRE_THROWS_AS(cache.get(2), std::invalid_argument);
+  cache.setCapacity(1);
+  REQUIRE(cache.contains(5));
+  cache.clear();
+  REQUIRE_FALSE(cache.contains(5));
+  // Without a protected segment, the cache evicts in LRU order
+  CacheImpl::SLRUCache<int, int> lru(2, 0.0);
+  lru.put(1, 1);
+  lru.put(2, 2);
+  REQUIRE(lru.get(1) == 1);
+  lru.put(3, 3); // evicts key 2
+  REQUIRE_FALSE(lru.contains(2));
+  REQUIRE(lru.contains(1));
+  CacheImpl::SLRUCache<int, int> empty(0);
+  empty.put(1, 1);
+  REQUIRE_FALSE(empty.contains(1));
+}
+
+TEST_CASE("ARC Test 1 with integers as keys") {
+  CacheImpl::ARCCache<int, int> cache(3);
+  cache.put(1, 1);
+  cache.put(2, 2);
+  cache.put(3, 3);
+  REQUIRE(cache.get(1) == 1); // moves key 1 to the frequent list
+  cache.put(4, 4);            // evicts key 2, the oldest key seen once
+  REQUIRE_FALSE(cache.contains(2));
+  REQUIRE_THROWS_AS(cache.get(2), std::invalid_argument);
+  cache.put(2, 20); // a ghost hit brings key 2 back as a frequent entry
+  REQUIRE(cache.get(2) == 20);
+  REQUIRE(cache.get(1) == 1);
+  int residents = 0;
+  for (int i = 1; i <= 4; ++i) {
+    residents += cache.contains(i) ? 1 : 0;
+  }
+  REQUIRE(residents == 3);
+  cache.put(1, 10);
+  REQUIRE(cache.get(1) == 10);
+  REQUIRE(cache.erase(1));
+  REQUIRE_FALSE(cache.erase(1));
+  // The ghost hit on key 2 let the recent list grow to one entry, so the
+  // frequent list gives up key 2 when shrinking
+  cache.setCapacity(1);
+  REQUIRE(cache.tryGet(4) == std::optional<int>(4));
+  REQUIRE_FALSE(cache.contains(2));
+  cache.clear();
+  REQUIRE_FALSE(cache.contains(2));
+  CacheImpl::ARCCache<int, int> empty(0);
+  empty.put(1, 1);
+  REQUIRE_FALSE(empty.contains(1));
+}
+
+// Replays a hot set, then a scan of keys seen once, then the hot set again,
+// and returns the hit ratio of the last pass
+template <typename CacheType> double hotSetHitRatioAfterScan() {
+  constexpr int HOT_KEYS = 500;
+  CacheType cache(1000);
+  auto access = [&cache](int key) {
+    if (cache.getPtr(key) != nullptr) {
+      return true;
+    }
+    cache.put(key, key);
+    return false;
+  };
+  for (int pass = 0; pass < 3; ++pass) {
+    for (int key = 0; key < HOT_KEYS; ++key) {
+      access(key);
+    }
+  }
+  for (int key = 1000000; key < 1100000; ++key) {
+    access(key);
+  }
+  int hits = 0;
+  for (int key = 0; key < HOT_KEYS; ++key) {
+    hits += access(key) ? 1 : 0;
+  }
+  return static_cast<double>(hits) / HOT_KEYS;
+}
+
+TEST_CASE("ARC keeps the hot set through a scan") {
+  REQUIRE(hotSetHitRatioAfterScan<CacheImpl::LRUCache<int, int>>() == 0.0);
+  REQUIRE(hotSetHitRatioAfterScan<CacheImpl::ARCCache<int, int>>() == 1.0);
+  // The popular keys of a mixed workload also stay cached
+  auto arc = scanHitRatios<CacheImpl::ARCCache<int, int>>();
+  auto lru = scanHitRatios<CacheImpl::LRUCache<int, int>>();
+  REQUIRE(arc.first > lru.first + 0.1);
+  REQUIRE(arc.second > lru.second + 0.1);
+}
+
+TEST_CASE("S3-FIFO keeps the hot set through a scan") {
+  REQUIRE(hotSetHitRatioAfterScan<CacheImpl::S3FIFOCache<int, int>>() > 0.9);
+  REQUIRE(hotSetHitRatioAfterScan<CacheImpl::FIFOCache<int, int>>() == 0.0);
+  auto s3fifo = scanHitRatios<CacheImpl::S3FIFOCache<int, int>>();
+  auto lru = scanHitRatios<CacheImpl::LRUCache<int, int>>();
+  REQUIRE(s3fifo.first > lru.first + 0.1);
+  REQUIRE(s3fifo.second > lru.second + 0.1);
+}
+
+TEST_CASE("SLRU keeps the hot set through a scan") {
+  REQUIRE(hotSetHitRatioAfterScan<CacheImpl::SLRUCache<int, int>>() == 1.0);
+  auto slru = scanHitRatios<CacheImpl::SLRUCache<int, int>>();
+  auto lru = scanHitRatios<CacheImpl::LRUCache<int, int>>();
+  REQUIRE(slru.first > lru.first + 0.1);
+  REQUIRE(slru.second > lru.second + 0.1);
+}
+
+TEST_CASE("LRU tryGet refreshes recency like get") {
+  constexpr std::size_t CAPACITY = 2;
+  auto cache = CacheImpl::LRUCache<int, int>(CAPACITY);
+  cache.put(1, 1);
+  cache.put(2, 2);
+  REQUIRE(cache.tryGet(1).has_value());
+  cache.put(3, 3); // evicts key 2
+  REQUIRE_FALSE(cache.tryGet(2).has_value());
+  REQUIRE(cache.tryGet(1) == std::optional<int>(1));
+}
+
+TEST_CASE("LRU hits and updates relink nodes without allocating") {
+  constexpr std::size_t CAPACITY = 3;
+  auto cache = CacheImpl::LRUCache<int, std::string>(CAPACITY);
+  cache.put(1, std::string(1000, 'a'));
+  cache.put(2, std::string(1000, 'b'));
+  cache.put(3, std::string(1000, 'c'));
+  std::string *value = cache.getPtr(1);
+  std::string update(1000, 'd');
+  std::size_t allocations = g_allocations;
+  REQUIRE(cache.getPtr(2) != nullptr);
+  REQUIRE(cache.getPtr(1) == value);
+  cache.put(3, update);
+  REQUIRE(g_allocations == allocations);
+  cache.put(4, "e"); // evicts key 2
+  REQUIRE_FALSE(cache.tryGet(2).has_value());
+  REQUIRE(*cache.getPtr(1) == std::string(1000, 'a'));
+  REQUIRE(cache.get(3) == update);
+}
+
+TEST_CASE("Intrusive LRU Test 1 with integers as keys") {
+  constexpr std::size_t CAPACITY = 2;
+  auto cache =
+      std::make_shared<CacheImpl::IntrusiveLRUCache<int, int>>(CAPACITY);
+  cache->put(1, 1);
+  cache->put(2, 2);
+  REQUIRE(cache->get(1) == 1);
+  cache->put(3, 3); // evicts key 2
+  REQUIRE_THROWS_AS(cache->get(2), std::invalid_argument);
+  cache->put(1, 10);
+  cache->put(4, 4); // evicts key 3
+  REQUIRE_FALSE(cache->tryGet(3).has_value());
+  REQUIRE(cache->get(1) == 10);
+  REQUIRE(cache->get(4) == 4);
+  cache->clear();
+  REQUIRE_FALSE(cache->tryGet(1).has_value());
+  cache->put(5, 5);
+  REQUIRE(cache->get(5) == 5);
+}
+
+TEST_CASE("Intrusive LRU put with eviction does not allocate") {
+  constexpr std::size_t CAPACITY = 100;
+  CacheImpl::IntrusiveLRUCache<int, int> cache(CAPACITY);
+  for (int i = 0; i < 1000; ++i) {
+    cache.put(i, i);
+  }
+  std::size_t allocations = g_allocations;
+  for (int i = 1000; i < 5000; ++i) {
+    cache.put(i, i);
+    cache.getPtr(i - 50);
+  }
+  REQUIRE(g_allocations == allocations);
+  REQUIRE(cache.get(4999) == 4999);
+  REQUIRE(cache.get(4950) == 4950);
+  REQUIRE_FALSE(cache.tryGet(4800).has_value());
+}
+
+TEST_CASE("Intrusive LRU Test 2 with std::strings as keys") {
+  constexpr std::size_t CAPACITY = 40;
+  CacheImpl::IntrusiveLRUCache<std::string, std::string> cache(CAPACITY);
+  for (int i = 0; i < 100; ++i) {
+    cache.put(std::to_string(i), std::to_string(i * 2));
+  }
+  REQUIRE_FALSE(cache.tryGet("59").has_value());
+  for (int i = 60; i < 100; ++i) {
+    REQUIRE(cache.get(std::to_string(i)) == std::to_string(i * 2));
+  }
+}
+
+TEST_CASE("Sharded cache splits the capacity over its shards") {
+  CacheImpl::ShardedCache<CacheImpl::LRUCache, int, int> cache(10, 4);
+  REQUIRE(cache.getCapacity() == 10);
+  REQUIRE(cache.getShardCount() == 4);
+  for (int i = 0; i < 100; ++i) {
+    cache.put(i, i);
+  }
+  std::size_t cached = 0;
+  for (int i = 0; i < 100; ++i) {
+    cached += cache.tryGet(i).has_value() ? 1 : 0;
+  }
+  REQUIRE(cached <= 10);
+  REQUIRE(cache.get(99) == 99);
+  REQUIRE_THROWS_AS(cache.get(-1), std::invalid_argument);
+  cache.clear();
+  int value = 0;
+  REQUIRE_FALSE(cache.tryGet(99, value));
+  CacheImpl::ShardedCache<CacheImpl::LFUCache, int, int> small(2, 8);
+  REQUIRE(small.getShardCount() == 2);
+  CacheImpl::ShardedCache<CacheImpl::FIFOCache, int, int> empty(0);
+  empty.put(1, 1);
+  REQUIRE_FALSE(empty.tryGet(1).has_value());
+}
+
+TEST_CASE("Sharded cache is safe to share between threads") {
+  constexpr std::size_t CAPACITY = 1000;
+  CacheImpl::ShardedCache<CacheImpl::FILOCache, int, int> cache(CAPACITY, 8);
+  // Catch2 assertions are not thread-safe, so the threads only count errors
+  std::atomic<int> wrongValues(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&cache, &wrongValues, t] {
+      for (int i = 0; i < 10000; ++i) {
+        int key = (i * 7 + t) % 2000;
+        if (auto value = cache.tryGet(key)) {
+          wrongValues += *value == key * 2 ? 0 : 1;
+        } else {
+          cache.put(key, key * 2);
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(wrongValues == 0);
+  std::size_t cached = 0;
+  for (int key = 0; key < 2000; ++key) {
+    cached += cache.tryGet(key).has_value() ? 1 : 0;
+  }
+  REQUIRE(cached <= CAPACITY);
+}
+
+TEST_CASE("Clock cache gives referenced entries a second chance") {
+  constexpr std::size_t CAPACITY = 3;
+  CacheImpl::ClockCache<int, int> cache(CAPACITY);
+  REQUIRE(cache.getCapacity() == CAPACITY);
+  cache.put(1, 1);
+  cache.put(2, 2);
+  cache.put(3, 3);
+  REQUIRE(cache.get(1) == 1);
+  cache.put(4, 4); // the hand skips key 1 and evicts key 2
+  REQUIRE_FALSE(cache.tryGet(2).has_value());
+  REQUIRE(cache.get(1) == 1);
+  cache.put(3, 30);
+  cache.put(5, 5); // evicts key 4, the only entry not referenced since
+  int value = 0;
+  REQUIRE_FALSE(cache.tryGet(4, value));
+  REQUIRE(cache.tryGet(3, value));
+  REQUIRE(value == 30);
+  REQUIRE_THROWS_AS(cache.get(4), std::invalid_argument);
+  cache.clear();
+  REQUIRE_FALSE(cache.tryGet(1).has_value());
+  cache.put(6, 6);
+  REQUIRE(cache.get(6) == 6);
+  CacheImpl::ClockCache<int, int> empty(0);
+  empty.put(1, 1);
+  REQUIRE_FALSE(empty.tryGet(1).has_value());
+}
+
+TEST_CASE("Clock cache is safe to share between threads") {
+  constexpr std::size_t CAPACITY = 500;
+  CacheImpl::ClockCache<int, int> cache(CAPACITY);
+  std::atomic<int> wrongValues(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&cache, &wrongValues, t] {
+      for (int i = 0; i < 10000; ++i) {
+        int key = (i * 13 + t) % 1000;
+        if (auto value = cache.tryGet(key)) {
+          wrongValues += *value == -key ? 0 : 1;
+        } else {
+          cache.put(key, -key);
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(wrongValues == 0);
+}
+
+TEST_CASE("Clock cache hits see whole entries while writers replace them") {
+  constexpr std::size_t CAPACITY = 64;
+  CacheImpl::ClockCache<int, std::string> cache(CAPACITY);
+  std::atomic<bool> done(false);
+  std::atomic<int> wrongValues(0);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 3; ++t) {
+    readers.emplace_back([&] {
+      while (!done) {
+        for (int key = 0; key < 128; ++key) {
+          if (auto value = cache.tryGet(key)) {
+            wrongValues += *value == std::string(key % 40 + 1, 'a' + key % 26)
+                               ? 0
+                               : 1;
+          }
+        }
+      }
+    });
+  }
+  // Updates, evictions, erasures and clears retire entries, and the erased
+  // buckets make the index rebuild itself
+  for (int i = 0; i < 20000; ++i) {
+    int key = (i * 7) % 128;
+    cache.put(key, std::string(key % 40 + 1, 'a' + key % 26));
+    if (i % 5 == 0) {
+      cache.erase((i * 3) % 128);
+    }
+    if (i % 5000 == 4999) {
+      cache.clear();
+    }
+  }
+  done = true;
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  REQUIRE(wrongValues == 0);
+  REQUIRE(cache.getWeight() <= CAPACITY);
+}
+
+// A clock that only moves when a test sets it
+struct ManualClock {
+  using duration = std::chrono::milliseconds;
+  using rep = duration::rep;
+  using period = duration::period;
+  using time_point = std::chrono::time_point<ManualClock>;
+  static constexpr bool is_steady = true;
+
+  static inline time_point current{};
+
+  static time_point now() { return current; }
+};
+
+template <typename K, typename V>
+using ExpiringLRUCache =
+    CacheImpl::ExpiringCache<CacheImpl::LRUCache, K, V, std::hash<K>,
+                             ManualClock>;
+
+TEST_CASE("Expiring cache drops entries once their ttl has passed") {
+  using std::chrono::milliseconds;
+  ExpiringLRUCache<int, int> cache(10);
+  cache.put(1, 10, milliseconds(100));
+  cache.put(2, 20);
+  cache.put(3, 30, milliseconds(50));
+  ManualClock::current += milliseconds(49);
+  REQUIRE(cache.contains(3));
+  REQUIRE(cache.get(3) == 30);
+  ManualClock::current += milliseconds(1);
+  REQUIRE(!cache.contains(3));
+  REQUIRE(!cache.tryGet(3));
+  REQUIRE_THROWS_AS(cache.get(3), std::invalid_argument);
+  REQUIRE(cache.get(1) == 10);
+  // A new ttl replaces the old one, and a put() without one keeps the entry
+  cache.put(1, 11, milliseconds(100));
+  cache.put(4, 40, milliseconds(10));
+  cache.put(4, 41);
+  ManualClock::current += milliseconds(60);
+  REQUIRE(cache.get(1) == 11);
+  REQUIRE(cache.get(2) == 20);
+  REQUIRE(cache.get(4) == 41);
+  ManualClock::current += milliseconds(40);
+  REQUIRE(!cache.contains(1));
+  REQUIRE(cache.contains(2));
+  REQUIRE(cache.contains(4));
+  cache.put(5, 50, milliseconds(10));
+  REQUIRE(cache.erase(5));
+  REQUIRE(!cache.erase(5));
+}
+
+TEST_CASE("Expiring cache erases expired entries before evicting live ones") {
+  using std::chrono::milliseconds;
+  ExpiringLRUCache<int, int> cache(3);
+  cache.put(1, 10, milliseconds(10));
+  cache.put(2, 20, milliseconds(10));
+  cache.put(3, 30);
+  // 3 is now the least recently used entry
+  cache.get(1);
+  cache.get(2);
+  ManualClock::current += milliseconds(20);
+  cache.put(4, 40);
+  REQUIRE(cache.getWeight() == 2);
+  REQUIRE(cache.get(3) == 30);
+  REQUIRE(cache.get(4) == 40);
+}
+
+TEST_CASE("Expiring cache expires ttls across all levels of the wheel") {
+  using std::chrono::milliseconds;
+  constexpr int KEYS = 2000;
+  ExpiringLRUCache<int, int> cache(KEYS + 1);
+  std::unordered_map<int, ManualClock::time_point> deadlines;
+  std::mt19937 gen(7);
+  // From a millisecond up to past the span of the wheel, about 12 days
+  std::uniform_int_distribution<int> level(0, 6);
+  std::uniform_int_distribution<int> key(0, KEYS - 1);
+  std::uniform_int_distribution<int> step(0, 5000);
+  for (int i = 0; i < 20000; ++i) {
+    int k = key(gen);
+    milliseconds ttl(std::uniform_int_distribution<long long>(
+        0, 1LL << (6 * level(gen)))(gen));
+    cache.put(k, k, ttl);
+    deadlines[k] = ManualClock::current + ttl;
+    // Mostly small steps, with an occasional jump of hours
+    ManualClock::current +=
+        milliseconds(i % 1000 == 0 ? 1LL << 24 : step(gen));
+    cache.put(-1, -1);
+    std::size_t live = 1;
+    for (auto &[k2, deadline] : deadlines) {
+      live += deadline > ManualClock::current ? 1 : 0;
+    }
+    // The put() above erased every expired entry
+    REQUIRE(cache.getWeight() == live);
+    for (int probe = 0; probe < 3; ++probe) {
+      int k2 = key(gen);
+      auto found = deadlines.find(k2);
+      bool alive = found != deadlines.end() &&
+                   found->second > ManualClock::current;
+      REQUIRE(cache.contains(k2) == alive);
+    }
+  }
+}
 #else
 
 #include <iostream>